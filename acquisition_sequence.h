@@ -0,0 +1,77 @@
+#ifndef ACQUISITION_SEQUENCE_H
+#define ACQUISITION_SEQUENCE_H
+
+/**
+* @brief Powers gated sensors only around the acquisition window before a sample, see SensorPower.
+* Every sensor needs MEDIAN_WINDOW bursts right before the sample, one per interval, and SETTLE_MS after powering it before its first burst.
+* Each sensor is therefore powered SETTLE_MS + MEDIAN_WINDOW * interval ahead of the sample, so the settling of a slow sensor overlaps
+* the bursts of the others and the acquisition window stays as long as the longest of them, instead of growing by the sum of the settling times.
+* @note The per-sensor state lives in a Gate owned by the caller, so the sequence works on sensor types without knowing them up front.
+*/
+class AcquisitionSequence{
+  unsigned long interval;
+  uint32_t sample_at;
+public:
+  /**
+  * @brief Power state of one sensor.
+  */
+  struct Gate{
+    uint32_t powered_at;
+    bool powered;
+
+    Gate() : powered_at(0), powered(false) {}
+  };
+
+  AcquisitionSequence() : interval(0), sample_at(0) {}
+
+  /**
+  * @brief Plans the acquisition of the sample due at sample_at.
+  * @param interval Period of the step() calls in ms.
+  */
+  void plan(uint32_t sample_at, unsigned long interval) {
+    this->sample_at = sample_at;
+    this->interval = interval;
+  }
+  /**
+  * @returns unsigned long The time in ms the sensor needs ahead of the sample, to settle and to fill its median filter.
+  */
+  template <class Sensor>
+  unsigned long lead_ms() const {
+    return Sensor::SETTLE_MS + this->window_ms<Sensor>();
+  }
+  template <class Sensor>
+  unsigned long window_ms() const {
+    return Sensor::MEDIAN_WINDOW * this->interval;
+  }
+  /**
+  * @returns bool Whether the planned sample is at most lead ms ahead, for sensors outside the power gating, e.g. to start an I2C conversion.
+  */
+  bool is_due(unsigned long lead, uint32_t now) const {
+    return (int32_t)(now - (this->sample_at - lead)) >= 0;
+  }
+  /**
+  * @brief Powers the sensor once its lead time before the sample is reached. Call periodically, every interval.
+  * @returns bool Whether the sensor is settled and within its window, i.e. whether its reading belongs into the median filter.
+  */
+  template <class Sensor>
+  bool step(Gate& gate, uint32_t now) {
+    if(!gate.powered){
+      if(!this->is_due(this->lead_ms<Sensor>(), now)) return false;
+      Sensor::Power::power_on();
+      gate.powered = true;
+      gate.powered_at = now;
+    }
+    if(now - gate.powered_at < Sensor::SETTLE_MS) return false;
+    return this->is_due(this->window_ms<Sensor>(), now);
+  }
+  /**
+  * @brief Switches the sensor off until the next planned acquisition.
+  */
+  template <class Sensor>
+  void stop(Gate& gate) {
+    Sensor::Power::power_off();
+    gate.powered = false;
+  }
+};
+
+#endif
@@ -1,51 +1,208 @@
 #ifndef ACTION_DECIDER_H
 #define ACTION_DECIDER_H
 
+#include "hal.h"
+#include "config.h"
 #include "analog_sensors.h"
 #include "pump_driver.h"
+#include "sensor_frame.h"
+#include "decision_table.h"
+#include "acquisition_sequence.h"
+#include "i2c_sensors.h"
+#include "sensor_health.h"
+#include "sensor_channel.h"
+
+/**
+* @brief Runs an expression once per element of a pack, in order: (void)PackSwallow{ 0, (expression, 0)... }.
+* The expansion inside a braced list is evaluated left to right, C++11 has no fold expressions. The leading 0 keeps the array from being empty.
+*/
+typedef int PackSwallow[];
 
 /**
 * @brief Contains all logic for determining when to run the pump
-* @note Pins A4 and A5 are reserved for possible I2C sensors.
+* Composed at compile time of the Rules and one sensor channel per SensorSlot, see SensorChannelBase. Every per-sensor step is a pack expansion
+* over the channels, inlined, so adding or removing a sensor is a change of the channel list, e.g. a ConstantChannel in place of a faulty sensor,
+* and no code or data is generated for a sensor which is not in it.
+* @tparam Rules Policy providing static constexpr bool decide(sm_state, ph_state, wl_state, wd_state, fallback), compiled into DecisionTables, e.g. WateringRules.
+* @tparam Channels The sensor channels, one per SensorSlot, each slot exactly once. The rules decide on the states of all four slots.
+* @note Pins A4 and A5 are reserved for I2C sensors, see I2C_PH_SENSOR.
 */
-class ActionDecider{
+template <class Rules, class... Channels>
+class ActionDecider : private Channels...{
+  static_assert(ChannelList<Channels...>::UNIQUE, "Two sensor channels share a SensorSlot.");
+  static_assert(ChannelList<Channels...>::SLOT_MASK == (1U << SENSOR_SLOT_COUNT) - 1, "Every SensorSlot needs a sensor channel.");
+public:
+  /**
+  * @brief Result of the closed-loop watering check.
+  */
+  enum WateringCheck{
+    WATERING_CONTINUE = 0,
+    // The soil moisture reached the OK band, or is wetter.
+    WATERING_TARGET_REACHED = 1,
+    // Water reached the bottom of the pot while watering.
+    WATERING_OVERFLOW = 2,
+    // One of the sensors reports an invalid state, stop as in DecideAction.
+    WATERING_SENSOR_INVALID = 3
+  };
 private:
-  static constexpr unsigned int SM_PIN = A1;
-  SoilMoistureSensor sm;
-  // PH sensor currently faulty (reads a constant PH value of around 8.6 without regard of the actual PH value of the water, tested with copious amounts of citric acid...), use a hardcoded OK instead...
-//  static constexpr unsigned int PH_PIN = A2;
-//  PHSensor ph;
-  static constexpr unsigned int WL_PIN = A3;
-  WaterLevelSensor wl;
-  static constexpr unsigned int WD_PIN = A6;
-  WaterDetectionSensor wd;
+  static constexpr unsigned char PD_PIN = PUMP_PIN;
+  typedef PumpDriver<PD_PIN> Pump;
+  Pump pd;
+
+  // Powers the sensors around their acquisition, see PlanAcquisition().
+  AcquisitionSequence sequence;
+
+  // Readings of the last Sample() call.
+  SensorFrame frame;
+
+  // Water detection state at the start of the current watering, see CheckWatering().
+  SensorStateLevel watering_start_wd;
+
+#if SENSOR_HEALTH
+  MoistureCrossCheck cross_check;
+#endif
 
+  typedef DecisionTable<Rules> Table;
+  static_assert(Table::matches_rules(), "The packed decision table does not read back as the Rules.");
+#if SENSOR_HEALTH
+  typedef DecisionTable<FallbackRules<Rules, RULES_IGNORE_PH> > IgnorePhTable;
+  typedef DecisionTable<FallbackRules<Rules, RULES_CONSERVATIVE> > ConservativeTable;
+  typedef DecisionTable<FallbackRules<Rules, RULES_IGNORE_PH | RULES_CONSERVATIVE> > ConservativeIgnorePhTable;
+  static_assert(IgnorePhTable::matches_rules() && ConservativeTable::matches_rules() && ConservativeIgnorePhTable::matches_rules(),
+    "A packed fallback decision table does not read back as the Rules.");
+#endif
 
-  static constexpr unsigned int PD_PIN = 2;
-  PumpDriver pd;
+#if ADC_ISR_ACQUISITION
+  static_assert(sizeof...(Channels) <= AdcAcquisition::MAX_CHANNELS, "More sensor channels than the AdcAcquisition engine converts.");
+#endif
+
+  static unsigned long longer(unsigned long a, unsigned long b) {
+    return a > b ? a : b;
+  }
 public:
   ActionDecider()
-  : sm(SM_PIN),
-//  ph(PH_PIN),
-    wl(WL_PIN),
-    wd(WD_PIN),
-    pd(PD_PIN)
+  : Channels()...,
+    pd(),
+    sequence(),
+    frame(),
+#if SENSOR_HEALTH
+    watering_start_wd(SensorStateLevel::OK),
+    cross_check()
+#else
+    watering_start_wd(SensorStateLevel::OK)
+#endif
     {
 
     }
+  /**
+  * @brief Starts the sensor acquisition, call once from setup().
+  */
+  void Begin(){
+    (void)PackSwallow{ 0, (static_cast<Channels&>(*this).begin(), 0)... };
+#if ADC_ISR_ACQUISITION
+    // The analog channels, in channel order.
+    unsigned char pins[sizeof...(Channels)];
+    unsigned char bits[sizeof...(Channels)];
+    unsigned char count = 0;
+    (void)PackSwallow{ 0, (count = static_cast<const Channels&>(*this).adc_pins(pins, bits, count), 0)... };
+    AdcAcquisition::begin(pins, bits, count);
+#endif
+  }
+  /**
+  * @brief Plans the acquisition for the sample due at sample_at, see AcquisitionSequence.
+  * @param interval Period of the Acquire() calls in ms.
+  * @returns unsigned long The time in ms ahead of the sample at which Acquire() has to start being called.
+  */
+  unsigned long PlanAcquisition(uint32_t sample_at, unsigned long interval){
+    sequence.plan(sample_at, interval);
+    unsigned long lead = 0;
+    (void)PackSwallow{ 0, (lead = longer(lead, static_cast<Channels&>(*this).plan(sequence, interval)), 0)... };
+    return lead;
+  }
+  /**
+  * @brief Pushes one oversampled burst per sensor into the median filters. Call periodically, a lot more often than Sample().
+  * Sensors are powered according to the planned acquisition, only settled sensors within their window are pushed.
+  * @note With ADC_ISR_ACQUISITION the bursts are copied from the last complete sweep of the AdcAcquisition engine, without waiting for a conversion.
+  */
+  void Acquire(){
+    uint32_t now = millis();
+#if ADC_ISR_ACQUISITION
+    unsigned int sweep[sizeof...(Channels)];
+    AdcAcquisition::snapshot(sweep, sizeof...(Channels));
+#else
+    const unsigned int* sweep = nullptr;
+#endif
+    unsigned char index = 0;
+    (void)PackSwallow{ 0, (static_cast<Channels&>(*this).acquire(sequence, now, sweep, index), 0)... };
+  }
+  /**
+  * @brief Switches the gated sensors off until the next planned acquisition. Call once the readings are no longer needed, i.e. not while the pump runs.
+  */
+  void PowerDownSensors(){
+    (void)PackSwallow{ 0, (static_cast<Channels&>(*this).power_down(sequence), 0)... };
+  }
+  /**
+  * @brief Powers one sensor outside the planned acquisition, e.g. for a calibration capture. PowerDownSensors() switches it off again.
+  */
+  void PowerSensor(SensorSlot slot){
+    (void)PackSwallow{ 0, (static_cast<Channels&>(*this).power_on(slot), 0)... };
+  }
+  /**
+  * @brief Reads one oversampled burst of a sensor, past the median filters and the debouncing, e.g. for a calibration capture.
+  * @returns unsigned int The reading rounded back to 10 bits, 0 for slots without an analog sensor.
+  */
+  unsigned int ReadRaw(SensorSlot slot) const{
+    unsigned int raw = 0;
+    (void)PackSwallow{ 0, (static_cast<const Channels&>(*this).read_raw(slot, raw), 0)... };
+    return raw;
+  }
+  /**
+  * @brief Captures the filtered readings of every sensor once and stores them in the frame used by DecideAction and PrintAll.
+  * Each reading is the median of the last Acquire() bursts of the sensor, rounded back to 10 bits.
+  * The states are debounced, each reading is classified with the sensors hysteresis against its current state,
+  * and a new state needs the sensors CONFIRM_SAMPLES consecutive Sample() calls before it is taken over, so readings around a threshold do not toggle the pump.
+  * With SENSOR_HEALTH the readings go through the SensorHealth checks afterwards, failed sensors read INVALID_STATE.
+  */
+  void Sample(){
+    // Make sure the frame contains at least one burst taken right now.
+    this->Acquire();
+    frame.timestamp = millis();
+    (void)PackSwallow{ 0, (static_cast<Channels&>(*this).sample(frame), 0)... };
+#if SENSOR_HEALTH
+    // Readings change fast while watering, that is no noise.
+    bool steady = !this->pd.is_on();
+    unsigned char implausible = cross_check.update(frame.state[SLOT_SOIL_MOISTURE], frame.state[SLOT_WATER_DETECTION], frame.timestamp);
+    (void)PackSwallow{ 0, (static_cast<Channels&>(*this).check_health(frame, steady, implausible), 0)... };
+#endif
+  }
+  /**
+  * @returns const SensorFrame& The readings of the last Sample() call.
+  */
+  const SensorFrame& GetFrame() const{
+    return this->frame;
+  }
+  /**
+  * @brief Takes over debounced states saved before a reset, so the first Sample() classifies with hysteresis against them instead of taking over any state.
+  * @param states One state per SensorSlot, as in the frame.
+  */
+  void RestoreStates(const SensorStateLevel* states){
+    (void)PackSwallow{ 0, (static_cast<Channels&>(*this).restore(states), 0)... };
+  }
+  /**
+  * @brief Prints the readings of the last Sample() call, without touching the sensors again.
+  */
   void PrintAll() const{
-    sm.SerialPrint();
-    // PH sensor is faulty...
-//  ph.SerialPrint();
-    wl.SerialPrint();
-    wd.SerialPrint();  
-    Serial.print("\n\nPump is: ");
-    this->pd.is_on() ? Serial.print(" On") : Serial.print("Off");
-    Serial.print("\n\n\n");
+    (void)PackSwallow{ 0, (static_cast<const Channels&>(*this).print(frame), 0)... };
+    unsigned char fallback = this->GetFallback();
+    if(fallback & RULES_IGNORE_PH) Serial.print(F("\nRules: without the PH check"));
+    if(fallback & RULES_CONSERVATIVE) Serial.print(F("\nRules: without the bone dry special case"));
+    Serial.print(F("\n\nPump is: "));
+    Serial.print(this->pd.is_on() ? F(" On") : F("Off"));
+    Serial.print(F("\n\n\n"));
   }
 
   /**
-  * The fuzzy rules are as follows:
+  * The fuzzy rules of WateringRules are as follows:
   * Turn the pump off if:
   *   - Any sensor reports an invalid state. *all sensors INVALID_STATE
   *   - There is no water detected in the tank anymore. *wl sensor TOO_LOW.
@@ -60,69 +217,68 @@ public:
   *     - PH is in range. *ph sensor DANGER_LOW - PH_DANGER_HIGH
   *     - Water is detected at the bottom. *wd OK/TOO_HIGH
   *     - The soil moisture at the top is bone dry. sm *TOO_LOW
+  * The Rules are compiled into a DecisionTable, the lookup is one index computation and one bit test.
+  * With SENSOR_HEALTH a compiled table of the fallback rules is picked instead while a sensor is faulty, see GetFallback().
+  * @note Works on the frame of the last Sample() call.
   * @returns bool Whether the pump shall be turned on (true) or off (false).
   */
-  bool DecideAction(){
-    SensorStateLevel sm_state = this->sm.get_state();
-    // Since the ph sensor is faulty and only displays one value, irregardless of the actual ph value of the water (tested by adding massive amounts of citric acid into the testing solution, without any change to the read value), set it to be always OK.
-    SensorStateLevel ph_state = SensorStateLevel::OK;
-    SensorStateLevel wl_state = this->wl.get_state();
-    SensorStateLevel wd_state = this->wd.get_state();
-
-    // Step 1
-    // Any of the sensors reports an invalid state.
-    if( 
-        sm_state == SensorStateLevel::INVALID_STATE ||
-        ph_state == SensorStateLevel::INVALID_STATE ||
-        wl_state == SensorStateLevel::INVALID_STATE ||
-        wd_state == SensorStateLevel::INVALID_STATE  
-      ) {
-        return false;
-      }
-    // There is no more water in the tank
-    if(wl_state == SensorStateLevel::TOO_LOW){
-      return false;
-    }
-
-    // Step 2
-    // Handle PH out of range first.
-    // PH has to be in the range of DANGER_LOW - DANGER_HIGH. Or rather, not TOO_LOW OR TOO_HIGH.
-    if(ph_state == SensorStateLevel::TOO_LOW || ph_state == SensorStateLevel::TOO_HIGH){
-      return false;
-    }
-
-    // Step 3
-    // Standard case
-    // PH range already implicitly checked in Step 2
-    if(
-      wd_state == SensorStateLevel::OK &&
-      ((int)wl_state >= (int)SensorStateLevel::OK && (int)wl_state <= (int)SensorStateLevel::TOO_HIGH) && // Check if the water level is in range OK - TOO_HIGH
-      ((int)sm_state <= (int)SensorStateLevel::DANGER_HIGH) // Check if soil moisture is in range TOO_LOW - DANGER_HIGH. Or rather, if not TOO_HIGH.
-    ){
-      return true;
-    }
+  bool DecideAction() const{
+    return Decide(this->frame, this->GetFallback());
+  }
+  /**
+  * @brief The decision of DecideAction() on any frame, e.g. one handed over from another task, see rtos_tasks.h.
+  * @param fallback The RulesFallback bits of GetFallback() at the time of the frame.
+  */
+  static bool Decide(const SensorFrame& frame, unsigned char fallback){
+    SensorStateLevel sm_state = frame.state[SLOT_SOIL_MOISTURE];
+    SensorStateLevel ph_state = frame.state[SLOT_PH];
+    SensorStateLevel wl_state = frame.state[SLOT_WATER_LEVEL];
+    SensorStateLevel wd_state = frame.state[SLOT_WATER_DETECTION];
 
-    // Step 4
-    // Special cases
-    // Case 1
-    // As in Step 3, the PH range has already been implicitly validated prior, in Step 2.
-    if(
-      (wd_state == SensorStateLevel::OK || wd_state == SensorStateLevel::TOO_HIGH) &&
-      (sm_state == SensorStateLevel::TOO_LOW)
-    ){
-      return true;
+#if SENSOR_HEALTH
+    switch(fallback){
+      case RULES_IGNORE_PH: return IgnorePhTable::lookup(sm_state, ph_state, wl_state, wd_state);
+      case RULES_CONSERVATIVE: return ConservativeTable::lookup(sm_state, ph_state, wl_state, wd_state);
+      case RULES_IGNORE_PH | RULES_CONSERVATIVE: return ConservativeIgnorePhTable::lookup(sm_state, ph_state, wl_state, wd_state);
+      default: break;
     }
-
-    // All other cases, turn pump off.
-    return false;
+#else
+    (void)fallback;
+#endif
+    return Table::lookup(sm_state, ph_state, wl_state, wd_state);
+  }
+  /**
+  * @brief Target of the closed-loop watering, the soil moisture in the OK band or wetter. CheckWatering() stops a dose there, and DecideDose() does not start one there.
+  * @note Lower states are drier, check for INVALID_STATE first, it is above TOO_HIGH.
+  */
+  static bool IsTargetReached(const SensorFrame& frame){
+    return (int)frame.state[SLOT_SOIL_MOISTURE] >= (int)SensorStateLevel::OK;
+  }
+  /**
+  * @brief Whether a dose shall start on the frame. The decision of Decide(), except with CLOSED_LOOP_WATERING on a frame at the target already,
+  * the rules water up to DANGER_HIGH, the closed loop would stop such a dose right after its start.
+  */
+  static bool DecideDose(const SensorFrame& frame, unsigned char fallback){
+    return Decide(frame, fallback) && !(CLOSED_LOOP_WATERING && IsTargetReached(frame));
+  }
+  /**
+  * @returns unsigned char The RulesFallback bits the channels ask for, e.g. without the PH check while the PH sensor is not healthy,
+  * without the bone dry special case while the soil moisture, water level or water detection sensor is degraded. Failed ones read INVALID_STATE, which turns the pump off.
+  * RULES_FULL without SENSOR_HEALTH.
+  */
+  unsigned char GetFallback() const{
+    unsigned char fallback = RULES_FULL;
+    (void)PackSwallow{ 0, (fallback |= static_cast<const Channels&>(*this).fallback(), 0)... };
+    return fallback;
   }
 
   /**
-  * @brief Calls DecideAction, and turns the pump on or off, depending on the decision result.
+  * @brief Calls DecideDose, and turns the pump on or off, depending on the decision result.
+  * @note Call Sample() first, the decision is based on the last captured frame.
   * @returns Whether the pump was turned on or off.
   */
   bool DecidePump() {
-    if(this->DecideAction()){
+    if(DecideDose(this->frame, this->GetFallback())){
        this->pd.turn_on();
        return true;
     }
@@ -130,11 +286,94 @@ public:
     return false;
   }
   /**
+  * @brief Turns the pump on without a decision, for a decision taken elsewhere via Decide().
+  */
+  void TurnOnPump(){
+    this->pd.turn_on();
+  }
+  /**
   * @brief Allow the users of the class to manually turn off the pump.
   */
   void TurnOffPump(){
     this->pd.turn_off();
   }
+  bool IsPumpOn() const{
+    return this->pd.is_on();
+  }
+  /**
+  * @brief Remembers the conditions at the start of a watering, call right after DecidePump() turned the pump on.
+  * With SENSOR_HEALTH the MoistureCrossCheck watches the water detection after the dose.
+  */
+  void BeginWatering(){
+    this->watering_start_wd = this->frame.state[SLOT_WATER_DETECTION];
+#if SENSOR_HEALTH
+    cross_check.begin_dose(this->frame.timestamp);
+#endif
+  }
+  /**
+  * @brief Closed-loop watering, decides whether a running watering can stop early. Call Sample() first, at a high rate while the pump runs.
+  * Stops once the soil moisture reached the target, see IsTargetReached(), or once water reaches the bottom of the pot.
+  * A watering started by the bone dry special case (water already detected at the bottom) only stops on the soil moisture target.
+  * @returns WateringCheck WATERING_CONTINUE while the watering has to go on.
+  */
+  WateringCheck CheckWatering() const{
+    SensorStateLevel wd_state = this->frame.state[SLOT_WATER_DETECTION];
+    SensorStateLevel sm_state = this->frame.state[SLOT_SOIL_MOISTURE];
+    if(wd_state == SensorStateLevel::INVALID_STATE || sm_state == SensorStateLevel::INVALID_STATE){
+      return WATERING_SENSOR_INVALID;
+    }
+    if(this->watering_start_wd == SensorStateLevel::OK && wd_state == SensorStateLevel::TOO_HIGH){
+      return WATERING_OVERFLOW;
+    }
+    if(IsTargetReached(this->frame)){
+      return WATERING_TARGET_REACHED;
+    }
+    return WATERING_CONTINUE;
+  }
+};
+
+/**
+* @brief Sensors of the single zone controller.
+*/
+struct SingleZoneSensors{
+  // Pins and thresholds are template parameters of the sensors, the sensor objects themselves hold no data.
+  static constexpr unsigned char SM_PIN = A1;
+  static constexpr unsigned char PH_PIN = A2;
+  static constexpr unsigned char WL_PIN = A3;
+  static constexpr unsigned char WD_PIN = A6;
+#if SENSOR_POWER_GATING
+  static constexpr unsigned char SM_POWER = SM_POWER_PIN;
+  static constexpr unsigned char WL_POWER = WL_POWER_PIN;
+  static constexpr unsigned char WD_POWER = WD_POWER_PIN;
+#else
+  static constexpr unsigned char SM_POWER = NO_POWER_PIN;
+  static constexpr unsigned char WL_POWER = NO_POWER_PIN;
+  static constexpr unsigned char WD_POWER = NO_POWER_PIN;
+#endif
+  typedef SoilMoistureSensor<SM_PIN, SM_POWER> SmSensor;
+  typedef PHSensor<PH_PIN> PhSensor;
+  typedef WaterLevelSensor<WL_PIN, WL_POWER> WlSensor;
+  typedef WaterDetectionSensor<WD_PIN, WD_POWER> WdSensor;
+
+  typedef AnalogChannel<SLOT_SOIL_MOISTURE, SmSensor, SoilMoistureHealth> SoilMoisture;
+#if I2C_PH_SENSOR
+  // Digital replacement of the faulty analog PH sensor.
+  typedef I2cChannel<SLOT_PH, EzoPhDevice> Ph;
+#elif ANALOG_PH_SENSOR
+  // The probe got stuck at around 8.6 once, the flatline check of its SensorHealth finds that, DecideAction() then waters without the PH check.
+  typedef AnalogChannel<SLOT_PH, PhSensor, PhHealth> Ph;
+#else
+  // PH sensor currently faulty (reads a constant PH value of around 8.6 without regard of the actual PH value of the water, tested with copious amounts of citric acid...), use a hardcoded OK instead...
+  typedef ConstantChannel<SLOT_PH, SensorStateLevel::OK> Ph;
+#endif
+  typedef AnalogChannel<SLOT_WATER_LEVEL, WlSensor, WaterLevelHealth> WaterLevel;
+  typedef AnalogChannel<SLOT_WATER_DETECTION, WdSensor, WaterDetectionHealth> WaterDetection;
 };
 
+typedef ActionDecider<WateringRules,
+  SingleZoneSensors::SoilMoisture,
+  SingleZoneSensors::Ph,
+  SingleZoneSensors::WaterLevel,
+  SingleZoneSensors::WaterDetection> SingleZoneDecider;
+
 #endif
\ No newline at end of file
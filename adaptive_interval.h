@@ -0,0 +1,97 @@
+#ifndef ADAPTIVE_INTERVAL_H
+#define ADAPTIVE_INTERVAL_H
+
+#include "hal.h"
+#include "state_bands.h"
+
+/**
+* @brief Derives the delay until the next sample from the trend of a sensor, instead of a fixed interval.
+* The trend is an exponentially weighted slope of the raw readings, in fixed point 1/16 counts per minute, no float math.
+* The interval is half the time until the reading is expected to cross the next band boundary in the direction of the trend,
+* clamped to min_ms...max_ms, so a stable sensor is sampled rarely and a sensor close to a threshold often.
+*/
+class AdaptiveInterval{
+  // Fixed point scale of the slope, 1/16 counts.
+  static constexpr unsigned char SLOPE_SHIFT = 4;
+  // Weight of a new slope sample, 1 / 2^WEIGHT_SHIFT = 1/4.
+  static constexpr unsigned char WEIGHT_SHIFT = 2;
+  static constexpr unsigned long MS_PER_MINUTE = 60000UL;
+
+  unsigned long min_ms;
+  unsigned long max_ms;
+  // Slope in 1/16 counts per minute, positive for rising readings.
+  long slope;
+  unsigned int last_raw;
+  uint32_t last_ms;
+  // Number of slope samples taken since the last reset, saturating at 2.
+  unsigned char samples;
+public:
+  AdaptiveInterval(unsigned long min_ms, unsigned long max_ms)
+  : min_ms(min_ms), max_ms(max_ms), slope(0), last_raw(0), last_ms(0), samples(0) {}
+
+  /**
+  * @brief Forgets the trend, e.g. after watering, which changes the reading independent of the trend.
+  */
+  void reset() {
+    this->slope = 0;
+    this->samples = 0;
+  }
+  /**
+  * @brief Adds a reading to the trend.
+  * @param timestamp millis() timestamp of the reading.
+  * @param raw The reading, ranging from 0 to 1023.
+  */
+  void update(uint32_t timestamp, unsigned int raw) {
+    if(this->samples > 0){
+      uint32_t elapsed = timestamp - this->last_ms;
+      if(elapsed == 0) return;
+      // At most 1023 * 16 * 60000, fits into 32 bit.
+      long delta = ((long)raw - (long)this->last_raw) * (1L << SLOPE_SHIFT) * (long)MS_PER_MINUTE;
+      long current = delta / (long)elapsed;
+      if(this->samples == 1) this->slope = current;
+      else this->slope += (current - this->slope) / (1L << WEIGHT_SHIFT);
+    }
+    if(this->samples < 2) this->samples++;
+    this->last_raw = raw;
+    this->last_ms = timestamp;
+  }
+  /**
+  * @returns long The trend in 1/16 counts per minute, positive for rising readings.
+  */
+  long get_slope() const {
+    return this->slope;
+  }
+  /**
+  * @brief Delay until the next sample of a sensor classified by the given band table.
+  * @param raw The latest reading.
+  * @returns unsigned long Between min_ms and max_ms, min_ms until the trend is known.
+  */
+  template <class Bands>
+  unsigned long next_interval(const Bands& bands, unsigned int raw) const {
+    if(this->samples < 2) return this->min_ms;
+    if(this->slope == 0) return this->max_ms;
+
+    unsigned char index = StateBands::band_index(bands, raw);
+    unsigned long distance;
+    unsigned long rate;
+    if(this->slope > 0){
+      // No boundary above the last band.
+      if(index + 1 >= StateBands::size(bands)) return this->max_ms;
+      distance = StateBands::upper_at(bands, index) - raw + 1;
+      rate = (unsigned long)this->slope;
+    }
+    else{
+      if(index == 0) return this->max_ms;
+      distance = raw - StateBands::upper_at(bands, index - 1);
+      rate = (unsigned long)(-this->slope);
+    }
+    // Sample twice before the expected crossing. distance * 16 * 60000 fits into 32 bit for 10 bit readings.
+    unsigned long crossing_ms = (distance << SLOPE_SHIFT) * MS_PER_MINUTE / rate;
+    unsigned long interval = crossing_ms / 2;
+    if(interval < this->min_ms) return this->min_ms;
+    if(interval > this->max_ms) return this->max_ms;
+    return interval;
+  }
+};
+
+#endif
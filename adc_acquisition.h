@@ -0,0 +1,187 @@
+#ifndef ADC_ACQUISITION_H
+#define ADC_ACQUISITION_H
+
+#include "config.h"
+#include "sample_filter.h"
+
+#if ADC_ISR_ACQUISITION
+
+/**
+* @brief Interrupt driven ADC acquisition engine.
+* The ADC-complete ISR stores each result, switches the multiplexer to the next configured channel and starts the next conversion right away,
+* so the ADC converts continuously without any CPU time spent busy-waiting.
+* Each channel is converted in a burst of 4^n conversions, which are summed and decimated inside the ISR (see Oversampling).
+* Results of a full sweep over all channels are written into the back buffer, which becomes the front buffer once the sweep completes.
+* @note The mux is switched inside the ISR before the next conversion is started, instead of using the ADATE free-running mode,
+* where a mux change only takes effect one conversion later.
+*/
+class AdcAcquisition{
+public:
+  static constexpr unsigned char MAX_CHANNELS = 8;
+private:
+  // Double buffer of decimated values, the ISR writes the sweep in progress into buffers[front ^ 1].
+  static volatile unsigned int buffers[2][MAX_CHANNELS];
+  // Index of the buffer holding the last complete sweep.
+  static volatile unsigned char front;
+  // Incremented after every complete sweep, single byte so it can be read atomically.
+  static volatile unsigned char sequence;
+
+  static unsigned char pins[MAX_CHANNELS];
+  static unsigned char channels[MAX_CHANNELS];
+  static unsigned char oversample_bits[MAX_CHANNELS];
+  static unsigned char count;
+  static volatile unsigned char current;
+  static volatile unsigned char discard;
+  // Burst state of the channel in progress.
+  static volatile unsigned int accumulator;
+  static volatile unsigned int burst_remaining;
+
+  static unsigned char pin_to_channel(unsigned char pin) {
+    return pin >= A0 ? pin - A0 : pin;
+  }
+  static void select(unsigned char channel) {
+    // AVcc reference, same as analogReference(DEFAULT).
+    ADMUX = _BV(REFS0) | (channel & 0x07);
+  }
+public:
+  /**
+  * @brief Starts converting the given analog pins in order, over and over again.
+  * @param pin_list The analog pins, e.g. A1, A3, A6.
+  * @param bits_list Additional bits of resolution per pin gained via oversampling, 0 to Oversampling::MAX_BITS.
+  * @param pin_count Number of pins in the list, at most MAX_CHANNELS.
+  * @note Blocks until the first sweep completed (well below 1ms per channel), so the front buffer always holds valid values afterwards.
+  */
+  static void begin(const unsigned char* pin_list, const unsigned char* bits_list, unsigned char pin_count) {
+    if(pin_count > MAX_CHANNELS) pin_count = MAX_CHANNELS;
+    ADCSRA &= ~_BV(ADIE);
+    for(unsigned char i = 0; i < pin_count; i++){
+      pins[i] = pin_list[i];
+      channels[i] = pin_to_channel(pin_list[i]);
+      oversample_bits[i] = bits_list[i] > Oversampling::MAX_BITS ? Oversampling::MAX_BITS : bits_list[i];
+    }
+    count = pin_count;
+    resume();
+  }
+  /**
+  * @brief Stops the engine after the conversion in progress and switches the ADC off, e.g. before entering a sleep mode.
+  * @note The front buffer keeps the values of the last complete sweep.
+  */
+  static void suspend() {
+    ADCSRA &= ~_BV(ADIE);
+    while(ADCSRA & _BV(ADSC)) {}
+    ADCSRA &= ~_BV(ADEN);
+  }
+  /**
+  * @brief (Re-)Starts the engine with the channels of the last begin() call.
+  * @note Blocks until a fresh sweep completed, so no stale values of the time before suspend() are returned afterwards.
+  */
+  static void resume() {
+    if(count == 0) return;
+    current = 0;
+    discard = ADC_SETTLE_CONVERSIONS;
+    accumulator = 0;
+    burst_remaining = Oversampling::sample_count(oversample_bits[0]);
+    unsigned char start = sequence;
+    select(channels[0]);
+    // Prescaler 128, 125kHz ADC clock at 16MHz, as configured by the Arduino core.
+    ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0) | _BV(ADIF);
+    ADCSRA |= _BV(ADSC);
+    while(sequence == start) {}
+  }
+  /**
+  * @brief Copies the last complete sweep, guaranteed to be from one and the same sweep.
+  * @param out Destination, receives one decimated value (10 + oversampling bits) per configured pin, in begin() order.
+  * @param out_count Number of values to copy.
+  * @returns unsigned char The sequence number of the copied sweep.
+  */
+  static unsigned char snapshot(unsigned int* out, unsigned char out_count) {
+    if(out_count > count) out_count = count;
+    unsigned char seq;
+    do{
+      seq = sequence;
+      const volatile unsigned int* buffer = buffers[front];
+      for(unsigned char i = 0; i < out_count; i++){
+        out[i] = buffer[i];
+      }
+      // The ISR only writes into the front buffer after the next flip, which changes the sequence number.
+    } while(seq != sequence);
+    return seq;
+  }
+  /**
+  * @brief Latest decimated value of a single pin, without waiting.
+  * @returns unsigned int Ranging from 0 to 2^(10 + oversampling bits) - 1, 0 if the pin is not converted by the engine.
+  */
+  static unsigned int latest_oversampled(unsigned char pin) {
+    for(unsigned char i = 0; i < count; i++){
+      if(pins[i] != pin) continue;
+      unsigned int value;
+      do{
+        value = buffers[front][i];
+      } while(value != buffers[front][i]);
+      return value;
+    }
+    return 0;
+  }
+  /**
+  * @brief Latest value of a single pin, rounded back to 10 bits, without waiting.
+  * @returns unsigned int Ranging from 0 to 1023, 0 if the pin is not converted by the engine.
+  */
+  static unsigned int latest(unsigned char pin) {
+    for(unsigned char i = 0; i < count; i++){
+      if(pins[i] == pin) return Oversampling::to_raw(latest_oversampled(pin), oversample_bits[i]);
+    }
+    return 0;
+  }
+  static unsigned char get_sequence() {
+    return sequence;
+  }
+  /**
+  * @brief Called from the ADC-complete ISR only.
+  */
+  static void on_conversion_complete() {
+    unsigned int value = ADC;
+    if(discard > 0){
+      discard--;
+    }
+    else if(--burst_remaining > 0){
+      accumulator += value;
+    }
+    else{
+      unsigned char c = current;
+      buffers[front ^ 1][c] = Oversampling::decimate(accumulator + value, oversample_bits[c]);
+      accumulator = 0;
+      if(++c >= count){
+        c = 0;
+        front ^= 1;
+        sequence++;
+      }
+      current = c;
+      burst_remaining = Oversampling::sample_count(oversample_bits[c]);
+      if(count > 1){
+        select(channels[c]);
+        discard = ADC_SETTLE_CONVERSIONS;
+      }
+    }
+    ADCSRA |= _BV(ADSC);
+  }
+};
+
+volatile unsigned int AdcAcquisition::buffers[2][AdcAcquisition::MAX_CHANNELS];
+volatile unsigned char AdcAcquisition::front = 0;
+volatile unsigned char AdcAcquisition::sequence = 0;
+unsigned char AdcAcquisition::pins[AdcAcquisition::MAX_CHANNELS];
+unsigned char AdcAcquisition::channels[AdcAcquisition::MAX_CHANNELS];
+unsigned char AdcAcquisition::oversample_bits[AdcAcquisition::MAX_CHANNELS];
+unsigned char AdcAcquisition::count = 0;
+volatile unsigned char AdcAcquisition::current = 0;
+volatile unsigned char AdcAcquisition::discard = 0;
+volatile unsigned int AdcAcquisition::accumulator = 0;
+volatile unsigned int AdcAcquisition::burst_remaining = 0;
+
+ISR(ADC_vect) {
+  AdcAcquisition::on_conversion_complete();
+}
+
+#endif
+
+#endif
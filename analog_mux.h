@@ -0,0 +1,75 @@
+#ifndef ANALOG_MUX_H
+#define ANALOG_MUX_H
+
+#include "fast_pin.h"
+
+// Select line of an AnalogMux which is not connected, e.g. S3 of a CD4051.
+static constexpr unsigned char NO_SELECT_PIN = 0xFF;
+
+/**
+* @brief One select line of an AnalogMux.
+*/
+template <unsigned char PIN>
+struct MuxSelectLine{
+  static void begin() {
+    FastPin<PIN>::set_low();
+    FastPin<PIN>::set_output();
+  }
+  static void write(bool high) {
+    if(high) FastPin<PIN>::set_high();
+    else FastPin<PIN>::set_low();
+  }
+};
+
+template <>
+struct MuxSelectLine<NO_SELECT_PIN>{
+  static void begin() {}
+  static void write(bool) {}
+};
+
+/**
+* @brief External analog multiplexer, a CD4051 (8 channels, S0-S2) or a 74HC4067 (16 channels, S0-S3), whose common output feeds one analog pin.
+* select() only toggles the select lines which differ from the current channel, each one a single sbi/cbi on the ATmega328P.
+* @tparam COMMON_PIN The analog pin wired to the common output, e.g. A0.
+* @tparam S0...S3 The digital pins driving the select lines, S3 NO_SELECT_PIN for a CD4051.
+*/
+template <unsigned char COMMON_PIN, unsigned char S0, unsigned char S1, unsigned char S2, unsigned char S3 = NO_SELECT_PIN>
+class AnalogMux{
+  static unsigned char current;
+public:
+  static constexpr unsigned char PIN_NUMBER = COMMON_PIN;
+  static constexpr unsigned char CHANNELS = S3 == NO_SELECT_PIN ? 8 : 16;
+
+  /**
+  * @brief Drives every select line, selecting channel 0.
+  */
+  static void begin() {
+    MuxSelectLine<S0>::begin();
+    MuxSelectLine<S1>::begin();
+    MuxSelectLine<S2>::begin();
+    MuxSelectLine<S3>::begin();
+    current = 0;
+  }
+  static void select(unsigned char channel) {
+    unsigned char changed = (channel ^ current) & (CHANNELS - 1);
+    if(changed & 0x01) MuxSelectLine<S0>::write(channel & 0x01);
+    if(changed & 0x02) MuxSelectLine<S1>::write(channel & 0x02);
+    if(changed & 0x04) MuxSelectLine<S2>::write(channel & 0x04);
+    if(changed & 0x08) MuxSelectLine<S3>::write(channel & 0x08);
+    current = channel & (CHANNELS - 1);
+  }
+  static unsigned char selected() {
+    return current;
+  }
+  /**
+  * @returns bool Whether pin is one of the select lines, for compile-time pin conflict checks.
+  */
+  static constexpr bool uses_pin(unsigned char pin) {
+    return pin == S0 || pin == S1 || pin == S2 || (S3 != NO_SELECT_PIN && pin == S3);
+  }
+};
+
+template <unsigned char COMMON_PIN, unsigned char S0, unsigned char S1, unsigned char S2, unsigned char S3>
+unsigned char AnalogMux<COMMON_PIN, S0, S1, S2, S3>::current = 0;
+
+#endif
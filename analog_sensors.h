@@ -1,79 +1,150 @@
 #ifndef ANALOG_SENSORS_H
 #define ANALOG_SENSORS_H
 
+#include "hal.h"
+#include "config.h"
 #include "states.h"
+#include "adc_acquisition.h"
+#include "sample_filter.h"
+#include "state_bands.h"
+#include "fixed_map.h"
+#include "sensor_power.h"
+#include "flash_strings.h"
 
 /**
-* @brief Abstract base class for analog based sensors.
+* @brief Helpers shared by all analog sensors, independent of pin and thresholds.
 */
-struct AnalogSensor{
-  const unsigned short PIN_NUMBER;
+struct AnalogSensorBase{
+  /**
+  * @brief Transforms a SensorStateLevel value to its' string representation, stored in flash.
+  */
+  static FlashString state_to_str(SensorStateLevel state) {
+    return FlashStrings::state_name(state);
+  }
+};
+
+/**
+* @brief Analog based sensor, specialized at compile time by its pin, its threshold policy and optionally its power pin.
+* Neither the pin nor the thresholds are stored in the object, there is no vtable, and get_state() inlines into a short lookup in the policy's flash band table.
+* @tparam PIN The analog pin the sensor is connected to, e.g. A1.
+* @tparam Thresholds Policy class providing:
+*   - static SensorStateLevel classify(unsigned int raw), assigns a raw value its' corresponding state.
+*   - static SensorStateLevel classify(unsigned int raw, SensorStateLevel current), the same with hysteresis against the previous state.
+*   - static FlashString name(), the sensors name used by SerialPrint, via F().
+*   - static constexpr unsigned char OVERSAMPLE_BITS and MEDIAN_WINDOW, the sensors filtering stage.
+*   - static constexpr unsigned int HYSTERESIS and unsigned char CONFIRM_SAMPLES, the sensors state debouncing.
+*   - static constexpr unsigned int SETTLE_MS, the time the sensors output needs to settle after powering it.
+*   - Optionally typedef ... Mapping, a FixedMap to the sensors calibrated unit, used by calibrate() and read_calibrated().
+* @tparam POWER_PIN The digital pin powering the sensor, see SensorPower, NO_POWER_PIN for a permanently powered sensor.
+*/
+template <unsigned char PIN, class Thresholds, unsigned char POWER_PIN = NO_POWER_PIN>
+struct AnalogSensor : public AnalogSensorBase{
+  typedef Thresholds ThresholdsType;
+  typedef SensorPower<POWER_PIN> Power;
+  static constexpr unsigned char PIN_NUMBER = PIN;
+  // Permanently powered sensors are always settled.
+  static constexpr unsigned int SETTLE_MS = Power::GATED ? Thresholds::SETTLE_MS : 0;
+  static constexpr unsigned char OVERSAMPLE_BITS = Thresholds::OVERSAMPLE_BITS;
+  static constexpr unsigned char MEDIAN_WINDOW = Thresholds::MEDIAN_WINDOW;
+  static constexpr unsigned int HYSTERESIS = Thresholds::HYSTERESIS;
+  static constexpr unsigned char CONFIRM_SAMPLES = Thresholds::CONFIRM_SAMPLES;
 
-  AnalogSensor(unsigned short pin) : PIN_NUMBER(pin) {};
   /**
   * @brief Reads the value from the sensor and returns it as is.
+  * @note With ADC_ISR_ACQUISITION the latest value converted by the AdcAcquisition engine is returned without waiting, the pin has to be part of the engine's channel list.
   * @returns unsigned int Ranging from 0 to 1023.
   */
-  virtual unsigned int read_raw() const final {
-    return analogRead(PIN_NUMBER);
+  unsigned int read_raw() const {
+#if ADC_ISR_ACQUISITION
+    return AdcAcquisition::latest(PIN);
+#else
+    return analogRead(PIN);
+#endif
   }
   /**
-  * @brief Reads the value from the sensor and maps it to a min...max range.
-  * @param min  The lower bound of the mapping.
-  * @param max The upper bound of the mapping.
-  * @returns int Ranging from min to max.
+  * @brief Reads a burst of 4^OVERSAMPLE_BITS values from the sensor and decimates them, see Oversampling.
+  * @note With ADC_ISR_ACQUISITION the latest burst of the AdcAcquisition engine is returned instead.
+  * @returns unsigned int Ranging from 0 to 2^(10 + OVERSAMPLE_BITS) - 1.
   */
-  virtual unsigned int read_mapped_int(int min, int max) const final{
-    return map(this->read_raw(), 0, 1023, min, max);
+  unsigned int read_oversampled() const {
+#if ADC_ISR_ACQUISITION
+    return AdcAcquisition::latest_oversampled(PIN);
+#else
+    static_assert(OVERSAMPLE_BITS <= Oversampling::MAX_BITS, "Too many oversampling bits for a 16 bit accumulator.");
+    unsigned int sum = 0;
+    for(unsigned int i = Oversampling::sample_count(OVERSAMPLE_BITS); i > 0; i--){
+      sum += analogRead(PIN);
+    }
+    return Oversampling::decimate(sum, OVERSAMPLE_BITS);
+#endif
   }
   /**
-  * @brief Reads the value from the sensor and maps it to a min...max range.
-  * @param min The lower bound of the mapping.
-  * @param max The upper bound of the mapping.
-  * @returns float Ranging from min to max.
+  * @brief Reads the value from the sensor and maps it to a MIN...MAX range in fixed point, see FixedMap.
+  * @tparam MIN The lower bound of the mapping.
+  * @tparam MAX The upper bound of the mapping.
+  * @tparam FRAC_BITS Fractional bits of the result, e.g. read_mapped<0, 14, 8>() returns a Q8 value.
+  * @returns long Ranging from MIN * 2^FRAC_BITS to MAX * 2^FRAC_BITS.
   */
-  virtual float read_mapped_float(float min, float max) const final {
-    float raw = static_cast<float>(this->read_raw());
-    return (raw / 1023.0f) * (max - min) + min;
+  template <long MIN, long MAX, unsigned char FRAC_BITS = 0>
+  long read_mapped() const {
+    return FixedMap<MIN, MAX, FRAC_BITS>::map(this->read_raw());
   }
   /**
   * @brief Reads the value from the sensor and maps it to a 0...100 percentage range.
   * @returns unsigned int ranging from 0% to 100%.
   */
-  virtual unsigned int read_percent() const final {
-    return this->read_mapped_int(0, 100);
+  unsigned int read_percent() const {
+    return static_cast<unsigned int>(this->read_mapped<0, 100>());
   }
-  virtual SensorStateLevel get_state() const = 0;
   /**
-  * @brief Default implementation, prints just the sensors raw value.
+  * @brief Maps an already read raw value to the calibrated unit of the sensor, only available for policies providing a Mapping, a FixedMap.
+  * @returns long The value in the unit and fixed point format of Thresholds::Mapping.
   */
-  virtual void SerialPrint() const {
-    Serial.print("#### Generic Analog Sensor reading ####\n");
-    Serial.print("Raw value: ");
-    Serial.print(this->read_raw());
-    Serial.print("\n");
-    Serial.print("#### Reading end ####\n");
+  static long calibrate(unsigned int raw) {
+    return Thresholds::Mapping::map(raw);
   }
   /**
-  * @brief Transforms a SensorStateLevel value to its' string representation.
+  * @brief Reads the value from the sensor and maps it to its calibrated unit, see calibrate().
   */
-  static const char* state_to_str(SensorStateLevel state) {
-    switch (state) {
-      case SensorStateLevel::TOO_LOW: return "TOO_LOW";
-      case SensorStateLevel::DANGER_LOW: return "DANGER_LOW";
-      case SensorStateLevel::OK: return "OK";
-      case SensorStateLevel::DANGER_HIGH: return "DANGER_HIGH";
-      case SensorStateLevel::TOO_HIGH: return "TOO_HIGH";
-      case SensorStateLevel::INVALID_STATE: return "INVALID_STATE";
-    }
+  long read_calibrated() const {
+    return calibrate(this->read_raw());
+  }
+  /**
+  * @brief Assigns an already read raw value its' corresponding state.
+  */
+  static SensorStateLevel classify(unsigned int raw) {
+    return Thresholds::classify(raw);
+  }
+  /**
+  * @brief Assigns an already read raw value its' corresponding state, with the policy's hysteresis against the current state.
+  */
+  static SensorStateLevel classify(unsigned int raw, SensorStateLevel current) {
+    return Thresholds::classify(raw, current);
+  }
+  /**
+  * @brief Reads the value from the sensor and assigns it its' corresponding state.
+  */
+  SensorStateLevel get_state() const {
+    return classify(this->read_raw());
+  }
+  /**
+  * @brief Prints the sensors metrics of the given reading.
+  * @param raw A value previously read via read_raw(), so printing does not trigger another conversion.
+  * @param state The state previously derived from raw via classify().
+  */
+  void SerialPrint(unsigned int raw, SensorStateLevel state) const {
+    Serial.print(Thresholds::name());
+    Serial.print('\n');
+    FlashStrings::print_field(F("Raw sensor value: "), raw);
+    FlashStrings::print_field(F("State: "), state_to_str(state));
   }
 };
 
 /**
-* @brief Concrete implementation for capacitive soil moisture sensors.
+* @brief Thresholds for capacitive soil moisture sensors.
 * @note Uses full range of values of SensorStateLevel
 */
-struct SoilMoistureSensor : public AnalogSensor {
+struct SoilMoistureThresholds{
   // Soaking wet soil, or stagnant water.
   static constexpr unsigned int THRESH_TOO_WET           = 350;
   // Soil is well saturated with water.
@@ -84,166 +155,261 @@ struct SoilMoistureSensor : public AnalogSensor {
   static constexpr unsigned int THRESH_DANGEROUSLY_DRY   = 650;
   // Bone dry soil.
   static constexpr unsigned int THRESH_TOO_DRY           = 1023;
+  static constexpr unsigned char BAND_COUNT = 5;
+  // Soaked and dry readings the thresholds above were tuned for, they split the range in between into equal bands.
+  // A calibration moves THRESH_TOO_WET to THRESH_DANGEROUSLY_DRY proportionally to the measured readings, see Calibration.
+  static constexpr unsigned int REFERENCE_LOW = 250;
+  static constexpr unsigned int REFERENCE_HIGH = 750;
 
-  SoilMoistureSensor(unsigned short pin) : AnalogSensor(pin) {}
+  // 16 conversions per reading, plus a median of 5 readings against spikes.
+  static constexpr unsigned char OVERSAMPLE_BITS = 2;
+  static constexpr unsigned char MEDIAN_WINDOW = 5;
 
-  /** 
-  * @brief Reads the value from the sensor and assigns it its' corresponding state.
-  * @returns SensorStateLevel Full range of SensorStateLevel, TOO_LOW to TOO_HIGH.
-  */
-  SensorStateLevel get_state() const override {
-    unsigned int value = read_raw();
+  // A state change needs the reading 15 counts past the boundary, confirmed by 3 consecutive samples.
+  static constexpr unsigned int HYSTERESIS = 15;
+  static constexpr unsigned char CONFIRM_SAMPLES = 3;
+  // The oscillator of the capacitive sensor needs about 100ms, plus margin for the output filter.
+  static constexpr unsigned int SETTLE_MS = 200;
 
-    if (value <= THRESH_TOO_WET)          return SensorStateLevel::TOO_HIGH;
-    if (value <= THRESH_DANGEROUSLY_WET)  return SensorStateLevel::DANGER_HIGH;
-    if (value <= THRESH_OK)               return SensorStateLevel::OK;
-    if (value <= THRESH_DANGEROUSLY_DRY)  return SensorStateLevel::DANGER_LOW;
-    if (value <= THRESH_TOO_DRY)          return SensorStateLevel::TOO_LOW;
+  static FlashString name() { return F("Soil Moisture"); }
 
-    return SensorStateLevel::INVALID_STATE;
-  }
+#if ONLINE_CALIBRATION
+  typedef BandTable<BAND_COUNT> Bands;
+#else
+  typedef StateBand Bands[BAND_COUNT];
+#endif
   /**
-  * @brief Prints the soil moisture sensors current metrics.
-  */
-  void SerialPrint() const override {
-    int raw = this->read_raw();
-    SensorStateLevel state = this->get_state();
-    const char* state_str = AnalogSensor::state_to_str(state);
-    Serial.print("Soil Moisture\n");
-    Serial.print("Raw sensor value: ");
-    Serial.print(raw);
-    Serial.print("\n");
-    Serial.print("State: ");
-    Serial.print(state_str);
-    Serial.print("\n");
-  }
+  * @returns const Bands& The band table classify() uses, in RAM with ONLINE_CALIBRATION.
+  */
+  static const Bands& bands();
+  /**
+  * @returns SensorStateLevel Full range of SensorStateLevel, TOO_LOW to TOO_HIGH.
+  */
+  static SensorStateLevel classify(unsigned int value);
+  static SensorStateLevel classify(unsigned int value, SensorStateLevel current);
 };
 
+// Wetter soil reads lower values.
+constexpr StateBand SOIL_MOISTURE_BANDS[SoilMoistureThresholds::BAND_COUNT] PROGMEM = {
+  { SoilMoistureThresholds::THRESH_TOO_WET,         SensorStateLevel::TOO_HIGH },
+  { SoilMoistureThresholds::THRESH_DANGEROUSLY_WET, SensorStateLevel::DANGER_HIGH },
+  { SoilMoistureThresholds::THRESH_OK,              SensorStateLevel::OK },
+  { SoilMoistureThresholds::THRESH_DANGEROUSLY_DRY, SensorStateLevel::DANGER_LOW },
+  { SoilMoistureThresholds::THRESH_TOO_DRY,         SensorStateLevel::TOO_LOW }
+};
+static_assert(StateBands::is_sorted(SOIL_MOISTURE_BANDS), "Soil moisture thresholds have to be ascending.");
+
+inline SensorStateLevel SoilMoistureThresholds::classify(unsigned int value) {
+  return StateBands::classify(bands(), value);
+}
+inline SensorStateLevel SoilMoistureThresholds::classify(unsigned int value, SensorStateLevel current) {
+  return StateBands::classify(bands(), value, current, HYSTERESIS);
+}
+
 /**
-* @brief Concrete implementation for BNC PH Sensor + PH sensor module.
+* @brief Thresholds for the BNC PH Sensor + PH sensor module.
 * @note Uses full range of values of SensorStateLevel
 */
-struct PHSensor : public AnalogSensor {
-private:
+struct PHThresholds{
   // Values taken from my own experience with commonly found plants.
   static constexpr float PH_TOO_LOW      = 5.8f;
   static constexpr float PH_DANGER_LOW  = 6.1f;
   static constexpr float PH_OK          = 7.0f;
   static constexpr float PH_DANGER_HIGH = 7.5f;
   static constexpr float PH_TOO_HIGH    = 14.0f;
-public:
-  PHSensor(unsigned short pin) : AnalogSensor(pin) {}
-  /** 
-  * @brief Reads the value from the sensor and assigns it its' corresponding state.
+
+  // 16 conversions per reading, plus a median of 5 readings against spikes.
+  static constexpr unsigned char OVERSAMPLE_BITS = 2;
+  static constexpr unsigned char MEDIAN_WINDOW = 5;
+
+  // About 0.07 PH, confirmed by 3 consecutive samples.
+  static constexpr unsigned int HYSTERESIS = 5;
+  static constexpr unsigned char CONFIRM_SAMPLES = 3;
+  // The amplifier of the PH module drifts for a while after powering it.
+  static constexpr unsigned int SETTLE_MS = 1000;
+
+  static FlashString name() { return F("PH"); }
+
+  // The sensor board of the PH probe handles the logarithmic aspect of the reading. The value only needs to be mapped from 0.0f to 14.0f.
+  static constexpr float PH_MIN = 0.0f;
+  static constexpr float PH_MAX = 14.0f;
+  // PH in 1/100 steps, e.g. 700 for PH 7.0, without any float math at runtime.
+  typedef FixedMap<static_cast<long>(PH_MIN * 100.0f), static_cast<long>(PH_MAX * 100.0f)> Mapping;
+
+  /**
   * @returns SensorStateLevel Full range of SensorStateLevel, TOO_LOW to TOO_HIGH.
   */
-  SensorStateLevel get_state() const override {
-    // The sensor board of the PH probe handles the logarithmic aspect of the reading. The value only needs to be mapped from 0.0f to 14.0f.
-    float value = read_mapped_float(0.0f, 14.0f);
-    if (value <= PH_TOO_LOW)      return SensorStateLevel::TOO_LOW;
-    if (value <= PH_DANGER_LOW)   return SensorStateLevel::DANGER_LOW;
-    if (value <= PH_OK)           return SensorStateLevel::OK;
-    if (value <= PH_DANGER_HIGH)  return SensorStateLevel::DANGER_HIGH;
-    if (value <= PH_TOO_HIGH)     return SensorStateLevel::TOO_HIGH;
-    return SensorStateLevel::INVALID_STATE;
-  }
-  /**
-  * @brief Prints the PH sensors current metrics.
-  */
-  void SerialPrint() const override {
-    int raw = this->read_raw();
-    SensorStateLevel state = this->get_state();
-    const char* state_str = AnalogSensor::state_to_str(state);
-    Serial.print("PH\n");
-    Serial.print("Raw sensor value: ");
-    Serial.print(raw);
-    Serial.print("\n");
-    Serial.print("State: ");
-    Serial.print(state_str);
-    Serial.print("\n");
-  }
+  static SensorStateLevel classify(unsigned int raw);
+  static SensorStateLevel classify(unsigned int raw, SensorStateLevel current);
+};
+
+// The PH thresholds are converted to raw values at compile time, no float math is left at runtime.
+constexpr StateBand PH_BANDS[] PROGMEM = {
+  { StateBands::mapped_to_raw(PHThresholds::PH_TOO_LOW,     PHThresholds::PH_MIN, PHThresholds::PH_MAX), SensorStateLevel::TOO_LOW },
+  { StateBands::mapped_to_raw(PHThresholds::PH_DANGER_LOW,  PHThresholds::PH_MIN, PHThresholds::PH_MAX), SensorStateLevel::DANGER_LOW },
+  { StateBands::mapped_to_raw(PHThresholds::PH_OK,          PHThresholds::PH_MIN, PHThresholds::PH_MAX), SensorStateLevel::OK },
+  { StateBands::mapped_to_raw(PHThresholds::PH_DANGER_HIGH, PHThresholds::PH_MIN, PHThresholds::PH_MAX), SensorStateLevel::DANGER_HIGH },
+  { StateBands::mapped_to_raw(PHThresholds::PH_TOO_HIGH,    PHThresholds::PH_MIN, PHThresholds::PH_MAX), SensorStateLevel::TOO_HIGH }
 };
+static_assert(StateBands::is_sorted(PH_BANDS), "PH thresholds have to be ascending.");
 
+inline SensorStateLevel PHThresholds::classify(unsigned int raw) {
+  return StateBands::classify(PH_BANDS, raw);
+}
+inline SensorStateLevel PHThresholds::classify(unsigned int raw, SensorStateLevel current) {
+  return StateBands::classify(PH_BANDS, raw, current, HYSTERESIS);
+}
 
 /**
-* @brief Concrete implementation for capacitive water level sensor.
+* @brief Thresholds for capacitive water level sensors.
 * @note Uses limited range of values of SensorStateLevel
 */
-struct WaterLevelSensor : public AnalogSensor {
-private:
+struct WaterLevelThresholds{
   // There is enough water still in the reservoir.
   static constexpr unsigned int THRESH_OK = 1024;
   // The water in the reservoir is running low.
   static constexpr unsigned int THRESH_DANGER_LOW = 450;
   // There is no more, or barely any at all water left in the reservoir.
   static constexpr unsigned int THRESH_DRY = 200;
-public:
-  WaterLevelSensor(unsigned int pin) : AnalogSensor(pin) {}
-  /** 
-  * @brief Reads the value from the sensor and assigns it its' corresponding state.
-  * @returns SensorStateLevel Limited range of SensorStateLevel, TOO_LOW, DANGER_LOW and OK only.
+  static constexpr unsigned char BAND_COUNT = 3;
+  // Empty and full reservoir readings the thresholds above were tuned for.
+  // A calibration moves THRESH_DRY and THRESH_DANGER_LOW proportionally to the measured readings, see Calibration.
+  static constexpr unsigned int REFERENCE_LOW = 50;
+  static constexpr unsigned int REFERENCE_HIGH = 850;
+
+  // 16 conversions per reading, plus a median of 5 readings against spikes.
+  static constexpr unsigned char OVERSAMPLE_BITS = 2;
+  static constexpr unsigned char MEDIAN_WINDOW = 5;
+
+  // The surface sloshes while the pump runs, 15 counts past the boundary, confirmed by 2 consecutive samples.
+  static constexpr unsigned int HYSTERESIS = 15;
+  static constexpr unsigned char CONFIRM_SAMPLES = 2;
+  static constexpr unsigned int SETTLE_MS = 200;
+
+  static FlashString name() { return F("Water level"); }
+
+#if ONLINE_CALIBRATION
+  typedef BandTable<BAND_COUNT> Bands;
+#else
+  typedef StateBand Bands[BAND_COUNT];
+#endif
+  /**
+  * @returns const Bands& The band table classify() uses, in RAM with ONLINE_CALIBRATION.
   */
-  SensorStateLevel get_state() const override {
-    int val = this->read_raw();
-    if(val <= THRESH_DRY) return SensorStateLevel::TOO_LOW;
-    if(val <= THRESH_DANGER_LOW) return SensorStateLevel::DANGER_LOW;
-    if(val <= THRESH_OK) return SensorStateLevel::OK;
-    return SensorStateLevel::INVALID_STATE;
-  }
+  static const Bands& bands();
   /**
-  * @brief Prints the water level sensors current metrics.
-  */
-  void SerialPrint() const override {
-    int raw = this->read_raw();
-    SensorStateLevel state = this->get_state();
-    const char* state_str = AnalogSensor::state_to_str(state);
-    Serial.print("Water level\n");
-    Serial.print("Raw sensor value: ");
-    Serial.print(raw);
-    Serial.print("\n");
-    Serial.print("State: ");
-    Serial.print(state_str);
-    Serial.print("\n");
-  }
+  * @returns SensorStateLevel Limited range of SensorStateLevel, TOO_LOW, DANGER_LOW and OK only.
+  */
+  static SensorStateLevel classify(unsigned int val);
+  static SensorStateLevel classify(unsigned int val, SensorStateLevel current);
 };
 
+constexpr StateBand WATER_LEVEL_BANDS[WaterLevelThresholds::BAND_COUNT] PROGMEM = {
+  { WaterLevelThresholds::THRESH_DRY,        SensorStateLevel::TOO_LOW },
+  { WaterLevelThresholds::THRESH_DANGER_LOW, SensorStateLevel::DANGER_LOW },
+  { WaterLevelThresholds::THRESH_OK,         SensorStateLevel::OK }
+};
+static_assert(StateBands::is_sorted(WATER_LEVEL_BANDS), "Water level thresholds have to be ascending.");
+
+inline SensorStateLevel WaterLevelThresholds::classify(unsigned int val) {
+  return StateBands::classify(bands(), val);
+}
+inline SensorStateLevel WaterLevelThresholds::classify(unsigned int val, SensorStateLevel current) {
+  return StateBands::classify(bands(), val, current, HYSTERESIS);
+}
+
+#if ONLINE_CALIBRATION
 /**
-* @brief Concrete implementation for capacitive water detection sensor.
+* @brief RAM copies of the calibrated band tables, start out with the compiled-in thresholds, see Calibration.
+*/
+struct CalibratedBands{
+  static SoilMoistureThresholds::Bands soil_moisture;
+  static WaterLevelThresholds::Bands water_level;
+};
+
+SoilMoistureThresholds::Bands CalibratedBands::soil_moisture(SOIL_MOISTURE_BANDS);
+WaterLevelThresholds::Bands CalibratedBands::water_level(WATER_LEVEL_BANDS);
+
+inline const SoilMoistureThresholds::Bands& SoilMoistureThresholds::bands() {
+  return CalibratedBands::soil_moisture;
+}
+inline const WaterLevelThresholds::Bands& WaterLevelThresholds::bands() {
+  return CalibratedBands::water_level;
+}
+#else
+inline const SoilMoistureThresholds::Bands& SoilMoistureThresholds::bands() {
+  return SOIL_MOISTURE_BANDS;
+}
+inline const WaterLevelThresholds::Bands& WaterLevelThresholds::bands() {
+  return WATER_LEVEL_BANDS;
+}
+#endif
+
+/**
+* @brief Thresholds for capacitive water detection sensors.
 * @note Uses limited range of values of SensorStateLevel
 */
-struct WaterDetectionSensor : public AnalogSensor {
-private:
+struct WaterDetectionThresholds{
   // Water is detected
   static constexpr unsigned int THRESH_ON = 1024;
   // No water detected
   static constexpr unsigned int THRESH_OFF = 50;
-public:
-  WaterDetectionSensor(unsigned int pin) : AnalogSensor(pin) {}
-  /** 
-  * @brief Reads the value from the sensor and assigns it its' corresponding state.
+
+  // Safety sensor, only 4 conversions per reading and no median, which would delay an overflow detection by 2 readings.
+  static constexpr unsigned char OVERSAMPLE_BITS = 1;
+  static constexpr unsigned char MEDIAN_WINDOW = 1;
+
+  // Safety sensor, detected water has to count right away. Leaving TOO_HIGH needs the reading 10 counts below THRESH_OFF though.
+  static constexpr unsigned int HYSTERESIS = 10;
+  static constexpr unsigned char CONFIRM_SAMPLES = 1;
+  static constexpr unsigned int SETTLE_MS = 50;
+
+  static FlashString name() { return F("Water detection"); }
+
+  /**
   * @returns SensorStateLevel Limited range of SensorStateLevel, TOO_HIGH and OK only.
   */
-  SensorStateLevel get_state() const override {
-    int val = this->read_raw();
-    if(val <= THRESH_OFF) return SensorStateLevel::OK;
-    if(val <= THRESH_ON) return SensorStateLevel::TOO_HIGH;
-    return SensorStateLevel::INVALID_STATE;
-  }
-  /**
-  * @brief Prints the water detection sensors current metrics.
-  */
-  void SerialPrint() const override {
-    int raw = this->read_raw();
-    SensorStateLevel state = this->get_state();
-    const char* state_str = AnalogSensor::state_to_str(state);
-    Serial.print("Water detection\n");
-    Serial.print("Raw sensor value: ");
-    Serial.print(raw);
-    Serial.print("\n");
-    Serial.print("State: ");
-    Serial.print(state_str);
-    Serial.print("\n");
-  }
+  static SensorStateLevel classify(unsigned int val);
+  static SensorStateLevel classify(unsigned int val, SensorStateLevel current);
+};
+
+constexpr StateBand WATER_DETECTION_BANDS[] PROGMEM = {
+  { WaterDetectionThresholds::THRESH_OFF, SensorStateLevel::OK },
+  { WaterDetectionThresholds::THRESH_ON,  SensorStateLevel::TOO_HIGH }
 };
+static_assert(StateBands::is_sorted(WATER_DETECTION_BANDS), "Water detection thresholds have to be ascending.");
+
+inline SensorStateLevel WaterDetectionThresholds::classify(unsigned int val) {
+  return StateBands::classify(WATER_DETECTION_BANDS, val);
+}
+inline SensorStateLevel WaterDetectionThresholds::classify(unsigned int val, SensorStateLevel current) {
+  // Rising into TOO_HIGH without hysteresis, the margin only applies on the way back to OK.
+  if(current == SensorStateLevel::OK) return StateBands::classify(WATER_DETECTION_BANDS, val);
+  return StateBands::classify(WATER_DETECTION_BANDS, val, current, HYSTERESIS);
+}
+
+/**
+* @brief Capacitive soil moisture sensor on the given pin, optionally powered via POWER_PIN.
+*/
+template <unsigned char PIN, unsigned char POWER_PIN = NO_POWER_PIN>
+using SoilMoistureSensor = AnalogSensor<PIN, SoilMoistureThresholds, POWER_PIN>;
+
+/**
+* @brief BNC PH Sensor + PH sensor module on the given pin, optionally powered via POWER_PIN.
+*/
+template <unsigned char PIN, unsigned char POWER_PIN = NO_POWER_PIN>
+using PHSensor = AnalogSensor<PIN, PHThresholds, POWER_PIN>;
+
+/**
+* @brief Capacitive water level sensor on the given pin, optionally powered via POWER_PIN.
+*/
+template <unsigned char PIN, unsigned char POWER_PIN = NO_POWER_PIN>
+using WaterLevelSensor = AnalogSensor<PIN, WaterLevelThresholds, POWER_PIN>;
+
+/**
+* @brief Capacitive water detection sensor on the given pin, optionally powered via POWER_PIN.
+*/
+template <unsigned char PIN, unsigned char POWER_PIN = NO_POWER_PIN>
+using WaterDetectionSensor = AnalogSensor<PIN, WaterDetectionThresholds, POWER_PIN>;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,220 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "hal.h"
+#include "config.h"
+
+#if BENCHMARK
+
+#include "action_decider.h"
+#include "flash_strings.h"
+
+#ifndef F_CPU
+// Host builds, the fallback counter converts micros() to cycles of a 16MHz board.
+#define F_CPU 16000000UL
+#endif
+
+/**
+* @brief Free-running 32 bit CPU cycle counter.
+* ATmega328P: Timer1 at the CPU clock, extended to 32 bit by its overflow interrupt, wraps after 268s at 16MHz.
+* Cortex-M3/M4/M7 (e.g. Due, Teensy 3/4): the DWT cycle counter. ESP32: the CCOUNT register.
+* Other boards, e.g. the Cortex-M0+ RP2040 without a DWT counter: micros() scaled to cycles, 1us resolution only.
+*/
+class CycleCounter{
+#if defined(__AVR_ATmega328P__)
+  static volatile unsigned int overflows;
+#elif defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+  static volatile uint32_t& dwt_ctrl() { return *reinterpret_cast<volatile uint32_t*>(0xE0001000UL); }
+  static volatile uint32_t& dwt_cyccnt() { return *reinterpret_cast<volatile uint32_t*>(0xE0001004UL); }
+  static volatile uint32_t& demcr() { return *reinterpret_cast<volatile uint32_t*>(0xE000EDFCUL); }
+#endif
+public:
+  static FlashString name() {
+#if defined(__AVR_ATmega328P__)
+    return F("timer1");
+#elif defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+    return F("dwt");
+#elif defined(ARDUINO_ARCH_ESP32)
+    return F("ccount");
+#else
+    return F("micros");
+#endif
+  }
+  static void begin() {
+#if defined(__AVR_ATmega328P__)
+    // Normal mode, no prescaler.
+    TCCR1A = 0;
+    TCCR1B = 0;
+    TCNT1 = 0;
+    overflows = 0;
+    TIFR1 = _BV(TOV1);
+    TIMSK1 = _BV(TOIE1);
+    TCCR1B = _BV(CS10);
+#elif defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+    // TRCENA, then CYCCNTENA.
+    demcr() |= 1UL << 24;
+    dwt_cyccnt() = 0;
+    dwt_ctrl() |= 1UL;
+#endif
+  }
+  static uint32_t now() {
+#if defined(__AVR_ATmega328P__)
+    uint8_t sreg = SREG;
+    cli();
+    unsigned int high = overflows;
+    unsigned int low = TCNT1;
+    // An overflow pending since interrupts were disabled, TCNT1 already wrapped if it reads low.
+    if((TIFR1 & _BV(TOV1)) && low < 0x8000) high++;
+    SREG = sreg;
+    return ((uint32_t)high << 16) | low;
+#elif defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+    return dwt_cyccnt();
+#elif defined(ARDUINO_ARCH_ESP32)
+    return ESP.getCycleCount();
+#else
+    return micros() * (F_CPU / 1000000UL);
+#endif
+  }
+  /**
+  * @brief Called from the Timer1 overflow ISR only.
+  */
+  static void on_overflow() {
+#if defined(__AVR_ATmega328P__)
+    overflows++;
+#endif
+  }
+};
+
+#if defined(__AVR_ATmega328P__)
+volatile unsigned int CycleCounter::overflows = 0;
+
+ISR(TIMER1_OVF_vect) {
+  CycleCounter::on_overflow();
+}
+#endif
+
+/**
+* @brief Cycle counts of one benchmark, the overhead of the measurement itself is subtracted.
+*/
+struct BenchmarkResult{
+  uint32_t min;
+  uint32_t max;
+  unsigned long long total;
+  unsigned int iterations;
+
+  uint32_t mean() const {
+    return iterations ? (uint32_t)(total / iterations) : 0;
+  }
+};
+
+/**
+* @brief Runs code under test N times and prints min/mean/max cycle counts as CSV, one row per benchmark:
+*   benchmark,iterations,min_cycles,mean_cycles,max_cycles
+* The table is preceded by a # comment line with the clock and the counter, tools/benchmark_compare.py compares two captures.
+* @note Interrupts stay enabled, Serial and millis() need them. The Timer0 and ADC interrupts end up in max, min is free of them.
+*/
+class Benchmark{
+  static uint32_t overhead;
+
+  template <typename Body>
+  static BenchmarkResult measure_raw(Body body, unsigned int iterations) {
+    BenchmarkResult result = { 0xFFFFFFFFUL, 0, 0, iterations };
+    for(unsigned int i = 0; i < iterations; i++){
+      uint32_t start = CycleCounter::now();
+      body();
+      uint32_t cycles = CycleCounter::now() - start;
+      cycles = cycles > overhead ? cycles - overhead : 0;
+      if(cycles < result.min) result.min = cycles;
+      if(cycles > result.max) result.max = cycles;
+      result.total += cycles;
+    }
+    return result;
+  }
+public:
+  // Results of otherwise pure calls are stored here, so the compiler cannot drop the calls.
+  static volatile unsigned long sink;
+
+  /**
+  * @brief Starts the counter and measures the cost of a measurement around an empty body. Prints the table header.
+  */
+  static void begin() {
+    CycleCounter::begin();
+    overhead = 0;
+    overhead = measure_raw([]() {}, 64).min;
+    Serial.print(F("# F_CPU="));
+    Serial.print((unsigned long)F_CPU);
+    Serial.print(F(" counter="));
+    Serial.print(CycleCounter::name());
+    Serial.print(F(" overhead="));
+    Serial.print((unsigned long)overhead);
+    Serial.print(F("\nbenchmark,iterations,min_cycles,mean_cycles,max_cycles\n"));
+  }
+  template <typename Body>
+  static void run(FlashString name, Body body, unsigned int iterations = BENCHMARK_ITERATIONS) {
+    if(iterations == 0) iterations = 1;
+    BenchmarkResult result = measure_raw(body, iterations);
+    Serial.print(name);
+    Serial.print(',');
+    Serial.print(result.iterations);
+    Serial.print(',');
+    Serial.print((unsigned long)result.min);
+    Serial.print(',');
+    Serial.print((unsigned long)result.mean());
+    Serial.print(',');
+    Serial.print((unsigned long)result.max);
+    Serial.print('\n');
+    // Keeps the report itself out of the next measurement.
+    Serial.flush();
+  }
+};
+
+uint32_t Benchmark::overhead = 0;
+volatile unsigned long Benchmark::sink = 0;
+
+/**
+* @brief The benchmarks of the sensor, decision and pump paths.
+* The sensors are instances of the SingleZoneDecider sensor types on the same pins, so with ADC_ISR_ACQUISITION they read the engine started by Begin().
+*/
+class BenchmarkSuite{
+  // The pins of SingleZoneSensors, without the power gating.
+  typedef SoilMoistureSensor<SingleZoneSensors::SM_PIN> SmSensor;
+  typedef WaterLevelSensor<SingleZoneSensors::WL_PIN> WlSensor;
+  typedef WaterDetectionSensor<SingleZoneSensors::WD_PIN> WdSensor;
+  typedef PumpDriver<PUMP_PIN> Pump;
+public:
+  static void run() {
+    SingleZoneDecider ad;
+    ad.Begin();
+    ad.PlanAcquisition(millis(), 100);
+    // Fills the median filters and the frame.
+    for(unsigned char i = 0; i < 8; i++) ad.Sample();
+
+    SmSensor sm;
+    WlSensor wl;
+    WdSensor wd;
+    Pump pump;
+
+    Benchmark::begin();
+    Benchmark::run(F("sm.read_raw"), [&]() { Benchmark::sink = sm.read_raw(); });
+    Benchmark::run(F("sm.read_oversampled"), [&]() { Benchmark::sink = sm.read_oversampled(); });
+    Benchmark::run(F("sm.get_state"), [&]() { Benchmark::sink = (unsigned long)sm.get_state(); });
+    Benchmark::run(F("wl.get_state"), [&]() { Benchmark::sink = (unsigned long)wl.get_state(); });
+    Benchmark::run(F("wd.get_state"), [&]() { Benchmark::sink = (unsigned long)wd.get_state(); });
+    Benchmark::run(F("sm.classify_hysteresis"), [&]() { Benchmark::sink = (unsigned long)SmSensor::classify(Benchmark::sink & 0x3FF, SensorStateLevel::OK); });
+    // Fixed point successors of the removed map()/float mappings.
+    Benchmark::run(F("sm.read_percent"), [&]() { Benchmark::sink = sm.read_percent(); });
+    Benchmark::run(F("sm.read_mapped_q8"), [&]() { Benchmark::sink = sm.read_mapped<0, 100, 8>(); });
+    Benchmark::run(F("ph.calibrate"), [&]() { Benchmark::sink = SingleZoneSensors::PhSensor::calibrate(Benchmark::sink & 0x3FF); });
+    Benchmark::run(F("ad.Acquire"), [&]() { ad.Acquire(); });
+    Benchmark::run(F("ad.Sample"), [&]() { ad.Sample(); });
+    Benchmark::run(F("ad.DecideAction"), [&]() { Benchmark::sink = ad.DecideAction(); });
+    Benchmark::run(F("pump.toggle"), [&]() { pump.turn_on(); pump.turn_off(); });
+    // Bound by the baud rate once the TX buffer is full.
+    Benchmark::run(F("ad.PrintAll"), [&]() { ad.PrintAll(); }, BENCHMARK_ITERATIONS / 16);
+    Serial.print(F("# done\n"));
+  }
+};
+
+#endif
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include "hal.h"
+#include "config.h"
+
+#if ONLINE_CALIBRATION
+
+#include "analog_sensors.h"
+#include "sensor_frame.h"
+#include "streaming_stats.h"
+#include "eeprom_store.h"
+#include "warm_boot.h"
+#include "flash_strings.h"
+
+/**
+* @brief Online calibration of the soil moisture and water level thresholds, guided over the serial line.
+* Each sensor is captured at both ends of its range, the soil moisture sensor in soaked and in dry soil, the water level sensor in an empty and a full reservoir.
+* A capture streams CALIBRATION_SAMPLES readings through a P2Quantile median and a RunningRange, in constant memory.
+* store() moves the thresholds of every sensor with both captures proportionally from the policy's REFERENCE_LOW and REFERENCE_HIGH readings to the measured medians,
+* and keeps the medians in the EEPROM. begin() turns them into the RAM band tables of CalibratedBands at boot, classification stays the same lookup as before.
+*/
+class Calibration{
+public:
+  enum Capture{
+    CAPTURE_SOIL_WET = 0,
+    CAPTURE_SOIL_DRY = 1,
+    CAPTURE_RESERVOIR_EMPTY = 2,
+    CAPTURE_RESERVOIR_FULL = 3,
+    CAPTURE_COUNT = 4,
+    CAPTURE_NONE = 0xFF
+  };
+  // Capture c belongs to target c / 2, at the low end of its range for even c.
+  enum Target{
+    TARGET_SOIL_MOISTURE = 0,
+    TARGET_WATER_LEVEL = 1,
+    TARGET_COUNT = 2
+  };
+  /**
+  * @brief Median readings at both ends of a sensor's range.
+  */
+  struct Points{
+    uint16_t low;
+    uint16_t high;
+  };
+  /**
+  * @brief Layout in the EEPROM, followed by its CRC, see EepromStore. Bump VERSION on every change.
+  */
+  struct Stored{
+    uint8_t version;
+    // One bit per Target.
+    uint8_t calibrated;
+    Points points[TARGET_COUNT];
+  };
+  static constexpr uint8_t VERSION = 1;
+#if WARM_BOOT
+  static_assert(CALIBRATION_ADDRESS >= WARM_BOOT_ADDRESS + EepromStore::size<WarmBoot::State>() || CALIBRATION_ADDRESS + EepromStore::size<Stored>() <= WARM_BOOT_ADDRESS,
+    "The calibration overlaps the warm boot state.");
+#endif
+#if EEPROM_LOG
+  static_assert(CALIBRATION_ADDRESS + EepromStore::size<Stored>() <= EEPROM_LOG_START, "The calibration overlaps the EEPROM log.");
+#endif
+private:
+  static Capture active;
+  static P2Quantile<32768> median;
+  static RunningRange range;
+  // Finished captures since the last store(), one bit per Capture.
+  static Points captured[TARGET_COUNT];
+  static uint8_t captured_mask;
+  static Stored stored;
+
+  /**
+  * @brief Moves every threshold but the upper bound of the last band from the reference readings of the policy to the measured ones.
+  * @returns bool False if a band would not be wider than twice the hysteresis, table stays unchanged then.
+  */
+  template <class Thresholds, unsigned char N>
+  static bool derive(BandTable<N>& table, const StateBand (&defaults)[N], const Points& points) {
+    if(points.high <= points.low) return false;
+    BandTable<N> derived(defaults);
+    long span = (long)points.high - points.low;
+    long reference_span = (long)Thresholds::REFERENCE_HIGH - Thresholds::REFERENCE_LOW;
+    long previous = -(long)Thresholds::HYSTERESIS;
+    for(unsigned char i = 0; i + 1 < N; i++){
+      long threshold = points.low + ((long)derived.bands[i].upper - (long)Thresholds::REFERENCE_LOW) * span / reference_span;
+      if(threshold < 0 || threshold - previous <= 2 * (long)Thresholds::HYSTERESIS) return false;
+      derived.bands[i].upper = threshold;
+      previous = threshold;
+    }
+    if((long)derived.bands[N - 1].upper - previous <= 2 * (long)Thresholds::HYSTERESIS) return false;
+    table = derived;
+    return true;
+  }
+  static bool derive(unsigned char target, const Points& points) {
+    if(target == TARGET_SOIL_MOISTURE) return derive<SoilMoistureThresholds>(CalibratedBands::soil_moisture, SOIL_MOISTURE_BANDS, points);
+    return derive<WaterLevelThresholds>(CalibratedBands::water_level, WATER_LEVEL_BANDS, points);
+  }
+  template <unsigned char N>
+  static void print_table(FlashString name, const BandTable<N>& table, bool calibrated) {
+    Serial.print(name);
+    Serial.print(F(" thresholds:"));
+    for(unsigned char i = 0; i + 1 < N; i++){
+      Serial.print(' ');
+      Serial.print(table.bands[i].upper);
+    }
+    Serial.print(calibrated ? F(" (calibrated)\n") : F(" (default)\n"));
+  }
+public:
+  /**
+  * @brief Compiles the stored calibration into the band tables, call once from setup(), before the first sample.
+  */
+  static void begin() {
+    if(!EepromStore::load(CALIBRATION_ADDRESS, stored) || stored.version != VERSION){
+      stored.version = VERSION;
+      stored.calibrated = 0;
+    }
+    CalibratedBands::soil_moisture.load(SOIL_MOISTURE_BANDS);
+    CalibratedBands::water_level.load(WATER_LEVEL_BANDS);
+    for(unsigned char t = 0; t < TARGET_COUNT; t++){
+      if((stored.calibrated & (1 << t)) && !derive(t, stored.points[t])) stored.calibrated &= ~(1 << t);
+    }
+  }
+  /**
+  * @brief Starts a capture, replacing one in progress. Feed it via push().
+  */
+  static void start(Capture capture) {
+    active = capture;
+    median.reset();
+    range.reset();
+  }
+  static bool is_capturing() {
+    return active != CAPTURE_NONE;
+  }
+  /**
+  * @returns SensorSlot The sensor of the capture in progress.
+  */
+  static SensorSlot slot() {
+    return active / 2 == TARGET_SOIL_MOISTURE ? SLOT_SOIL_MOISTURE : SLOT_WATER_LEVEL;
+  }
+  /**
+  * @brief Takes the next reading of the capture in progress, and finishes it after CALIBRATION_SAMPLES readings.
+  * @returns bool Whether the capture finished with this reading, its result is printed then.
+  */
+  static bool push(unsigned int raw) {
+    if(!is_capturing()) return false;
+    median.push(raw);
+    range.push(raw);
+    if(median.get_count() < CALIBRATION_SAMPLES) return false;
+    Points& points = captured[active / 2];
+    if(active % 2 == 0) points.low = median.value();
+    else points.high = median.value();
+    captured_mask |= 1 << active;
+    Serial.print(F("Capture done\n"));
+    FlashStrings::print_field(F("Median: "), median.value());
+    FlashStrings::print_field(F("Min: "), range.min);
+    FlashStrings::print_field(F("Max: "), range.max);
+    active = CAPTURE_NONE;
+    return true;
+  }
+  /**
+  * @brief Derives the thresholds of every sensor with both captures done, applies them and keeps them in the EEPROM.
+  * @returns bool False if the captures of a sensor were too close together, or inverted, its thresholds stay unchanged then.
+  */
+  static bool store() {
+    bool valid = true;
+    for(unsigned char t = 0; t < TARGET_COUNT; t++){
+      uint8_t both = 3 << (2 * t);
+      if((captured_mask & both) != both) continue;
+      captured_mask &= ~both;
+      if(!derive(t, captured[t])){
+        valid = false;
+        continue;
+      }
+      stored.points[t] = captured[t];
+      stored.calibrated |= 1 << t;
+    }
+    EepromStore::save(CALIBRATION_ADDRESS, stored);
+    if(!valid) Serial.print(F("Captures too close together, thresholds unchanged\n"));
+    print();
+    return valid;
+  }
+  /**
+  * @brief Returns to the compiled-in thresholds, and drops the stored calibration.
+  */
+  static void revert() {
+    stored.calibrated = 0;
+    captured_mask = 0;
+    EepromStore::save(CALIBRATION_ADDRESS, stored);
+    CalibratedBands::soil_moisture.load(SOIL_MOISTURE_BANDS);
+    CalibratedBands::water_level.load(WATER_LEVEL_BANDS);
+    print();
+  }
+  static void print() {
+    print_table(SoilMoistureThresholds::name(), CalibratedBands::soil_moisture, stored.calibrated & (1 << TARGET_SOIL_MOISTURE));
+    print_table(WaterLevelThresholds::name(), CalibratedBands::water_level, stored.calibrated & (1 << TARGET_WATER_LEVEL));
+  }
+};
+
+Calibration::Capture Calibration::active = Calibration::CAPTURE_NONE;
+P2Quantile<32768> Calibration::median;
+RunningRange Calibration::range;
+Calibration::Points Calibration::captured[Calibration::TARGET_COUNT] = {};
+uint8_t Calibration::captured_mask = 0;
+Calibration::Stored Calibration::stored = { Calibration::VERSION, 0, {} };
+
+#endif
+
+#endif
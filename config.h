@@ -0,0 +1,293 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/**
+* Compile-time configuration of the controller.
+* Every option may be overridden via build flags, e.g. -DADC_ISR_ACQUISITION=0.
+*/
+
+// Acquire the analog sensors via the interrupt driven ADC engine instead of blocking analogRead() calls.
+// Only available on the ATmega328P (Uno/Nano), other boards always use analogRead().
+#ifndef ADC_ISR_ACQUISITION
+#define ADC_ISR_ACQUISITION 1
+#endif
+#if ADC_ISR_ACQUISITION && !defined(__AVR_ATmega328P__)
+#undef ADC_ISR_ACQUISITION
+#define ADC_ISR_ACQUISITION 0
+#endif
+
+// Number of conversions thrown away after switching the ADC multiplexer to another channel, lets the sample and hold capacitor settle.
+#ifndef ADC_SETTLE_CONVERSIONS
+#define ADC_SETTLE_CONVERSIONS 1
+#endif
+
+// Sleep between scheduled tasks, idle mode for short waits, power-down mode woken by the watchdog for long waits.
+// ATmega328P only. Serial input is only received while awake or in idle mode.
+#ifndef LOW_POWER_SLEEP
+#define LOW_POWER_SLEEP 0
+#endif
+#if LOW_POWER_SLEEP && !defined(__AVR_ATmega328P__)
+#undef LOW_POWER_SLEEP
+#define LOW_POWER_SLEEP 0
+#endif
+
+// Waits shorter than this are spent in idle mode, waking up from power-down costs a fresh ADC sweep.
+#ifndef POWER_DOWN_MIN_MS
+#define POWER_DOWN_MIN_MS 32
+#endif
+
+// Supply current per mode in uA, used to weigh the time spent in each mode into an estimate of the average current.
+// Defaults are the ATmega328P datasheet typicals at 5V/16MHz, replace them with the values measured on the actual board (regulator, USB bridge and LEDs add to them).
+#ifndef POWER_ACTIVE_UA
+#define POWER_ACTIVE_UA 9000UL
+#endif
+#ifndef POWER_IDLE_UA
+#define POWER_IDLE_UA 2500UL
+#endif
+#ifndef POWER_DOWN_UA
+#define POWER_DOWN_UA 7UL
+#endif
+
+// Output format of the per-cycle sensor report.
+// TELEMETRY_TEXT: human readable text, for the Serial monitor.
+// TELEMETRY_BINARY: framed binary records (see telemetry.h), decoded on the host by tools/telemetry_decode.py.
+#define TELEMETRY_TEXT 0
+#define TELEMETRY_BINARY 1
+#ifndef TELEMETRY_MODE
+#define TELEMETRY_MODE TELEMETRY_TEXT
+#endif
+
+// Serial baud rate, binary telemetry defaults to a higher rate to keep the line time per record short.
+#ifndef SERIAL_BAUD
+#if TELEMETRY_MODE == TELEMETRY_BINARY
+#define SERIAL_BAUD 115200UL
+#else
+#define SERIAL_BAUD 9600UL
+#endif
+#endif
+
+// Size of the binary telemetry TX queue in bytes, power of two, at most 128.
+#ifndef TELEMETRY_QUEUE_SIZE
+#define TELEMETRY_QUEUE_SIZE 64
+#endif
+
+// Digital pin switching the pump.
+#ifndef PUMP_PIN
+#define PUMP_PIN 2
+#endif
+
+// Dose by flow meter pulses on FLOW_METER_PIN (external interrupt INT1 on the ATmega328P) instead of by run time only.
+#ifndef FLOW_METER_ENABLED
+#define FLOW_METER_ENABLED 0
+#endif
+#if FLOW_METER_ENABLED && !defined(__AVR_ATmega328P__)
+#undef FLOW_METER_ENABLED
+#define FLOW_METER_ENABLED 0
+#endif
+#ifndef FLOW_METER_PIN
+#define FLOW_METER_PIN 3
+#endif
+// Flow meter pulses per watering dose, e.g. ~450 pulses per litre for the common YF-S201.
+#ifndef FLOW_METER_DOSE_PULSES
+#define FLOW_METER_DOSE_PULSES 225UL
+#endif
+
+// Sample soil moisture and water detection at a high rate while the pump runs, and stop the dose as soon as the target moisture or an overflow is reached.
+// The dose of pump_on_time, or FLOW_METER_DOSE_PULSES, stays the upper bound.
+#ifndef CLOSED_LOOP_WATERING
+#define CLOSED_LOOP_WATERING 1
+#endif
+
+// Switch the pump off from the analog comparator interrupt as soon as water reaches the bottom of the pot, independent of the sampling rate.
+// ATmega328P only. Needs the water detection signal wired to AIN1 (D7) as well, and a reference divider matching WaterDetectionThresholds::THRESH_OFF on AIN0 (D6),
+// e.g. 50 / 1024 * 5V = ~244mV, 10k over 510R. D6 and D7 are then unavailable as digital pins.
+#ifndef OVERFLOW_GUARD_ENABLED
+#define OVERFLOW_GUARD_ENABLED 0
+#endif
+#if OVERFLOW_GUARD_ENABLED && !defined(__AVR_ATmega328P__)
+#undef OVERFLOW_GUARD_ENABLED
+#define OVERFLOW_GUARD_ENABLED 0
+#endif
+
+// Derive the delay between decisions from the soil moisture trend, between pump_off_delay and pump_off_delay_max, instead of the fixed pump_off_delay.
+#ifndef ADAPTIVE_SAMPLING
+#define ADAPTIVE_SAMPLING 1
+#endif
+
+// Power the soil moisture, water level and water detection sensors via digital pins only around their acquisition, instead of permanently.
+// Saves their supply current between decisions, and slows down the corrosion of resistive probes.
+#ifndef SENSOR_POWER_GATING
+#define SENSOR_POWER_GATING 0
+#endif
+#ifndef SM_POWER_PIN
+#define SM_POWER_PIN 4
+#endif
+#ifndef WL_POWER_PIN
+#define WL_POWER_PIN 5
+#endif
+#ifndef WD_POWER_PIN
+#define WD_POWER_PIN 8
+#endif
+
+// Read the PH from an Atlas Scientific EZO-pH circuit on I2C (SDA A4, SCL A5) instead of the hardcoded OK of the faulty analog PH sensor.
+// ATmega328P only, the I2C sensors run on the interrupt driven TwiMaster.
+#ifndef I2C_PH_SENSOR
+#define I2C_PH_SENSOR 0
+#endif
+#if I2C_PH_SENSOR && !defined(__AVR_ATmega328P__)
+#undef I2C_PH_SENSOR
+#define I2C_PH_SENSOR 0
+#endif
+// Whether any I2C sensor is enabled, derived, do not set it directly.
+#define I2C_SENSORS_ENABLED (I2C_PH_SENSOR)
+#ifndef I2C_CLOCK_HZ
+#define I2C_CLOCK_HZ 100000UL
+#endif
+
+// Water several pots from one board, see ZoneController. Replaces the single zone ActionDecider, and reports in text mode only.
+// Zone z has its soil moisture sensor on mux channel 2z, its water detection sensor on channel 2z + 1, and its pump on ZONE_FIRST_PUMP_PIN + z.
+#ifndef MULTI_ZONE
+#define MULTI_ZONE 0
+#endif
+#ifndef ZONE_COUNT
+#define ZONE_COUNT 4
+#endif
+#ifndef ZONE_FIRST_PUMP_PIN
+#define ZONE_FIRST_PUMP_PIN 2
+#endif
+// Number of pumps the supply drives at the same time, further zones wait for a free slot.
+#ifndef MAX_CONCURRENT_PUMPS
+#define MAX_CONCURRENT_PUMPS 1
+#endif
+// CD4051 (S3 0xFF, 8 channels) or 74HC4067 (16 channels).
+#ifndef MUX_COMMON_PIN
+#define MUX_COMMON_PIN A0
+#endif
+#ifndef MUX_S0_PIN
+#define MUX_S0_PIN 9
+#endif
+#ifndef MUX_S1_PIN
+#define MUX_S1_PIN 10
+#endif
+#ifndef MUX_S2_PIN
+#define MUX_S2_PIN 11
+#endif
+#ifndef MUX_S3_PIN
+#define MUX_S3_PIN 0xFF
+#endif
+
+// Replace the controller by the on-device benchmark suite of benchmark.h, which prints the cycle counts of the hot paths once after boot.
+// On the ATmega328P the suite takes over Timer1, the pump pin is toggled for a few cycles per iteration, disconnect the pump.
+#ifndef BENCHMARK
+#define BENCHMARK 0
+#endif
+// Iterations per benchmark, the Serial bound PrintAll() runs BENCHMARK_ITERATIONS / 16.
+#ifndef BENCHMARK_ITERATIONS
+#define BENCHMARK_ITERATIONS 256
+#endif
+
+// Latency histograms of loop(), the ActionDecider calls and the scheduler tasks, see instrumentation.h.
+// Printed by the serial command 'l', reset by 'L'. Costs PROBE_COUNT * 29 bytes of SRAM and two micros() calls per probe.
+#ifndef INSTRUMENTATION
+#define INSTRUMENTATION 0
+#endif
+
+// Persistent ring log of sensor frames and pump events in the EEPROM, see eeprom_log.h. Streamed out by the serial command 'd', decoded by tools/eeprom_log_decode.py.
+// ATmega328P only.
+#ifndef EEPROM_LOG
+#define EEPROM_LOG 0
+#endif
+#if EEPROM_LOG && !defined(__AVR_ATmega328P__)
+#undef EEPROM_LOG
+#define EEPROM_LOG 0
+#endif
+// EEPROM bytes of the log, EEPROM_LOG_START up to EEPROM_LOG_END exclusive, 8 bytes per record. The bytes below EEPROM_LOG_START stay free for settings.
+#ifndef EEPROM_LOG_START
+#define EEPROM_LOG_START 128
+#endif
+#ifndef EEPROM_LOG_END
+#define EEPROM_LOG_END 1024
+#endif
+// Minimum time in s between two logged sensor frames, limits the EEPROM wear. Pump events are always logged.
+#ifndef EEPROM_LOG_FRAME_INTERVAL_S
+#define EEPROM_LOG_FRAME_INTERVAL_S 60
+#endif
+
+// Keeps the watering phase and the debounced sensor states in the EEPROM, so a reset within a watering cycle resumes the after-watering delay
+// instead of watering again right away, see warm_boot.h. ATmega328P only.
+#ifndef WARM_BOOT
+#define WARM_BOOT 1
+#endif
+#if WARM_BOOT && !defined(__AVR_ATmega328P__)
+#undef WARM_BOOT
+#define WARM_BOOT 0
+#endif
+// EEPROM address of the warm boot state, 8 bytes, below EEPROM_LOG_START.
+#ifndef WARM_BOOT_ADDRESS
+#define WARM_BOOT_ADDRESS 0
+#endif
+// Longest wait in ms at boot for a host to open the serial port, on boards with native USB only, where Serial tells whether one did.
+#ifndef SERIAL_HOST_WAIT_MS
+#define SERIAL_HOST_WAIT_MS 500
+#endif
+
+// Calibrates the soil moisture and water level thresholds on the device, guided by serial commands, and keeps them in the EEPROM, see calibration.h.
+// ATmega328P and the single zone controller only.
+#ifndef ONLINE_CALIBRATION
+#define ONLINE_CALIBRATION 0
+#endif
+#if ONLINE_CALIBRATION && (!defined(__AVR_ATmega328P__) || MULTI_ZONE || BENCHMARK)
+#undef ONLINE_CALIBRATION
+#define ONLINE_CALIBRATION 0
+#endif
+// EEPROM address of the calibration, 12 bytes, after the warm boot state and below EEPROM_LOG_START.
+#ifndef CALIBRATION_ADDRESS
+#define CALIBRATION_ADDRESS 16
+#endif
+// Readings per calibration capture, one every 100ms.
+#ifndef CALIBRATION_SAMPLES
+#define CALIBRATION_SAMPLES 300
+#endif
+
+// Checks every sensor for readings stuck at a rail, flatlines and noise, and the soil moisture against the water detection, see sensor_health.h.
+// A failed sensor reads INVALID_STATE, ActionDecider falls back to rules without the PH check or without the bone dry special case, see RulesFallback.
+#ifndef SENSOR_HEALTH
+#define SENSOR_HEALTH 1
+#endif
+// Reads the analog PH sensor on A2 in place of its hardcoded OK, opt-in, the probe of the original board is stuck. Needs SENSOR_HEALTH, the I2C_PH_SENSOR replaces it.
+// Its PH is ignored until its health check watched it for the flatline window, 30 minutes after boot, a stuck probe fails the check then.
+#ifndef ANALOG_PH_SENSOR
+#define ANALOG_PH_SENSOR 0
+#endif
+#if ANALOG_PH_SENSOR && (!SENSOR_HEALTH || I2C_PH_SENSOR)
+#undef ANALOG_PH_SENSOR
+#define ANALOG_PH_SENSOR 0
+#endif
+
+// Runs the single zone controller as FreeRTOS tasks instead of the loop() scheduler, see rtos_tasks.h.
+// ESP32, and RP2040 with the FreeRTOS SMP option of the arduino-pico core, single zone controller only.
+#ifndef RTOS_TASKS
+#define RTOS_TASKS 0
+#endif
+#if RTOS_TASKS && (!(defined(ARDUINO_ARCH_ESP32) || (defined(ARDUINO_ARCH_RP2040) && defined(__FREERTOS))) || MULTI_ZONE || BENCHMARK)
+#undef RTOS_TASKS
+#define RTOS_TASKS 0
+#endif
+// Core of the acquisition and pump safety task, the ESP32 runs its Wi-Fi stack on core 0.
+#ifndef RTOS_SAFETY_CORE
+#define RTOS_SAFETY_CORE 1
+#endif
+// Core of the decision and telemetry tasks, and of the network uplink.
+#ifndef RTOS_DECISION_CORE
+#define RTOS_DECISION_CORE 0
+#endif
+// Task stacks in bytes.
+#ifndef RTOS_STACK_BYTES
+#define RTOS_STACK_BYTES 4096
+#endif
+// Age after which the safety task drops a pump command, the decision task fell behind and the frame it decided on is outdated.
+#ifndef RTOS_COMMAND_TIMEOUT_MS
+#define RTOS_COMMAND_TIMEOUT_MS 2000
+#endif
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef CRC16_H
+#define CRC16_H
+
+#include <stdint.h>
+
+/**
+* @brief CRC-16/CCITT-FALSE, bitwise, without a lookup table in flash.
+*/
+struct Crc16{
+  static uint16_t ccitt_false(const uint8_t* data, unsigned char length) {
+    uint16_t crc = 0xFFFF;
+    for(unsigned char i = 0; i < length; i++){
+      crc ^= (uint16_t)data[i] << 8;
+      for(unsigned char bit = 0; bit < 8; bit++){
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+      }
+    }
+    return crc;
+  }
+};
+
+#endif
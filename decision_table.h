@@ -0,0 +1,157 @@
+#ifndef DECISION_TABLE_H
+#define DECISION_TABLE_H
+
+#include "hal.h"
+#include "states.h"
+
+/**
+* @brief Fallbacks of the watering rules for sensors found faulty by the SensorHealth checks, one bit each, see FallbackRules.
+*/
+enum RulesFallback : unsigned char{
+  RULES_FULL = 0,
+  // The PH sensor failed, water without the PH check.
+  RULES_IGNORE_PH = 0x01,
+  // The soil moisture, water level or water detection readings are degraded, water in the standard case only, without the bone dry special case.
+  RULES_CONSERVATIVE = 0x02,
+  RULES_FALLBACK_COUNT = 4
+};
+
+/**
+* @brief The watering rules of ActionDecider::DecideAction, as a constexpr function of the four sensor states.
+* Evaluated at compile time only, to generate the DecisionTable.
+*/
+struct WateringRules{
+  /**
+  * @brief Inclusive range check of a state, e.g. DANGER_LOW to DANGER_HIGH.
+  */
+  static constexpr bool in_range(SensorStateLevel state, SensorStateLevel min, SensorStateLevel max) {
+    return (int)state >= (int)min && (int)state <= (int)max;
+  }
+  /**
+  * @param fallback RulesFallback bits, RULES_FULL for the rules as listed.
+  * @returns bool Whether the pump shall be turned on (true) or off (false), see ActionDecider::DecideAction for the rules.
+  */
+  static constexpr bool decide(SensorStateLevel sm_state, SensorStateLevel ph_state, SensorStateLevel wl_state, SensorStateLevel wd_state,
+                               unsigned char fallback = RULES_FULL) {
+    return
+      // Without the PH check every PH state counts as OK.
+      (fallback & RULES_IGNORE_PH) ? decide(sm_state, SensorStateLevel::OK, wl_state, wd_state, fallback & ~RULES_IGNORE_PH) :
+      // Step 1
+      // Any of the sensors reports an invalid state.
+      (sm_state == SensorStateLevel::INVALID_STATE ||
+       ph_state == SensorStateLevel::INVALID_STATE ||
+       wl_state == SensorStateLevel::INVALID_STATE ||
+       wd_state == SensorStateLevel::INVALID_STATE) ? false :
+      // There is no more water in the tank
+      (wl_state == SensorStateLevel::TOO_LOW) ? false :
+      // Step 2
+      // PH has to be in the range of DANGER_LOW - DANGER_HIGH. Or rather, not TOO_LOW OR TOO_HIGH.
+      (ph_state == SensorStateLevel::TOO_LOW || ph_state == SensorStateLevel::TOO_HIGH) ? false :
+      // Step 3
+      // Standard case, PH range already implicitly checked in Step 2.
+      (wd_state == SensorStateLevel::OK &&
+       in_range(wl_state, SensorStateLevel::OK, SensorStateLevel::TOO_HIGH) &&
+       (int)sm_state <= (int)SensorStateLevel::DANGER_HIGH) ? true :
+      // Step 4
+      // Special case, water detected at the bottom but the soil at the top is bone dry.
+      !(fallback & RULES_CONSERVATIVE) &&
+      ((wd_state == SensorStateLevel::OK || wd_state == SensorStateLevel::TOO_HIGH) &&
+       sm_state == SensorStateLevel::TOO_LOW);
+  }
+};
+
+/**
+* @brief Rules policy of a DecisionTable for the rules with the given RulesFallback bits.
+* @tparam Rules Policy providing static constexpr bool decide(sm_state, ph_state, wl_state, wd_state, fallback), e.g. WateringRules.
+*/
+template <class Rules, unsigned char FALLBACK>
+struct FallbackRules{
+  static constexpr bool decide(SensorStateLevel sm_state, SensorStateLevel ph_state, SensorStateLevel wl_state, SensorStateLevel wd_state) {
+    return Rules::decide(sm_state, ph_state, wl_state, wd_state, FALLBACK);
+  }
+};
+
+/**
+* @brief Compile-time list of indices, the avr toolchain ships without <utility>.
+*/
+template <unsigned int... I>
+struct IndexSequence{};
+
+template <unsigned int N, unsigned int... I>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...> {};
+
+template <unsigned int... I>
+struct MakeIndexSequence<0, I...>{
+  typedef IndexSequence<I...> type;
+};
+
+/**
+* @brief Layout of a decision table, one bit per combination of the four sensor states TOO_LOW to INVALID_STATE.
+*/
+struct DecisionTableLayout{
+  // TOO_LOW to TOO_HIGH, plus INVALID_STATE.
+  static constexpr unsigned int STATE_COUNT = (unsigned int)SensorStateLevel::INVALID_STATE + 1;
+  static constexpr unsigned int ENTRY_COUNT = STATE_COUNT * STATE_COUNT * STATE_COUNT * STATE_COUNT;
+  static constexpr unsigned int BYTE_COUNT = (ENTRY_COUNT + 7) / 8;
+
+  static constexpr unsigned int index(SensorStateLevel sm_state, SensorStateLevel ph_state, SensorStateLevel wl_state, SensorStateLevel wd_state) {
+    return (((unsigned int)sm_state * STATE_COUNT + (unsigned int)ph_state) * STATE_COUNT + (unsigned int)wl_state) * STATE_COUNT + (unsigned int)wd_state;
+  }
+  static constexpr SensorStateLevel state_at(unsigned int i, unsigned int weight) {
+    return static_cast<SensorStateLevel>(i / weight % STATE_COUNT);
+  }
+};
+
+/**
+* @brief Decision rules compiled into a packed bit table in flash (162 bytes). A decision is one index computation and one bit test,
+* independent of how many rules the Rules policy evaluates.
+* @tparam Rules Policy providing static constexpr bool decide(sm_state, ph_state, wl_state, wd_state).
+*/
+template <class Rules, class Sequence = typename MakeIndexSequence<DecisionTableLayout::BYTE_COUNT>::type>
+struct DecisionTable;
+
+template <class Rules, unsigned int... B>
+struct DecisionTable<Rules, IndexSequence<B...> > : public DecisionTableLayout{
+  /**
+  * @brief Evaluates Rules for the combination of states encoded in the table index i.
+  */
+  static constexpr bool rule_at(unsigned int i) {
+    return i < ENTRY_COUNT && Rules::decide(
+      state_at(i, STATE_COUNT * STATE_COUNT * STATE_COUNT),
+      state_at(i, STATE_COUNT * STATE_COUNT),
+      state_at(i, STATE_COUNT),
+      state_at(i, 1));
+  }
+  static constexpr unsigned char byte_at(unsigned int b) {
+    return
+      (rule_at(b * 8 + 0) ? 0x01 : 0) | (rule_at(b * 8 + 1) ? 0x02 : 0) |
+      (rule_at(b * 8 + 2) ? 0x04 : 0) | (rule_at(b * 8 + 3) ? 0x08 : 0) |
+      (rule_at(b * 8 + 4) ? 0x10 : 0) | (rule_at(b * 8 + 5) ? 0x20 : 0) |
+      (rule_at(b * 8 + 6) ? 0x40 : 0) | (rule_at(b * 8 + 7) ? 0x80 : 0);
+  }
+
+  static constexpr unsigned char bytes[BYTE_COUNT] PROGMEM = { byte_at(B)... };
+
+  /**
+  * @brief Compile-time check of the packing, every bit of the table reads back as the Rules evaluation of its state combination, entries lo to hi - 1.
+  * @note Table and check come from the same Rules, whether the Rules match the original branchy decision is checked on the host, see host/reference_rules.h.
+  */
+  static constexpr bool matches_rules(unsigned int lo = 0, unsigned int hi = ENTRY_COUNT) {
+    return hi - lo == 1
+      ? (((bytes[lo / 8] >> (lo % 8)) & 1) != 0) == rule_at(lo)
+      : matches_rules(lo, lo + (hi - lo) / 2) && matches_rules(lo + (hi - lo) / 2, hi);
+  }
+
+  /**
+  * @brief Looks up the decision for the given sensor states.
+  */
+  static bool lookup(SensorStateLevel sm_state, SensorStateLevel ph_state, SensorStateLevel wl_state, SensorStateLevel wd_state) {
+    unsigned int i = index(sm_state, ph_state, wl_state, wd_state);
+    return (pgm_read_byte(&bytes[i >> 3]) >> (i & 7)) & 1;
+  }
+};
+
+template <class Rules, unsigned int... B>
+constexpr unsigned char DecisionTable<Rules, IndexSequence<B...> >::bytes[DecisionTableLayout::BYTE_COUNT] PROGMEM;
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef DOSING_ENGINE_H
+#define DOSING_ENGINE_H
+
+#include "hal.h"
+#include "config.h"
+#include "pump_driver.h"
+
+#if defined(__AVR_ATmega328P__)
+#include <util/atomic.h>
+#endif
+
+/**
+* @brief Runs the pump for an exact dose, independent of what the main loop is doing.
+* On the ATmega328P a 1ms Timer1 compare match interrupt counts the dose down and switches the pump off from the ISR,
+* with FLOW_METER_ENABLED the flow meter pulses on INT1 are counted down as well, the run time then acts as an upper bound.
+* The main loop only polls for the completion. Other boards count the dose down in update() via millis().
+*/
+class DosingEngine{
+public:
+  typedef PumpDriver<PUMP_PIN> Pump;
+
+  enum State{
+    IDLE = 0,
+    RUNNING = 1,
+    COMPLETED = 2,
+    ABORTED = 3
+  };
+private:
+  static volatile State state;
+  static volatile unsigned long remaining_ms;
+  static volatile unsigned long dosed_ms;
+#if FLOW_METER_ENABLED
+  static volatile unsigned long remaining_pulses;
+  static volatile unsigned long dosed_pulses;
+#endif
+#if !defined(__AVR_ATmega328P__)
+  static uint32_t last_ms;
+#endif
+
+  static void timer_start() {
+#if defined(__AVR_ATmega328P__)
+    // CTC mode, prescaler 64, 16MHz / 64 / 250 = 1kHz.
+    TCCR1A = 0;
+    TCCR1B = 0;
+    TCNT1 = 0;
+    OCR1A = (F_CPU / 64UL / 1000UL) - 1;
+    TIFR1 = _BV(OCF1A);
+    TIMSK1 |= _BV(OCIE1A);
+    TCCR1B = _BV(WGM12) | _BV(CS11) | _BV(CS10);
+#if FLOW_METER_ENABLED
+    pinMode(FLOW_METER_PIN, INPUT_PULLUP);
+    // Falling edge on INT1.
+    EICRA = (EICRA & ~(_BV(ISC10) | _BV(ISC11))) | _BV(ISC11);
+    EIFR = _BV(INTF1);
+    EIMSK |= _BV(INT1);
+#endif
+#else
+    last_ms = millis();
+#endif
+  }
+  static void timer_stop() {
+#if defined(__AVR_ATmega328P__)
+    TCCR1B = 0;
+    TIMSK1 &= ~_BV(OCIE1A);
+#if FLOW_METER_ENABLED
+    EIMSK &= ~_BV(INT1);
+#endif
+#endif
+  }
+  static void finish(State result) {
+    Pump::turn_off();
+    timer_stop();
+    state = result;
+  }
+public:
+  /**
+  * @brief Turns the pump on and off again after exactly ms milliseconds.
+  */
+  static void start_ms(unsigned long ms) {
+    if(ms == 0) return;
+    timer_stop();
+    remaining_ms = ms;
+    dosed_ms = 0;
+#if FLOW_METER_ENABLED
+    // Run time only, the flow meter pulses are counted but do not end the dose.
+    remaining_pulses = 0;
+    dosed_pulses = 0;
+#endif
+    state = RUNNING;
+    Pump::turn_on();
+    timer_start();
+  }
+#if FLOW_METER_ENABLED
+  /**
+  * @brief Turns the pump on and off again after the given number of flow meter pulses, or after max_ms, whatever comes first.
+  */
+  static void start_pulses(unsigned long pulses, unsigned long max_ms) {
+    if(pulses == 0 || max_ms == 0) return;
+    timer_stop();
+    remaining_ms = max_ms;
+    dosed_ms = 0;
+    remaining_pulses = pulses;
+    dosed_pulses = 0;
+    state = RUNNING;
+    Pump::turn_on();
+    timer_start();
+  }
+  static unsigned long get_dosed_pulses() {
+    unsigned long pulses;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+      pulses = dosed_pulses;
+    }
+    return pulses;
+  }
+#endif
+  /**
+  * @brief Stops a running dose right away.
+  * @note Atomic on the ATmega328P, a Timer1 tick between the check and finish() would otherwise complete the dose and get overwritten with ABORTED.
+  */
+  static void abort() {
+#if defined(__AVR_ATmega328P__)
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+      if(state == RUNNING) finish(ABORTED);
+    }
+#else
+    if(state == RUNNING) finish(ABORTED);
+#endif
+  }
+  static bool is_running() {
+    return state == RUNNING;
+  }
+  /**
+  * @brief Reports a finished dose exactly once.
+  * @returns State COMPLETED or ABORTED once after a dose ended, IDLE otherwise, also while the dose is running.
+  */
+  static State poll_finished() {
+    State current = state;
+    if(current == COMPLETED || current == ABORTED){
+      state = IDLE;
+      return current;
+    }
+    return IDLE;
+  }
+  /**
+  * @returns unsigned long The run time of the current or last dose in ms.
+  */
+  static unsigned long get_dosed_ms() {
+    unsigned long ms;
+#if defined(__AVR_ATmega328P__)
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+      ms = dosed_ms;
+    }
+#else
+    ms = dosed_ms;
+#endif
+    return ms;
+  }
+  /**
+  * @brief Counts the dose down on boards without the Timer1 implementation, call from loop(). Does nothing on the ATmega328P.
+  */
+  static void update() {
+#if !defined(__AVR_ATmega328P__)
+    if(state != RUNNING) return;
+    uint32_t now = millis();
+    uint32_t elapsed = now - last_ms;
+    last_ms = now;
+    dosed_ms += elapsed;
+    if(elapsed >= remaining_ms) finish(COMPLETED);
+    else remaining_ms -= elapsed;
+#endif
+  }
+  /**
+  * @brief Called from the Timer1 compare match ISR only, once per ms.
+  */
+  static void on_tick() {
+    if(state != RUNNING) return;
+    dosed_ms++;
+    if(--remaining_ms == 0) finish(COMPLETED);
+  }
+#if FLOW_METER_ENABLED
+  /**
+  * @brief Called from the flow meter ISR only, once per pulse.
+  */
+  static void on_pulse() {
+    if(state != RUNNING) return;
+    dosed_pulses++;
+    if(remaining_pulses > 0 && --remaining_pulses == 0) finish(COMPLETED);
+  }
+#endif
+};
+
+volatile DosingEngine::State DosingEngine::state = DosingEngine::IDLE;
+volatile unsigned long DosingEngine::remaining_ms = 0;
+volatile unsigned long DosingEngine::dosed_ms = 0;
+#if FLOW_METER_ENABLED
+volatile unsigned long DosingEngine::remaining_pulses = 0;
+volatile unsigned long DosingEngine::dosed_pulses = 0;
+#endif
+#if !defined(__AVR_ATmega328P__)
+uint32_t DosingEngine::last_ms = 0;
+#endif
+
+#if defined(__AVR_ATmega328P__)
+ISR(TIMER1_COMPA_vect) {
+  DosingEngine::on_tick();
+}
+#if FLOW_METER_ENABLED
+ISR(INT1_vect) {
+  DosingEngine::on_pulse();
+}
+#endif
+#endif
+
+#endif
@@ -0,0 +1,386 @@
+#ifndef EEPROM_LOG_H
+#define EEPROM_LOG_H
+
+#include "hal.h"
+#include "config.h"
+#include "sensor_frame.h"
+
+/**
+* @brief One 8 byte slot of the EEPROM log: sequence number, header and a 6 byte payload, bit fields packed LSB first.
+* Header: type in bits 7-5, pump on in bit 4.
+*   TIME:  uptime s (32), boot number (8), flags (8), bit 7 marks the record written at boot, bits 0-3 the reset cause (MCUSR).
+*   KEY:   soil moisture raw (10), water level raw (10), water detection raw (10), states (4 x 3, in SensorSlot order). Follows a TIME record of the same second.
+*   DELTA: s since the previous frame (12), raw differences (3 x 8, signed), states (4 x 3).
+*   EVENT: uptime s (32), EepromLog::Event (8), argument (8).
+* @note tools/eeprom_log_decode.py mirrors this layout.
+*/
+struct LogRecord{
+  static constexpr unsigned char SIZE = 8;
+  static constexpr unsigned char HEADER = 1;
+  static constexpr unsigned char PAYLOAD = 2;
+
+  uint8_t bytes[SIZE];
+
+  uint8_t get_type() const {
+    return bytes[HEADER] >> 5;
+  }
+};
+
+/**
+* @brief Builds the LogRecords of sensor frames and events, the PH raw value is not logged, only its state.
+*/
+struct LogRecordCodec{
+  enum Type{
+    TYPE_TIME = 0,
+    TYPE_KEY = 1,
+    TYPE_DELTA = 2,
+    TYPE_EVENT = 3,
+    // Erased EEPROM reads 0xFF.
+    TYPE_EMPTY = 7
+  };
+  static constexpr unsigned char RAW_BITS = 10;
+  static constexpr unsigned char STATE_BITS = 3;
+  static constexpr unsigned char DT_BITS = 12;
+  static constexpr unsigned long DELTA_MAX_DT_S = (1UL << DT_BITS) - 1;
+  static constexpr int DELTA_MAX = 127;
+  static constexpr unsigned char BOOT_FLAG = 0x80;
+
+  static void put_bits(uint8_t* payload, unsigned char offset, unsigned char width, unsigned long value) {
+    for(unsigned char i = 0; i < width; i++, offset++){
+      uint8_t mask = 1 << (offset & 7);
+      if(value & 1) payload[offset >> 3] |= mask;
+      else payload[offset >> 3] &= ~mask;
+      value >>= 1;
+    }
+  }
+  static unsigned long get_bits(const uint8_t* payload, unsigned char offset, unsigned char width) {
+    unsigned long value = 0;
+    for(unsigned char i = 0; i < width; i++){
+      if(payload[(offset + i) >> 3] & (1 << ((offset + i) & 7))) value |= 1UL << i;
+    }
+    return value;
+  }
+  /**
+  * @returns SensorSlot The frame slot of the i-th logged raw value.
+  */
+  static SensorSlot raw_slot(unsigned char i) {
+    return i == 0 ? SLOT_SOIL_MOISTURE : i == 1 ? SLOT_WATER_LEVEL : SLOT_WATER_DETECTION;
+  }
+  static LogRecord make(Type type, bool pump_on) {
+    LogRecord record;
+    for(unsigned char i = 0; i < LogRecord::SIZE; i++) record.bytes[i] = 0;
+    record.bytes[LogRecord::HEADER] = (type << 5) | (pump_on ? 0x10 : 0);
+    return record;
+  }
+  static void put_states(LogRecord& record, unsigned char offset, const SensorFrame& frame) {
+    for(unsigned char i = 0; i < SENSOR_SLOT_COUNT; i++){
+      put_bits(record.bytes + LogRecord::PAYLOAD, offset + i * STATE_BITS, STATE_BITS, (uint8_t)frame.state[i]);
+    }
+  }
+  static LogRecord time(unsigned long uptime_s, uint8_t boot, uint8_t flags) {
+    LogRecord record = make(TYPE_TIME, false);
+    put_bits(record.bytes + LogRecord::PAYLOAD, 0, 32, uptime_s);
+    record.bytes[LogRecord::PAYLOAD + 4] = boot;
+    record.bytes[LogRecord::PAYLOAD + 5] = flags;
+    return record;
+  }
+  static LogRecord key(const SensorFrame& frame, bool pump_on) {
+    LogRecord record = make(TYPE_KEY, pump_on);
+    for(unsigned char i = 0; i < 3; i++){
+      put_bits(record.bytes + LogRecord::PAYLOAD, i * RAW_BITS, RAW_BITS, frame.raw[raw_slot(i)]);
+    }
+    put_states(record, 3 * RAW_BITS, frame);
+    return record;
+  }
+  /**
+  * @param previous_raw The logged raw values of the previous frame, in raw_slot() order.
+  * @returns bool False if dt_s or a difference does not fit a DELTA record, a TIME and KEY record are needed then.
+  */
+  static bool delta(const SensorFrame& frame, const unsigned int* previous_raw, unsigned long dt_s, bool pump_on, LogRecord& record) {
+    if(dt_s > DELTA_MAX_DT_S) return false;
+    record = make(TYPE_DELTA, pump_on);
+    put_bits(record.bytes + LogRecord::PAYLOAD, 0, DT_BITS, dt_s);
+    for(unsigned char i = 0; i < 3; i++){
+      int difference = (int)frame.raw[raw_slot(i)] - (int)previous_raw[i];
+      if(difference > DELTA_MAX || difference < -DELTA_MAX) return false;
+      put_bits(record.bytes + LogRecord::PAYLOAD, DT_BITS + i * 8, 8, (uint8_t)(int8_t)difference);
+    }
+    put_states(record, DT_BITS + 3 * 8, frame);
+    return true;
+  }
+  static LogRecord event(unsigned long uptime_s, uint8_t code, uint8_t argument, bool pump_on) {
+    LogRecord record = make(TYPE_EVENT, pump_on);
+    put_bits(record.bytes + LogRecord::PAYLOAD, 0, 32, uptime_s);
+    record.bytes[LogRecord::PAYLOAD + 4] = code;
+    record.bytes[LogRecord::PAYLOAD + 5] = argument;
+    return record;
+  }
+};
+
+#if EEPROM_LOG
+
+#include <util/atomic.h>
+#include "spsc_ring.h"
+
+/**
+* @brief Ring log of LogRecords in the EEPROM between EEPROM_LOG_START and EEPROM_LOG_END, see EEPROM_LOG.
+* Records are staged in RAM and written in batches by the EEPROM-ready interrupt, one byte per interrupt, so logging never waits for the 3.4ms byte writes.
+* Bytes which already hold the value are skipped, which saves the write and the wear.
+* The slots are written in turn, which spreads the wear evenly. Consecutive slots carry consecutive 8 bit sequence numbers,
+* so begin() finds the newest record as the last one before a break in the sequence, without a separate head pointer that would wear out first.
+* The sequence number of a slot is written last, a record torn by a reset keeps its old number and is taken as the oldest one.
+* @note The log takes over the EEPROM-ready interrupt, other EEPROM accesses have to pause() it, see WarmBoot.
+*/
+class EepromLog{
+public:
+  enum Event{
+    EVENT_PUMP_ON = 1,
+    // Argument: run time in s.
+    EVENT_PUMP_OFF = 2,
+    EVENT_PUMP_ABORTED = 3,
+    // Argument: 0 detected by the closed-loop watering, 1 by the OverflowGuard.
+    EVENT_OVERFLOW = 4
+  };
+  static constexpr unsigned char VERSION = 1;
+  static_assert((EEPROM_LOG_END - EEPROM_LOG_START) / LogRecord::SIZE >= 2 && (EEPROM_LOG_END - EEPROM_LOG_START) / LogRecord::SIZE < 256,
+    "The log needs 2 to 255 slots, the sequence numbers are 8 bit.");
+  static constexpr unsigned char SLOT_COUNT = (EEPROM_LOG_END - EEPROM_LOG_START) / LogRecord::SIZE;
+  static_assert(EEPROM_LOG_END <= E2END + 1, "EEPROM_LOG_END is beyond the EEPROM.");
+private:
+  // Staged frames are written once this many records are waiting, events right away.
+  static constexpr unsigned char BATCH_RECORDS = 4;
+  // A KEY record at least every this many frames, bounds the damage of a lost record to the decoder.
+  static constexpr unsigned char KEY_INTERVAL = 16;
+
+  // Produced by loop(), consumed by the EEPROM-ready ISR.
+  static SpscRing<LogRecord, 8> pending;
+  static uint8_t next_sequence;
+  static uint8_t boot;
+  // Records lost to a full staging buffer, reported by dump().
+  static unsigned int dropped;
+  // Delta encoding state of the frames.
+  static unsigned int last_raw[3];
+  static unsigned long last_frame_s;
+  static unsigned char frames_since_key;
+  static bool has_frame;
+  // Owned by the ISR once begin() returned.
+  static unsigned char write_slot;
+  static unsigned char write_index;
+
+  static unsigned int address(unsigned char slot, unsigned char index) {
+    return EEPROM_LOG_START + (unsigned int)slot * LogRecord::SIZE + index;
+  }
+  /**
+  * @brief Reads one byte, waits for a write in progress with interrupts enabled.
+  */
+  static uint8_t read_byte(unsigned int address) {
+    for(;;){
+      while(EECR & _BV(EEPE)) {}
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        // The ISR may have started the next write in the meantime.
+        if(!(EECR & _BV(EEPE))){
+          EEAR = address;
+          EECR |= _BV(EERE);
+          return EEDR;
+        }
+      }
+    }
+  }
+  static uint8_t type_at(unsigned char slot) {
+    return read_byte(address(slot, LogRecord::HEADER)) >> 5;
+  }
+  static uint8_t sequence_at(unsigned char slot) {
+    return read_byte(address(slot, 0));
+  }
+  /**
+  * @brief Finds the newest record.
+  * @returns bool False if the log is empty.
+  */
+  static bool find_head(unsigned char& head) {
+    if(type_at(0) == LogRecordCodec::TYPE_EMPTY) return false;
+    uint8_t sequence = sequence_at(0);
+    for(unsigned char slot = 0; slot < SLOT_COUNT - 1; slot++){
+      uint8_t next = sequence_at(slot + 1);
+      if(type_at(slot + 1) == LogRecordCodec::TYPE_EMPTY || next != (uint8_t)(sequence + 1)){
+        head = slot;
+        return true;
+      }
+      sequence = next;
+    }
+    head = SLOT_COUNT - 1;
+    return true;
+  }
+  /**
+  * @returns uint8_t The boot number of the newest TIME record, walking back from head.
+  */
+  static uint8_t last_boot(unsigned char head) {
+    unsigned char slot = head;
+    for(unsigned int i = 0; i < SLOT_COUNT; i++){
+      uint8_t type = type_at(slot);
+      if(type == LogRecordCodec::TYPE_EMPTY) break;
+      if(type == LogRecordCodec::TYPE_TIME) return read_byte(address(slot, LogRecord::PAYLOAD + 4));
+      slot = slot == 0 ? SLOT_COUNT - 1 : slot - 1;
+    }
+    return 0;
+  }
+  static void append(LogRecord record) {
+    record.bytes[0] = next_sequence;
+    if(!pending.push(record)){
+      dropped++;
+      return;
+    }
+    next_sequence++;
+    if(pending.size() >= BATCH_RECORDS) flush();
+  }
+  static void wait_idle() {
+    flush();
+    while(!is_idle()) {}
+  }
+public:
+  /**
+  * @brief Finds the head of the log and appends a TIME record marking the boot, call once from setup().
+  * @param reset_cause The reset flags of MCUSR, 0 if unknown.
+  */
+  static void begin(uint8_t reset_cause) {
+    unsigned char head;
+    if(find_head(head)){
+      write_slot = head + 1 < SLOT_COUNT ? head + 1 : 0;
+      next_sequence = sequence_at(head) + 1;
+      boot = last_boot(head) + 1;
+    }
+    else{
+      write_slot = 0;
+      next_sequence = 0;
+      boot = 0;
+    }
+    write_index = 0;
+    append(LogRecordCodec::time(millis() / 1000UL, boot, LogRecordCodec::BOOT_FLAG | (reset_cause & 0x0F)));
+    flush();
+  }
+  /**
+  * @brief Logs a sensor frame, at most one per EEPROM_LOG_FRAME_INTERVAL_S, as a DELTA to the previous one where it fits.
+  */
+  static void log_frame(const SensorFrame& frame, bool pump_on) {
+    unsigned long now_s = frame.timestamp / 1000UL;
+    if(has_frame && now_s - last_frame_s < EEPROM_LOG_FRAME_INTERVAL_S) return;
+    // Room for a TIME and a KEY record, a dropped record would break the DELTA chain. The next frame starts a new one.
+    if(pending.free_space() < 2){
+      dropped++;
+      has_frame = false;
+      return;
+    }
+    LogRecord record;
+    if(has_frame && frames_since_key < KEY_INTERVAL && LogRecordCodec::delta(frame, last_raw, now_s - last_frame_s, pump_on, record)){
+      append(record);
+      frames_since_key++;
+    }
+    else{
+      append(LogRecordCodec::time(now_s, boot, 0));
+      append(LogRecordCodec::key(frame, pump_on));
+      frames_since_key = 0;
+    }
+    for(unsigned char i = 0; i < 3; i++) last_raw[i] = frame.raw[LogRecordCodec::raw_slot(i)];
+    last_frame_s = now_s;
+    has_frame = true;
+  }
+  /**
+  * @brief Logs an event and writes everything staged right away.
+  */
+  static void log_event(Event event, uint8_t argument, bool pump_on) {
+    append(LogRecordCodec::event(millis() / 1000UL, event, argument, pump_on));
+    flush();
+  }
+  /**
+  * @brief Starts writing the staged records.
+  */
+  static void flush() {
+    // A single sbi, EECR is in the bit addressable I/O range, so the ISR cannot be interrupted halfway.
+    if(!pending.is_empty()) EECR |= _BV(EERIE);
+  }
+  /**
+  * @brief Stops the ISR after the byte in progress, e.g. for the blocking accesses of avr/eeprom.h. flush() resumes where the ISR stopped.
+  */
+  static void pause() {
+    EECR &= ~_BV(EERIE);
+  }
+  /**
+  * @returns bool Whether no write is in progress, power-down would stop the EEPROM-ready interrupt from waking the CPU.
+  */
+  static bool is_idle() {
+    return !(EECR & _BV(EERIE));
+  }
+  /**
+  * @brief Streams the log out in one binary burst, oldest record first, after writing everything staged:
+  * "ELOG", version, record size, record count, dropped records (16 bit little-endian), then the records.
+  * @note Blocks for the writes and the transmission, meant for the serial command only.
+  */
+  static void dump() {
+    wait_idle();
+    unsigned char head = 0;
+    unsigned int count = 0;
+    unsigned char oldest = 0;
+    if(find_head(head)){
+      unsigned char after = head + 1 < SLOT_COUNT ? head + 1 : 0;
+      bool wrapped = after != 0 && type_at(after) != LogRecordCodec::TYPE_EMPTY;
+      count = wrapped || after == 0 ? SLOT_COUNT : head + 1;
+      oldest = wrapped ? after : 0;
+    }
+    Serial.write((const uint8_t*)"ELOG", 4);
+    Serial.write(VERSION);
+    Serial.write(LogRecord::SIZE);
+    Serial.write((uint8_t)count);
+    Serial.write((uint8_t)(dropped & 0xFF));
+    Serial.write((uint8_t)(dropped >> 8));
+    unsigned char slot = oldest;
+    for(unsigned int i = 0; i < count; i++){
+      for(unsigned char b = 0; b < LogRecord::SIZE; b++) Serial.write(read_byte(address(slot, b)));
+      slot = slot + 1 < SLOT_COUNT ? slot + 1 : 0;
+    }
+  }
+  /**
+  * @brief Called from the EEPROM-ready ISR only, which fires as long as no write is in progress and the interrupt is enabled.
+  * Writes the next byte of the oldest staged record which differs from the EEPROM, and disables the interrupt once nothing is staged anymore.
+  */
+  static void on_ready() {
+    LogRecord record;
+    if(!pending.peek(record)){
+      EECR &= ~_BV(EERIE);
+      return;
+    }
+    while(write_index < LogRecord::SIZE){
+      // Bytes 1 to 7, then the sequence number.
+      unsigned char index = write_index + 1 < LogRecord::SIZE ? write_index + 1 : 0;
+      write_index++;
+      EEAR = address(write_slot, index);
+      EECR |= _BV(EERE);
+      if(EEDR == record.bytes[index]) continue;
+      EEDR = record.bytes[index];
+      // Atomic erase and write, EEPE within 4 cycles of EEMPE, interrupts are off in the ISR.
+      EECR |= _BV(EEMPE);
+      EECR |= _BV(EEPE);
+      return;
+    }
+    pending.pop(record);
+    write_index = 0;
+    write_slot = write_slot + 1 < SLOT_COUNT ? write_slot + 1 : 0;
+  }
+};
+
+SpscRing<LogRecord, 8> EepromLog::pending;
+uint8_t EepromLog::next_sequence = 0;
+uint8_t EepromLog::boot = 0;
+unsigned int EepromLog::dropped = 0;
+unsigned int EepromLog::last_raw[3] = { 0, 0, 0 };
+unsigned long EepromLog::last_frame_s = 0;
+unsigned char EepromLog::frames_since_key = 0;
+bool EepromLog::has_frame = false;
+unsigned char EepromLog::write_slot = 0;
+unsigned char EepromLog::write_index = 0;
+
+ISR(EE_READY_vect) {
+  EepromLog::on_ready();
+}
+
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef EEPROM_STORE_H
+#define EEPROM_STORE_H
+
+#include "hal.h"
+#include "config.h"
+#include "crc16.h"
+
+#if defined(__AVR_ATmega328P__)
+
+#include <avr/eeprom.h>
+#if EEPROM_LOG
+#include "eeprom_log.h"
+#endif
+
+/**
+* @brief Settings structs in the EEPROM, each followed by its CRC-16/CCITT-FALSE, e.g. the WarmBoot state and the Calibration.
+* Blocking, 3.4ms per written byte, only the bytes which changed are written.
+* @note Pauses the EepromLog ISR around every access, it would change the address registers in the middle of one.
+*/
+class EepromStore{
+  static void pause() {
+#if EEPROM_LOG
+    EepromLog::pause();
+#endif
+  }
+  static void resume() {
+#if EEPROM_LOG
+    EepromLog::flush();
+#endif
+  }
+public:
+  template <typename T>
+  static constexpr unsigned int size() {
+    return sizeof(T) + sizeof(uint16_t);
+  }
+  /**
+  * @returns bool False if the CRC does not match, e.g. for erased or never written EEPROM, value is undefined then.
+  */
+  template <typename T>
+  static bool load(unsigned int address, T& value) {
+    uint16_t crc;
+    pause();
+    eeprom_read_block(&value, reinterpret_cast<const void*>(address), sizeof(T));
+    eeprom_read_block(&crc, reinterpret_cast<const void*>(address + sizeof(T)), sizeof(crc));
+    resume();
+    return crc == Crc16::ccitt_false(reinterpret_cast<const uint8_t*>(&value), sizeof(T));
+  }
+  template <typename T>
+  static void save(unsigned int address, const T& value) {
+    uint16_t crc = Crc16::ccitt_false(reinterpret_cast<const uint8_t*>(&value), sizeof(T));
+    pause();
+    eeprom_update_block(&value, reinterpret_cast<void*>(address), sizeof(T));
+    eeprom_update_block(&crc, reinterpret_cast<void*>(address + sizeof(T)), sizeof(crc));
+    resume();
+  }
+};
+
+#endif
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef FAST_PIN_H
+#define FAST_PIN_H
+
+#include "hal.h"
+
+/**
+* @brief Digital output pin bound at compile time.
+* On the ATmega328P (Uno/Nano) the port register and bitmask are resolved at compile time,
+* so set_high()/set_low() compile into a single sbi/cbi instruction: atomic, a few cycles, and safe to call from any ISR.
+* Other boards fall back to digitalWrite().
+* @tparam PIN Arduino pin number, 0 to 19 on the ATmega328P (D0-D13, A0-A5).
+*/
+template <unsigned char PIN>
+struct FastPin{
+#if defined(__AVR_ATmega328P__)
+  static_assert(PIN < 20, "The ATmega328P has no digital port for this pin.");
+private:
+  enum Port{
+    PORT_B,
+    PORT_C,
+    PORT_D
+  };
+  // D0-D7: PORTD, D8-D13: PORTB, A0-A5: PORTC.
+  static constexpr Port PORT = PIN < 8 ? PORT_D : PIN < 14 ? PORT_B : PORT_C;
+  static constexpr unsigned char MASK = 1 << (PIN < 8 ? PIN : PIN < 14 ? PIN - 8 : PIN - 14);
+public:
+  static void set_output() {
+    if(PORT == PORT_D) DDRD |= MASK;
+    else if(PORT == PORT_B) DDRB |= MASK;
+    else DDRC |= MASK;
+  }
+  static void set_high() {
+    if(PORT == PORT_D) PORTD |= MASK;
+    else if(PORT == PORT_B) PORTB |= MASK;
+    else PORTC |= MASK;
+  }
+  static void set_low() {
+    if(PORT == PORT_D) PORTD &= ~MASK;
+    else if(PORT == PORT_B) PORTB &= ~MASK;
+    else PORTC &= ~MASK;
+  }
+  /**
+  * @returns bool The level the pin is driven to, read back from the output latch.
+  */
+  static bool is_high() {
+    if(PORT == PORT_D) return PORTD & MASK;
+    if(PORT == PORT_B) return PORTB & MASK;
+    return PORTC & MASK;
+  }
+#else
+private:
+  static volatile bool high;
+public:
+  static void set_output() {
+    pinMode(PIN, OUTPUT);
+  }
+  static void set_high() {
+    high = true;
+    digitalWrite(PIN, HIGH);
+  }
+  static void set_low() {
+    high = false;
+    digitalWrite(PIN, LOW);
+  }
+  static bool is_high() {
+    return high;
+  }
+#endif
+};
+
+#if !defined(__AVR_ATmega328P__)
+template <unsigned char PIN>
+volatile bool FastPin<PIN>::high = false;
+#endif
+
+#endif
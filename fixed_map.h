@@ -0,0 +1,36 @@
+#ifndef FIXED_MAP_H
+#define FIXED_MAP_H
+
+/**
+* @brief Linear mapping of 10 bit readings to the MIN...MAX range in fixed point, as a replacement of map() and float math.
+* The scale factor (MAX - MIN) * 2^FRAC_BITS / 1023 is computed at compile time as a Q16 constant,
+* so a mapping is one 32 bit multiplication and a shift, instead of map()'s 32 bit division or a software float multiplication.
+* Results are rounded to the nearest unit of the last place, map() truncates instead, so both differ by at most one unit.
+* @tparam MIN The mapped value of a reading of 0.
+* @tparam MAX The mapped value of a reading of 1023.
+* @tparam FRAC_BITS Fractional bits of the result, e.g. 8 for a Q8 result, 0 for whole numbers.
+*/
+template <long MIN, long MAX, unsigned char FRAC_BITS = 0>
+struct FixedMap{
+  static_assert(MAX > MIN, "The mapped range has to be ascending.");
+  static constexpr unsigned char SHIFT = 16;
+  // Width of the range in output units.
+  static constexpr unsigned long SPAN = (unsigned long)(MAX - MIN) << FRAC_BITS;
+  static_assert(SPAN < (1UL << SHIFT), "The mapped range is too wide for a Q16 scale factor, reduce it or FRAC_BITS.");
+  static constexpr unsigned long SCALE = ((SPAN << SHIFT) + 511UL) / 1023UL;
+  static constexpr long OFFSET = MIN * (1L << FRAC_BITS);
+  // Value of one unit of the result, e.g. 256 for a Q8 result.
+  static constexpr long ONE = 1L << FRAC_BITS;
+
+  /**
+  * @param raw The reading, ranging from 0 to 1023, larger values are clamped.
+  * @returns long The mapped value with FRAC_BITS fractional bits, ranging from MIN * ONE to MAX * ONE.
+  */
+  static long map(unsigned int raw) {
+    if(raw > 1023) raw = 1023;
+    // 1023 * SCALE is about SPAN * 2^16 < 2^32.
+    return OFFSET + (long)(((unsigned long)raw * SCALE + (1UL << (SHIFT - 1))) >> SHIFT);
+  }
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef FLASH_STRINGS_H
+#define FLASH_STRINGS_H
+
+#include "hal.h"
+#include "states.h"
+
+/**
+* @brief Pointer to a string in flash, as returned by F().
+* On AVR every plain string literal is copied into SRAM at startup, a string created by F() or stored in PROGMEM stays in flash,
+* and Serial.print() reads it from there byte by byte. Use it for every diagnostic string.
+*/
+typedef const __FlashStringHelper* FlashString;
+
+// Names of the SensorStateLevel values, indexed by the state.
+const char STATE_NAME_TOO_LOW[] PROGMEM = "TOO_LOW";
+const char STATE_NAME_DANGER_LOW[] PROGMEM = "DANGER_LOW";
+const char STATE_NAME_OK[] PROGMEM = "OK";
+const char STATE_NAME_DANGER_HIGH[] PROGMEM = "DANGER_HIGH";
+const char STATE_NAME_TOO_HIGH[] PROGMEM = "TOO_HIGH";
+const char STATE_NAME_INVALID_STATE[] PROGMEM = "INVALID_STATE";
+const char* const STATE_NAMES[] PROGMEM = {
+  STATE_NAME_TOO_LOW,
+  STATE_NAME_DANGER_LOW,
+  STATE_NAME_OK,
+  STATE_NAME_DANGER_HIGH,
+  STATE_NAME_TOO_HIGH,
+  STATE_NAME_INVALID_STATE
+};
+static_assert(sizeof(STATE_NAMES) / sizeof(STATE_NAMES[0]) == SensorStateLevel::INVALID_STATE + 1, "Every SensorStateLevel needs a name.");
+
+/**
+* @brief Printing helpers for the flash resident strings.
+*/
+struct FlashStrings{
+  /**
+  * @returns FlashString The name of the state, "INVALID_STATE" for anything out of range.
+  */
+  static FlashString state_name(SensorStateLevel state) {
+    unsigned char index = state > SensorStateLevel::INVALID_STATE ? SensorStateLevel::INVALID_STATE : state;
+    return reinterpret_cast<FlashString>(pgm_read_ptr(&STATE_NAMES[index]));
+  }
+  /**
+  * @brief Prints one "label value" line, the label from flash.
+  */
+  template <class T>
+  static void print_field(FlashString label, T value) {
+    Serial.print(label);
+    Serial.print(value);
+    Serial.print('\n');
+  }
+};
+
+#endif
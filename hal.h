@@ -0,0 +1,18 @@
+#ifndef HAL_H
+#define HAL_H
+
+/**
+* @brief The part of the Arduino core the controller is written against: analogRead(), digitalWrite(), digitalRead(), pinMode(), map(),
+* millis(), micros(), delay(), Serial, F() and the PROGMEM accessors.
+* Every header calling into the core includes this one instead of relying on the sketch's implicit Arduino.h.
+* Boards get the Arduino core itself. HOST_SIM builds (host/Makefile) get host/hal_host.h, which implements the same functions on the PC,
+* against a virtual clock and simulated pins, so the sensors, ActionDecider and the scheduler run unchanged off-device.
+* @note A host build is a non-AVR build, it exercises the generic fallbacks, never the register level ATmega328P paths.
+*/
+#if defined(HOST_SIM)
+#include "host/hal_host.h"
+#else
+#include <Arduino.h>
+#endif
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+* @brief Mock of the Arduino core for HOST_SIM builds, see hal.h.
+* Time is virtual, it only moves when the harness calls HostHal::advance_us() or the code under test calls delay().
+* millis() and micros() are 32 bit as on the boards, they wrap after 49.7 days and 71.6 minutes, HostHal::start_at_ms() moves the power-on time close to a wrap.
+* Analog inputs return whatever the harness stored in HostHal::analog, digital pins latch their last write.
+* Pin numbers follow the Uno/Nano layout, D0-D13 and A0-A7 as 14-21.
+*/
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+static const uint8_t A0 = 14;
+static const uint8_t A1 = 15;
+static const uint8_t A2 = 16;
+static const uint8_t A3 = 17;
+static const uint8_t A4 = 18;
+static const uint8_t A5 = 19;
+static const uint8_t A6 = 20;
+static const uint8_t A7 = 21;
+
+// Flash is ordinary memory on the host.
+// The reads go through memcpy, the tables hold unsigned int, 32 bit on the host, of which a word read takes the low half (little-endian).
+#define PROGMEM
+#define PSTR(s) (s)
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+inline uint8_t pgm_read_byte(const void* address) {
+  uint8_t value;
+  memcpy(&value, address, sizeof(value));
+  return value;
+}
+inline uint16_t pgm_read_word(const void* address) {
+  uint16_t value;
+  memcpy(&value, address, sizeof(value));
+  return value;
+}
+inline uint32_t pgm_read_dword(const void* address) {
+  uint32_t value;
+  memcpy(&value, address, sizeof(value));
+  return value;
+}
+inline void* pgm_read_ptr(const void* address) {
+  void* value;
+  memcpy(&value, address, sizeof(value));
+  return value;
+}
+
+struct HostHal{
+  static constexpr uint8_t PIN_COUNT = 22;
+  static constexpr uint16_t ANALOG_MAX = 1023;
+
+  // Virtual time in us, the 32 bit millis() and micros() are its low bits. Starts at 0 at power-on, unless moved by start_at_ms().
+  static uint64_t now_us;
+  // Value returned by analogRead(), per pin.
+  static uint16_t analog[PIN_COUNT];
+  // Output latch and mode of every pin.
+  static uint8_t level[PIN_COUNT];
+  static uint8_t mode[PIN_COUNT];
+  // Number of analogRead() calls, to spot acquisition changes in a simulation.
+  static unsigned long long analog_reads;
+
+  static void advance_us(uint32_t us) {
+    now_us += us;
+  }
+  static void advance_ms(uint32_t ms) {
+    now_us += (uint64_t)ms * 1000U;
+  }
+  /**
+  * @brief Sets the clock to ms, call before setup(). The board's clock reads that value after ms since power-on, e.g. a few minutes before the wrap.
+  */
+  static void start_at_ms(uint32_t ms) {
+    now_us = (uint64_t)ms * 1000U;
+  }
+  /**
+  * @brief Sets the value of an analog input, clamped to the 10 bit range of the ADC.
+  */
+  static void set_analog(uint8_t pin, long value) {
+    if(pin >= PIN_COUNT) return;
+    if(value < 0) value = 0;
+    if(value > ANALOG_MAX) value = ANALOG_MAX;
+    analog[pin] = (uint16_t)value;
+  }
+  static bool is_high(uint8_t pin) {
+    return pin < PIN_COUNT && level[pin] == HIGH;
+  }
+  /**
+  * @brief Back to the power-on state, between two simulation runs within one process.
+  */
+  static void reset() {
+    now_us = 0;
+    analog_reads = 0;
+    memset(analog, 0, sizeof(analog));
+    memset(level, 0, sizeof(level));
+    memset(mode, 0, sizeof(mode));
+  }
+};
+
+uint64_t HostHal::now_us = 0;
+uint16_t HostHal::analog[HostHal::PIN_COUNT] = {};
+uint8_t HostHal::level[HostHal::PIN_COUNT] = {};
+uint8_t HostHal::mode[HostHal::PIN_COUNT] = {};
+unsigned long long HostHal::analog_reads = 0;
+
+inline uint32_t millis() {
+  return (uint32_t)(HostHal::now_us / 1000U);
+}
+inline uint32_t micros() {
+  return (uint32_t)HostHal::now_us;
+}
+inline void delay(uint32_t ms) {
+  HostHal::advance_ms(ms);
+}
+inline void delayMicroseconds(unsigned int us) {
+  HostHal::advance_us(us);
+}
+inline int analogRead(uint8_t pin) {
+  HostHal::analog_reads++;
+  return pin < HostHal::PIN_COUNT ? HostHal::analog[pin] : 0;
+}
+inline void pinMode(uint8_t pin, uint8_t mode) {
+  if(pin < HostHal::PIN_COUNT) HostHal::mode[pin] = mode;
+}
+inline void digitalWrite(uint8_t pin, uint8_t value) {
+  if(pin < HostHal::PIN_COUNT) HostHal::level[pin] = value ? HIGH : LOW;
+}
+inline int digitalRead(uint8_t pin) {
+  return HostHal::is_high(pin) ? HIGH : LOW;
+}
+inline long map(long x, long in_min, long in_max, long out_min, long out_max) {
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+// No interrupts on the host, everything runs on the harness's thread.
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+/**
+* @brief Serial port of the host build, writes to a stdio stream, nullptr discards the output.
+* The TX buffer drains instantly, input is whatever the harness queued via inject().
+*/
+class HostSerial{
+  // Same size as the TX buffer of the AVR core.
+  static constexpr int TX_BUFFER_SIZE = 64;
+  static constexpr unsigned char RX_BUFFER_SIZE = 64;
+
+  FILE* out;
+  char rx[RX_BUFFER_SIZE];
+  unsigned char rx_head;
+  unsigned char rx_tail;
+  unsigned long long written;
+
+  size_t put(const char* text) {
+    size_t length = strlen(text);
+    written += length;
+    if(out) fwrite(text, 1, length, out);
+    return length;
+  }
+  size_t put_format(const char* format, long long value) {
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), format, value);
+    return put(buffer);
+  }
+public:
+  HostSerial() : out(nullptr), rx(), rx_head(0), rx_tail(0), written(0) {}
+
+  void set_output(FILE* stream) {
+    out = stream;
+  }
+  /**
+  * @brief Queues bytes for available()/read(), e.g. a serial command. Bytes beyond the RX buffer are dropped, as on the board.
+  */
+  void inject(const char* text) {
+    while(*text){
+      unsigned char next = (rx_head + 1) % RX_BUFFER_SIZE;
+      if(next == rx_tail) return;
+      rx[rx_head] = *text++;
+      rx_head = next;
+    }
+  }
+  /**
+  * @returns unsigned long long The number of bytes printed or written since power-on, also with the output discarded.
+  */
+  unsigned long long get_written() const {
+    return written;
+  }
+
+  void begin(unsigned long baud) {
+    (void)baud;
+  }
+  void end() {}
+  void flush() {
+    if(out) fflush(out);
+  }
+  explicit operator bool() const {
+    return true;
+  }
+  int available() const {
+    return (rx_head - rx_tail + RX_BUFFER_SIZE) % RX_BUFFER_SIZE;
+  }
+  int peek() const {
+    return rx_head == rx_tail ? -1 : (unsigned char)rx[rx_tail];
+  }
+  int read() {
+    if(rx_head == rx_tail) return -1;
+    unsigned char c = rx[rx_tail];
+    rx_tail = (rx_tail + 1) % RX_BUFFER_SIZE;
+    return c;
+  }
+  int availableForWrite() const {
+    return TX_BUFFER_SIZE - 1;
+  }
+  size_t write(uint8_t byte) {
+    written++;
+    if(out) fputc(byte, out);
+    return 1;
+  }
+  size_t write(const uint8_t* data, size_t length) {
+    written += length;
+    if(out) fwrite(data, 1, length, out);
+    return length;
+  }
+
+  size_t print(const char* text) { return put(text); }
+  size_t print(const __FlashStringHelper* text) { return put(reinterpret_cast<const char*>(text)); }
+  size_t print(char c) { return write((uint8_t)c); }
+  // Numbers are printed in decimal, as by the Print class of the core.
+  size_t print(unsigned char value) { return put_format("%lld", value); }
+  size_t print(int value) { return put_format("%lld", value); }
+  size_t print(unsigned int value) { return put_format("%lld", value); }
+  size_t print(long value) { return put_format("%lld", value); }
+  size_t print(unsigned long value) {
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%lu", value);
+    return put(buffer);
+  }
+  size_t print(double value, int digits = 2) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+    return put(buffer);
+  }
+
+  size_t println() { return put("\r\n"); }
+  template <typename T>
+  size_t println(T value) {
+    size_t n = print(value);
+    return n + println();
+  }
+};
+
+HostSerial Serial;
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef PLANT_MODEL_H
+#define PLANT_MODEL_H
+
+#include <stdint.h>
+
+/**
+* @brief Synthetic pot and reservoir for the host simulation, in raw ADC counts of the sensors.
+* The soil dries out steadily and is wetted while the pump runs, water pumped into saturated soil drains to the bottom of the pot,
+* and the reservoir is refilled by the gardener some time after it ran low.
+* Every reading carries a little uniform noise from a seeded xorshift generator, so a run is reproducible.
+*/
+class PlantModel{
+public:
+  struct Parameters{
+    // Soil moisture, wetter soil reads lower values.
+    double soil_start;
+    double soil_dry_per_hour;
+    double soil_wet_per_s;
+    // Soil wetter than this passes pumped water through to the water detection sensor.
+    double soil_saturated;
+    double soil_min;
+    // Water level, the reservoir reads lower values as it empties.
+    double reservoir_start;
+    double reservoir_per_s;
+    double reservoir_refill_below;
+    double reservoir_refill_after_h;
+    // Water detection at the bottom of the pot.
+    double drainage_per_s;
+    double drainage_dry_per_hour;
+    unsigned int noise;
+  };
+  static Parameters defaults() {
+    Parameters p;
+    p.soil_start = 600;
+    p.soil_dry_per_hour = 4;
+    p.soil_wet_per_s = 6;
+    p.soil_saturated = 380;
+    p.soil_min = 250;
+    p.reservoir_start = 900;
+    p.reservoir_per_s = 1.5;
+    p.reservoir_refill_below = 250;
+    p.reservoir_refill_after_h = 24;
+    p.drainage_per_s = 25;
+    p.drainage_dry_per_hour = 60;
+    p.noise = 2;
+    return p;
+  }
+private:
+  Parameters p;
+  double soil;
+  double reservoir;
+  double drainage;
+  // Time in hours since the reservoir ran low, negative while it is above the refill mark.
+  double low_for_h;
+  uint32_t rng;
+
+  uint32_t next_random() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+  }
+  long noisy(double value) {
+    if(p.noise == 0) return (long)(value + 0.5);
+    long offset = (long)(next_random() % (2 * p.noise + 1)) - (long)p.noise;
+    return (long)(value + 0.5) + offset;
+  }
+public:
+  PlantModel(const Parameters& parameters, uint32_t seed) :
+    p(parameters), soil(parameters.soil_start), reservoir(parameters.reservoir_start), drainage(0), low_for_h(-1), rng(seed ? seed : 1) {}
+
+  /**
+  * @brief Advances the model by ms milliseconds with the pump on or off.
+  */
+  void step(unsigned long ms, bool pump_on) {
+    double s = ms / 1000.0;
+    double h = s / 3600.0;
+    soil += p.soil_dry_per_hour * h;
+    drainage -= p.drainage_dry_per_hour * h;
+    // The pump runs dry once the reservoir is empty.
+    if(pump_on && reservoir > 0){
+      reservoir -= p.reservoir_per_s * s;
+      if(soil > p.soil_saturated) soil -= p.soil_wet_per_s * s;
+      else drainage += p.drainage_per_s * s;
+    }
+    if(soil < p.soil_min) soil = p.soil_min;
+    if(soil > 1023) soil = 1023;
+    if(drainage < 0) drainage = 0;
+    if(drainage > 1023) drainage = 1023;
+    if(reservoir < 0) reservoir = 0;
+
+    if(reservoir < p.reservoir_refill_below){
+      if(low_for_h < 0) low_for_h = 0;
+      low_for_h += h;
+      if(low_for_h >= p.reservoir_refill_after_h){
+        reservoir = p.reservoir_start;
+        low_for_h = -1;
+      }
+    }
+  }
+  long soil_raw() { return noisy(soil); }
+  long reservoir_raw() { return noisy(reservoir); }
+  long drainage_raw() { return noisy(drainage); }
+};
+
+#endif
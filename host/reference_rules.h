@@ -0,0 +1,89 @@
+#ifndef REFERENCE_RULES_H
+#define REFERENCE_RULES_H
+
+#include "../decision_table.h"
+
+/**
+* @brief The branchy ActionDecider::DecideAction() of the sketch before the rules were compiled into a DecisionTable, host only.
+* Kept verbatim as the reference the packed tables are checked against, see check_rules(). The PH sensor was hardcoded OK back then,
+* ph_state is a parameter here, so the check covers the PH steps as well.
+* @returns bool Whether the pump shall be turned on (true) or off (false).
+*/
+inline bool reference_decide(SensorStateLevel sm_state, SensorStateLevel ph_state, SensorStateLevel wl_state, SensorStateLevel wd_state) {
+  // Step 1
+  // Any of the sensors reports an invalid state.
+  if(
+      sm_state == SensorStateLevel::INVALID_STATE ||
+      ph_state == SensorStateLevel::INVALID_STATE ||
+      wl_state == SensorStateLevel::INVALID_STATE ||
+      wd_state == SensorStateLevel::INVALID_STATE
+    ) {
+      return false;
+    }
+  // There is no more water in the tank
+  if(wl_state == SensorStateLevel::TOO_LOW){
+    return false;
+  }
+
+  // Step 2
+  // Handle PH out of range first.
+  // PH has to be in the range of DANGER_LOW - DANGER_HIGH. Or rather, not TOO_LOW OR TOO_HIGH.
+  if(ph_state == SensorStateLevel::TOO_LOW || ph_state == SensorStateLevel::TOO_HIGH){
+    return false;
+  }
+
+  // Step 3
+  // Standard case
+  // PH range already implicitly checked in Step 2
+  if(
+    wd_state == SensorStateLevel::OK &&
+    ((int)wl_state >= (int)SensorStateLevel::OK && (int)wl_state <= (int)SensorStateLevel::TOO_HIGH) && // Check if the water level is in range OK - TOO_HIGH
+    ((int)sm_state <= (int)SensorStateLevel::DANGER_HIGH) // Check if soil moisture is in range TOO_LOW - DANGER_HIGH. Or rather, if not TOO_HIGH.
+  ){
+    return true;
+  }
+
+  // Step 4
+  // Special cases
+  // Case 1
+  // As in Step 3, the PH range has already been implicitly validated prior, in Step 2.
+  if(
+    (wd_state == SensorStateLevel::OK || wd_state == SensorStateLevel::TOO_HIGH) &&
+    (sm_state == SensorStateLevel::TOO_LOW)
+  ){
+    return true;
+  }
+
+  // All other cases, turn pump off.
+  return false;
+}
+
+/**
+* @brief Compares the packed DecisionTable of the WateringRules against reference_decide(), for every one of the 6^4 state combinations,
+* and the table without the PH check against the reference with the PH hardcoded OK, the behaviour of the sketch back then.
+* @returns unsigned int The number of mismatching entries, each one is printed to stderr.
+*/
+inline unsigned int check_rules() {
+  typedef DecisionTable<WateringRules> Table;
+  typedef DecisionTable<FallbackRules<WateringRules, RULES_IGNORE_PH> > IgnorePhTable;
+  unsigned int mismatches = 0;
+  for(unsigned int i = 0; i < DecisionTableLayout::ENTRY_COUNT; i++){
+    const unsigned int n = DecisionTableLayout::STATE_COUNT;
+    SensorStateLevel sm = DecisionTableLayout::state_at(i, n * n * n);
+    SensorStateLevel ph = DecisionTableLayout::state_at(i, n * n);
+    SensorStateLevel wl = DecisionTableLayout::state_at(i, n);
+    SensorStateLevel wd = DecisionTableLayout::state_at(i, 1);
+    bool table = Table::lookup(sm, ph, wl, wd);
+    bool ignore_ph = IgnorePhTable::lookup(sm, ph, wl, wd);
+    bool reference = reference_decide(sm, ph, wl, wd);
+    bool reference_ph_ok = reference_decide(sm, SensorStateLevel::OK, wl, wd);
+    if(table != reference || ignore_ph != reference_ph_ok){
+      fprintf(stderr, "rules: sm %d ph %d wl %d wd %d: table %d, reference %d, without PH %d, reference %d\n",
+        sm, ph, wl, wd, table, reference, ignore_ph, reference_ph_ok);
+      mismatches++;
+    }
+  }
+  return mismatches;
+}
+
+#endif
@@ -0,0 +1,257 @@
+/**
+* Host simulation of the single-zone controller.
+* setup() and loop() of main.c.ino run unchanged against the mock HAL of hal_host.h, in virtual time:
+* after every loop() pass the clock jumps straight to the next scheduled task, so months of controller time pass in seconds.
+* While a dose runs the clock advances in 1ms steps, the resolution of the DosingEngine timer on the board.
+*
+* Sensor input is either a synthetic pot (PlantModel) reacting to the pump, or a trace recorded with TELEMETRY_BINARY
+* and decoded by tools/telemetry_decode.py, which is replayed open loop, each row held until the next one.
+*   sim [--days N] [--seed N] [--serial] [--max-starts N] [--start-ms N]
+*   sim --replay trace.csv [--serial] [--max-starts N] [--start-ms N]
+*   sim --check-rules
+* Every pump switch is printed as a CSV line on stdout, a summary goes to stderr.
+* --max-starts fails the run with exit code 1 above N pump starts, for the regression checks of make check.
+* --start-ms sets the board's clock at power-on, e.g. 4294000000 to run through the 32 bit millis() wrap shortly after the start.
+* --check-rules compares the compiled decision tables against the original branchy rules, see reference_rules.h, and exits.
+* Diffing the stdout of two builds shows what a change of the rules or thresholds does to the watering.
+* --serial passes the controllers own Serial output through to stderr.
+*/
+#include <chrono>
+#include <vector>
+
+#include "hal_host.h"
+#include "plant_model.h"
+#include "reference_rules.h"
+#include "../main.c.ino"
+
+#if MULTI_ZONE || BENCHMARK
+#error "The host simulation covers the single-zone flow only, build it with MULTI_ZONE=0 and BENCHMARK=0."
+#endif
+
+namespace{
+
+const uint8_t SM_SIM_PIN = SingleZoneSensors::SM_PIN;
+const uint8_t WL_SIM_PIN = SingleZoneSensors::WL_PIN;
+const uint8_t WD_SIM_PIN = SingleZoneSensors::WD_PIN;
+
+// Consecutive loop() passes without advancing the clock, before the clock is forced on by 1ms.
+const unsigned int MAX_ZERO_STEPS = 16;
+
+struct TraceRow{
+  // Relative to the first row.
+  unsigned long long time_ms;
+  long sm;
+  long wl;
+  long wd;
+  bool pump_on;
+};
+
+/**
+* @brief Reads a telemetry_decode.py CSV file.
+*/
+class TraceReader{
+  int timestamp_column;
+  int sm_column;
+  int wl_column;
+  int wd_column;
+  int pump_column;
+  unsigned long long base;
+  unsigned long last_raw_timestamp;
+
+  static int find_column(const char* header, const char* name) {
+    char copy[512];
+    snprintf(copy, sizeof(copy), "%s", header);
+    int index = 0;
+    for(char* field = strtok(copy, ",\r\n"); field; field = strtok(nullptr, ",\r\n"), index++){
+      if(strcmp(field, name) == 0) return index;
+    }
+    fprintf(stderr, "trace: no column %s\n", name);
+    return -1;
+  }
+  /**
+  * @brief The millis() timestamps of a board wrap after 49 days and restart at 0 on a reset, both continue the trace time.
+  */
+  unsigned long long unwrap(unsigned long raw, bool first) {
+    if(!first && raw < last_raw_timestamp){
+      if(last_raw_timestamp - raw > 0x80000000UL) base += 0x100000000ULL;
+      else base += last_raw_timestamp - raw;
+    }
+    last_raw_timestamp = raw;
+    return base + raw;
+  }
+public:
+  TraceReader() : timestamp_column(-1), sm_column(-1), wl_column(-1), wd_column(-1), pump_column(-1), base(0), last_raw_timestamp(0) {}
+
+  bool read(const char* path, std::vector<TraceRow>& rows) {
+    FILE* file = fopen(path, "r");
+    if(!file){
+      fprintf(stderr, "trace: cannot open %s\n", path);
+      return false;
+    }
+    char line[512];
+    if(fgets(line, sizeof(line), file)){
+      timestamp_column = find_column(line, "timestamp_ms");
+      sm_column = find_column(line, "soil_moisture_raw");
+      wl_column = find_column(line, "water_level_raw");
+      wd_column = find_column(line, "water_detection_raw");
+      pump_column = find_column(line, "pump_on");
+    }
+    if(timestamp_column < 0 || sm_column < 0 || wl_column < 0 || wd_column < 0){
+      fclose(file);
+      return false;
+    }
+    unsigned long long origin = 0;
+    while(fgets(line, sizeof(line), file)){
+      long values[32];
+      int count = 0;
+      for(char* field = strtok(line, ",\r\n"); field && count < 32; field = strtok(nullptr, ",\r\n")){
+        values[count++] = strtol(field, nullptr, 10);
+      }
+      if(count <= timestamp_column || count <= sm_column || count <= wl_column || count <= wd_column) continue;
+      TraceRow row;
+      unsigned long long time = unwrap((unsigned long)values[timestamp_column], rows.empty());
+      if(rows.empty()) origin = time;
+      row.time_ms = time - origin;
+      row.sm = values[sm_column];
+      row.wl = values[wl_column];
+      row.wd = values[wd_column];
+      row.pump_on = pump_column >= 0 && pump_column < count && values[pump_column] != 0;
+      rows.push_back(row);
+    }
+    fclose(file);
+    if(rows.empty()) fprintf(stderr, "trace: no rows in %s\n", path);
+    return !rows.empty();
+  }
+};
+
+struct SimStats{
+  unsigned long long passes;
+  unsigned long pump_starts;
+  unsigned long long pump_ms;
+  // Synthetic: time with the soil too dry, and with water standing at the bottom of the pot.
+  unsigned long long dry_ms;
+  unsigned long long wet_bottom_ms;
+  // Replay: time the simulated pump differs from the recorded one.
+  unsigned long long mismatch_ms;
+};
+
+// Time since the start of the run, millis() wraps.
+uint64_t simulated_ms = 0;
+
+void print_event(bool pump_on) {
+  const SensorFrame& frame = ad.GetFrame();
+  printf("%lu,%s,%u,%u,%u\n", (unsigned long)millis(), pump_on ? "pump_on" : "pump_off",
+    frame.raw[SLOT_SOIL_MOISTURE], frame.raw[SLOT_WATER_LEVEL], frame.raw[SLOT_WATER_DETECTION]);
+}
+
+/**
+* @returns unsigned long Time to advance the clock by after a loop() pass, at most limit.
+*/
+unsigned long next_step(unsigned long limit, unsigned int& zero_steps) {
+  unsigned long step = DosingEngine::is_running() ? 1 : scheduler.time_until_next();
+  if(step == 0 && ++zero_steps > MAX_ZERO_STEPS) step = 1;
+  if(step != 0) zero_steps = 0;
+  return step < limit ? step : limit;
+}
+
+/**
+* @brief Runs the controller for duration_ms, feed is called before every loop() pass with the time since the previous one,
+* and returns the longest step it allows until its input changes.
+*/
+template <typename Feed>
+void run(unsigned long long duration_ms, SimStats& stats, Feed feed) {
+  setup();
+  bool pump_on = false;
+  unsigned int zero_steps = 0;
+  unsigned long elapsed = 0;
+  while(simulated_ms < duration_ms){
+    unsigned long limit = feed(elapsed, pump_on, stats);
+    loop();
+    stats.passes++;
+    bool now_on = HostHal::is_high(PUMP_PIN);
+    if(now_on != pump_on){
+      print_event(now_on);
+      if(now_on) stats.pump_starts++;
+      pump_on = now_on;
+    }
+    unsigned long long remaining = duration_ms - simulated_ms;
+    if(remaining < limit) limit = (unsigned long)remaining;
+    elapsed = next_step(limit, zero_steps);
+    HostHal::advance_ms(elapsed);
+    simulated_ms += elapsed;
+    if(pump_on) stats.pump_ms += elapsed;
+  }
+}
+
+int usage() {
+  fprintf(stderr, "usage: sim [--days N] [--seed N] [--serial] [--max-starts N] [--start-ms N]\n       sim --replay trace.csv [--serial] [--max-starts N] [--start-ms N]\n       sim --check-rules\n");
+  return 2;
+}
+
+}
+
+int main(int argc, char** argv) {
+  double days = 30;
+  uint32_t seed = 1;
+  const char* replay = nullptr;
+  long max_starts = -1;
+  for(int i = 1; i < argc; i++){
+    if(strcmp(argv[i], "--days") == 0 && i + 1 < argc) days = atof(argv[++i]);
+    else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc) replay = argv[++i];
+    else if(strcmp(argv[i], "--serial") == 0) Serial.set_output(stderr);
+    else if(strcmp(argv[i], "--check-rules") == 0){
+      unsigned int mismatches = check_rules();
+      fprintf(stderr, "rules: %u of %u table entries differ from the reference\n", mismatches, DecisionTableLayout::ENTRY_COUNT);
+      return mismatches == 0 ? 0 : 1;
+    }
+    else if(strcmp(argv[i], "--start-ms") == 0 && i + 1 < argc) HostHal::start_at_ms((uint32_t)strtoul(argv[++i], nullptr, 10));
+    else if(strcmp(argv[i], "--max-starts") == 0 && i + 1 < argc) max_starts = strtol(argv[++i], nullptr, 10);
+    else return usage();
+  }
+
+  SimStats stats = {};
+  printf("time_ms,event,soil_moisture_raw,water_level_raw,water_detection_raw\n");
+  std::chrono::steady_clock::time_point wall_start = std::chrono::steady_clock::now();
+
+  if(replay){
+    std::vector<TraceRow> rows;
+    if(!TraceReader().read(replay, rows)) return 1;
+    size_t current = 0;
+    run(rows.back().time_ms, stats, [&](unsigned long elapsed, bool pump_on, SimStats& s) -> unsigned long {
+      if(pump_on != rows[current].pump_on) s.mismatch_ms += elapsed;
+      while(current + 1 < rows.size() && rows[current + 1].time_ms <= simulated_ms) current++;
+      HostHal::set_analog(SM_SIM_PIN, rows[current].sm);
+      HostHal::set_analog(WL_SIM_PIN, rows[current].wl);
+      HostHal::set_analog(WD_SIM_PIN, rows[current].wd);
+      return current + 1 < rows.size() ? (unsigned long)(rows[current + 1].time_ms - simulated_ms) : 60000UL;
+    });
+  }
+  else{
+    PlantModel plant(PlantModel::defaults(), seed);
+    run((unsigned long long)(days * 24 * 3600 * 1000), stats, [&](unsigned long elapsed, bool pump_on, SimStats& s) -> unsigned long {
+      plant.step(elapsed, pump_on);
+      long sm = plant.soil_raw();
+      long wd = plant.drainage_raw();
+      if(sm > (long)SoilMoistureThresholds::THRESH_DANGEROUSLY_DRY) s.dry_ms += elapsed;
+      if(wd > (long)WaterDetectionThresholds::THRESH_OFF) s.wet_bottom_ms += elapsed;
+      HostHal::set_analog(SM_SIM_PIN, sm);
+      HostHal::set_analog(WL_SIM_PIN, plant.reservoir_raw());
+      HostHal::set_analog(WD_SIM_PIN, wd);
+      return 60000UL;
+    });
+  }
+
+  double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+  double simulated_h = simulated_ms / 3600000.0;
+  fprintf(stderr, "simulated: %.1f h in %.2f s wall, %llu loop passes (%.0f per s)\n",
+    simulated_h, wall_s, stats.passes, wall_s > 0 ? stats.passes / wall_s : 0.0);
+  fprintf(stderr, "pump: %lu starts, %.1f s total\n", stats.pump_starts, stats.pump_ms / 1000.0);
+  if(replay) fprintf(stderr, "pump state differs from the recording: %.1f s\n", stats.mismatch_ms / 1000.0);
+  else fprintf(stderr, "soil too dry: %.1f h, water at the bottom: %.1f h\n", stats.dry_ms / 3600000.0, stats.wet_bottom_ms / 3600000.0);
+  if(max_starts >= 0 && stats.pump_starts > (unsigned long)max_starts){
+    fprintf(stderr, "FAIL: %lu pump starts, at most %ld expected\n", stats.pump_starts, max_starts);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,237 @@
+#ifndef I2C_SENSORS_H
+#define I2C_SENSORS_H
+
+#include "hal.h"
+#include "config.h"
+
+#if I2C_SENSORS_ENABLED
+
+#include "twi_master.h"
+#include "analog_sensors.h"
+
+/**
+* @brief I2C sensor driven by a non-blocking state machine on the TwiMaster, the counterpart of AnalogSensor for digital modules.
+* A measurement is a command write, the conversion time of the device, and a response read. update() advances it,
+* so a conversion of hundreds of ms and the bus transactions overlap with everything else the loop does.
+* @tparam Device Policy class providing:
+*   - static constexpr uint8_t ADDRESS, the 7 bit bus address.
+*   - static constexpr unsigned int CONVERSION_MS, the time between the command and the response.
+*   - static constexpr unsigned char RESPONSE_SIZE, the bytes to read.
+*   - static unsigned char command(uint8_t* out), writes the measurement command, at most TwiMaster::TX_SIZE bytes, and returns its length.
+*   - static bool decode(const uint8_t* response, unsigned int& value), converts the response into the reading, false if it is invalid.
+*   - static SensorStateLevel classify(unsigned int value, SensorStateLevel current), assigns a reading its state, with hysteresis.
+*   - static constexpr unsigned char CONFIRM_SAMPLES, the consecutive samples a new state needs, see SensorDebounce.
+*   - static FlashString name(), the sensors name used by SerialPrint, via F().
+*/
+template <class Device>
+class I2cSensor : public AnalogSensorBase{
+  enum Phase{
+    PHASE_IDLE = 0,
+    PHASE_COMMAND = 1,
+    PHASE_CONVERTING = 2,
+    PHASE_READING = 3
+  };
+  // A transaction of a few bytes takes well below 1ms at 100kHz, anything longer is a stuck bus.
+  static constexpr unsigned long TRANSACTION_TIMEOUT_MS = 25;
+
+  Phase phase;
+  bool requested;
+  bool valid;
+  unsigned int value;
+  uint32_t timestamp;
+  // Start of the current phase, the deadline of the conversion in PHASE_CONVERTING.
+  uint32_t phase_ms;
+  unsigned int errors;
+  uint8_t response[Device::RESPONSE_SIZE];
+
+  void enter(Phase next, uint32_t now) {
+    this->phase = next;
+    this->phase_ms = now;
+  }
+  void fail() {
+    this->valid = false;
+    this->errors++;
+    this->phase = PHASE_IDLE;
+  }
+  /**
+  * @returns TwiMaster::Status The status of the running transaction, a timed out one is reset and FAILED.
+  */
+  TwiMaster::Status transaction_status(uint32_t now) {
+    TwiMaster::Status status = TwiMaster::get_status();
+    if(status == TwiMaster::BUSY && now - this->phase_ms > TRANSACTION_TIMEOUT_MS){
+      TwiMaster::reset();
+      status = TwiMaster::FAILED;
+    }
+    if(status == TwiMaster::DONE || status == TwiMaster::FAILED) TwiMaster::release();
+    return status;
+  }
+public:
+  typedef Device DeviceType;
+
+  I2cSensor() : phase(PHASE_IDLE), requested(false), valid(false), value(0), timestamp(0), phase_ms(0), errors(0), response() {}
+
+  /**
+  * @brief Requests a measurement, it starts with the next update() finding the bus idle. Ignored while a measurement runs.
+  */
+  void start() {
+    if(this->phase == PHASE_IDLE) this->requested = true;
+  }
+  /**
+  * @brief Advances the measurement, call periodically, e.g. from ActionDecider::Acquire().
+  */
+  void update(uint32_t now) {
+    switch(this->phase){
+      case PHASE_IDLE:{
+        if(!this->requested) break;
+        uint8_t command[TwiMaster::TX_SIZE];
+        unsigned char length = Device::command(command);
+        if(TwiMaster::start_write(Device::ADDRESS, command, length)){
+          this->requested = false;
+          this->enter(PHASE_COMMAND, now);
+        }
+        break;
+      }
+      case PHASE_COMMAND:{
+        TwiMaster::Status status = this->transaction_status(now);
+        if(status == TwiMaster::DONE) this->enter(PHASE_CONVERTING, now + Device::CONVERSION_MS);
+        else if(status == TwiMaster::FAILED) this->fail();
+        break;
+      }
+      case PHASE_CONVERTING:
+        if((int32_t)(now - this->phase_ms) < 0) break;
+        if(TwiMaster::start_read(Device::ADDRESS, this->response, Device::RESPONSE_SIZE)) this->enter(PHASE_READING, now);
+        break;
+      case PHASE_READING:{
+        TwiMaster::Status status = this->transaction_status(now);
+        if(status == TwiMaster::DONE){
+          unsigned int decoded;
+          if(Device::decode(this->response, decoded)){
+            this->value = decoded;
+            this->timestamp = now;
+            this->valid = true;
+            this->phase = PHASE_IDLE;
+          }
+          else this->fail();
+        }
+        else if(status == TwiMaster::FAILED) this->fail();
+        break;
+      }
+    }
+  }
+  /**
+  * @returns bool Whether a measurement is requested or running.
+  */
+  bool is_busy() const {
+    return this->requested || this->phase != PHASE_IDLE;
+  }
+  /**
+  * @returns bool Whether the last measurement succeeded, false before the first one and after any bus or decoding error.
+  */
+  bool has_value() const {
+    return this->valid;
+  }
+  /**
+  * @returns unsigned int The reading of the last successful measurement, in the unit of the Device.
+  */
+  unsigned int get_value() const {
+    return this->value;
+  }
+  /**
+  * @returns uint32_t millis() timestamp of the last successful measurement.
+  */
+  uint32_t get_timestamp() const {
+    return this->timestamp;
+  }
+  /**
+  * @returns unsigned int The number of failed measurements since boot.
+  */
+  unsigned int get_errors() const {
+    return this->errors;
+  }
+  static SensorStateLevel classify(unsigned int value, SensorStateLevel current) {
+    return Device::classify(value, current);
+  }
+  /**
+  * @brief Prints the sensors metrics of the given reading.
+  */
+  void SerialPrint(unsigned int reading, SensorStateLevel state) const {
+    Serial.print(Device::name());
+    Serial.print('\n');
+    FlashStrings::print_field(F("Sensor value: "), reading);
+    FlashStrings::print_field(F("State: "), state_to_str(state));
+  }
+};
+
+/**
+* @brief Atlas Scientific EZO-pH circuit in I2C mode.
+* A single reading ("R") takes 900ms, the response is a status byte followed by the PH as a zero terminated ASCII string, e.g. "7.012".
+* Readings are decoded into 1/100 PH steps and classified against the PHThresholds.
+*/
+struct EzoPhDevice{
+  static constexpr uint8_t ADDRESS = 0x63;
+  // 900ms per datasheet, plus margin.
+  static constexpr unsigned int CONVERSION_MS = 1000;
+  static constexpr unsigned char RESPONSE_SIZE = 8;
+  // Hysteresis of 0.07 PH, the analog PH sensor's 5 raw counts.
+  static constexpr unsigned int HYSTERESIS = 7;
+  static constexpr unsigned char CONFIRM_SAMPLES = PHThresholds::CONFIRM_SAMPLES;
+
+  // Status byte of a response.
+  static constexpr uint8_t RESPONSE_SUCCESS = 1;
+
+  static FlashString name() { return F("PH (EZO)"); }
+
+  static unsigned char command(uint8_t* out) {
+    out[0] = 'R';
+    return 1;
+  }
+  /**
+  * @param value Receives the PH in 1/100 steps, e.g. 701 for "7.012".
+  */
+  static bool decode(const uint8_t* response, unsigned int& value) {
+    if(response[0] != RESPONSE_SUCCESS) return false;
+    unsigned int whole = 0;
+    unsigned int hundredths = 0;
+    unsigned char decimals = 0;
+    bool digits = false;
+    bool fraction = false;
+    for(unsigned char i = 1; i < RESPONSE_SIZE && response[i] != 0; i++){
+      uint8_t c = response[i];
+      if(c == '.' && !fraction){
+        fraction = true;
+      }
+      else if(c >= '0' && c <= '9'){
+        digits = true;
+        if(!fraction) whole = whole * 10 + (c - '0');
+        else if(decimals < 2){
+          hundredths = hundredths * 10 + (c - '0');
+          decimals++;
+        }
+      }
+      else return false;
+    }
+    if(!digits || whole > 14) return false;
+    if(decimals == 1) hundredths *= 10;
+    value = whole * 100 + hundredths;
+    return true;
+  }
+  static SensorStateLevel classify(unsigned int value, SensorStateLevel current);
+};
+
+// The PHThresholds in 1/100 PH steps, rounded, 5.8f * 100 is slightly below 580.
+constexpr StateBand PH_HUNDREDTHS_BANDS[] PROGMEM = {
+  { static_cast<unsigned int>(PHThresholds::PH_TOO_LOW * 100.0f + 0.5f),     SensorStateLevel::TOO_LOW },
+  { static_cast<unsigned int>(PHThresholds::PH_DANGER_LOW * 100.0f + 0.5f),  SensorStateLevel::DANGER_LOW },
+  { static_cast<unsigned int>(PHThresholds::PH_OK * 100.0f + 0.5f),          SensorStateLevel::OK },
+  { static_cast<unsigned int>(PHThresholds::PH_DANGER_HIGH * 100.0f + 0.5f), SensorStateLevel::DANGER_HIGH },
+  { static_cast<unsigned int>(PHThresholds::PH_TOO_HIGH * 100.0f + 0.5f),    SensorStateLevel::TOO_HIGH }
+};
+static_assert(StateBands::is_sorted(PH_HUNDREDTHS_BANDS), "PH thresholds have to be ascending.");
+
+inline SensorStateLevel EzoPhDevice::classify(unsigned int value, SensorStateLevel current) {
+  return StateBands::classify(PH_HUNDREDTHS_BANDS, value, current, HYSTERESIS);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include "hal.h"
+#include "config.h"
+#include "flash_strings.h"
+
+/**
+* @brief Code paths measured by a ScopeProbe, one LatencyHistogram each.
+*/
+enum Probe{
+  // Active part of a loop() pass, everything but the sleep.
+  PROBE_LOOP = 0,
+  // PowerManager::sleep(), the time spent waiting for the next task.
+  PROBE_WAIT = 1,
+  // ActionDecider::Acquire(), ZoneController::Scan() with MULTI_ZONE.
+  PROBE_ACQUIRE = 2,
+  PROBE_SAMPLE = 3,
+  PROBE_DECIDE = 4,
+  // ActionDecider::PrintAll() or the telemetry record, the zone report with MULTI_ZONE.
+  PROBE_PRINT = 5,
+  PROBE_WATERING = 6,
+  // How late the scheduler runs a task after its deadline, at the ms resolution of millis().
+  PROBE_LATENESS = 7,
+  PROBE_COUNT = 8
+};
+
+/**
+* @brief Log bucketed histogram of durations in us, bucket i counts durations below 32us << i, the last bucket everything above.
+* A saturated bucket halves every bucket of the histogram, from then on older durations weigh less than recent ones, scale counts the halvings.
+*/
+struct LatencyHistogram{
+  static constexpr unsigned char BUCKET_COUNT = 10;
+  static constexpr unsigned char FIRST_BUCKET_BITS = 5;
+
+  unsigned int buckets[BUCKET_COUNT];
+  // Exact number of recorded durations, independent of the halvings.
+  unsigned long total;
+  unsigned long max_us;
+  unsigned char scale;
+
+  static unsigned char bucket_of(unsigned long us) {
+    unsigned char bucket = 0;
+    us >>= FIRST_BUCKET_BITS;
+    while(us != 0 && bucket < BUCKET_COUNT - 1){
+      us >>= 1;
+      bucket++;
+    }
+    return bucket;
+  }
+  /**
+  * @returns unsigned long Upper bound of the bucket in us, exclusive, 0 for the open ended last bucket.
+  */
+  static unsigned long bucket_limit(unsigned char bucket) {
+    return bucket < BUCKET_COUNT - 1 ? (1UL << FIRST_BUCKET_BITS) << bucket : 0;
+  }
+  void record(unsigned long us) {
+    unsigned char bucket = bucket_of(us);
+    if(buckets[bucket] == 0xFFFF){
+      for(unsigned char i = 0; i < BUCKET_COUNT; i++) buckets[i] >>= 1;
+      scale++;
+    }
+    buckets[bucket]++;
+    total++;
+    if(us > max_us) max_us = us;
+  }
+  void reset() {
+    for(unsigned char i = 0; i < BUCKET_COUNT; i++) buckets[i] = 0;
+    total = 0;
+    max_us = 0;
+    scale = 0;
+  }
+};
+
+/**
+* @brief Latency histograms of the main code paths, PROBE_COUNT * 29 bytes of SRAM, printed on request via dump().
+* With INSTRUMENTATION disabled every call compiles to nothing, and no SRAM is used.
+*/
+class Instrumentation{
+#if INSTRUMENTATION
+  static LatencyHistogram histograms[PROBE_COUNT];
+  static uint32_t since_ms;
+
+  static FlashString probe_name(Probe probe) {
+    switch(probe){
+      case PROBE_LOOP: return F("loop");
+      case PROBE_WAIT: return F("wait");
+      case PROBE_ACQUIRE: return F("acquire");
+      case PROBE_SAMPLE: return F("sample");
+      case PROBE_DECIDE: return F("decide");
+      case PROBE_PRINT: return F("print");
+      case PROBE_WATERING: return F("watering");
+      default: return F("lateness");
+    }
+  }
+#endif
+public:
+  static void record(Probe probe, unsigned long us) {
+#if INSTRUMENTATION
+    histograms[probe].record(us);
+#else
+    (void)probe;
+    (void)us;
+#endif
+  }
+  static void reset() {
+#if INSTRUMENTATION
+    for(unsigned char i = 0; i < PROBE_COUNT; i++) histograms[i].reset();
+    since_ms = millis();
+#endif
+  }
+  /**
+  * @brief Prints every histogram as CSV, one row per probe:
+  *   probe,count,max_us,scale,<32,<64,...,<8192,>=8192
+  * The bucket counts of a row were halved scale times, count is exact.
+  */
+  static void dump() {
+#if INSTRUMENTATION
+    FlashStrings::print_field(F("# latency since ms: "), since_ms);
+    Serial.print(F("probe,count,max_us,scale"));
+    for(unsigned char b = 0; b < LatencyHistogram::BUCKET_COUNT; b++){
+      unsigned long limit = LatencyHistogram::bucket_limit(b);
+      Serial.print(limit ? F(",<") : F(",>="));
+      Serial.print(limit ? limit : LatencyHistogram::bucket_limit(b - 1));
+    }
+    Serial.print('\n');
+    for(unsigned char i = 0; i < PROBE_COUNT; i++){
+      const LatencyHistogram& histogram = histograms[i];
+      Serial.print(probe_name((Probe)i));
+      Serial.print(',');
+      Serial.print(histogram.total);
+      Serial.print(',');
+      Serial.print(histogram.max_us);
+      Serial.print(',');
+      Serial.print(histogram.scale);
+      for(unsigned char b = 0; b < LatencyHistogram::BUCKET_COUNT; b++){
+        Serial.print(',');
+        Serial.print(histogram.buckets[b]);
+      }
+      Serial.print('\n');
+    }
+#endif
+  }
+};
+
+#if INSTRUMENTATION
+LatencyHistogram Instrumentation::histograms[PROBE_COUNT] = {};
+uint32_t Instrumentation::since_ms = 0;
+#endif
+
+/**
+* @brief Records the time from its construction to its destruction, or to stop(), into the histogram of the probe.
+* Empty with INSTRUMENTATION disabled, the compiler removes it completely.
+*/
+class ScopeProbe{
+#if INSTRUMENTATION
+  Probe probe;
+  uint32_t start;
+  bool running;
+#endif
+public:
+  explicit ScopeProbe(Probe id)
+#if INSTRUMENTATION
+    : probe(id), start(micros()), running(true) {}
+#else
+  {
+    (void)id;
+  }
+#endif
+  /**
+  * @brief Records right away, e.g. before a sleep at the end of the scope.
+  */
+  void stop() {
+#if INSTRUMENTATION
+    if(!running) return;
+    Instrumentation::record(probe, micros() - start);
+    running = false;
+#endif
+  }
+  /**
+  * @brief Adds time micros() did not count, e.g. a power-down phase, during which Timer0 stops, see PowerManager::sleep().
+  */
+  void add_ms(unsigned long ms) {
+#if INSTRUMENTATION
+    start -= ms * 1000UL;
+#else
+    (void)ms;
+#endif
+  }
+  ~ScopeProbe() {
+    stop();
+  }
+};
+
+#endif
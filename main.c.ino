@@ -1,40 +1,786 @@
 #include "action_decider.h"
+#include "scheduler.h"
+#include "power_manager.h"
+#include "telemetry.h"
+#include "dosing_engine.h"
+#include "overflow_guard.h"
+#include "adaptive_interval.h"
+#include "zone_controller.h"
+#include "benchmark.h"
+#include "instrumentation.h"
+#include "eeprom_log.h"
+#include "warm_boot.h"
+#include "calibration.h"
+#include "rtos_tasks.h"
 
-// Initiate the setup of all sensors inside ActionDecider class.
-ActionDecider ad;
+// Shorter delays for demonstration purposes, change to real-world values for real-workd use.
+// unsigned long, since the real-world values exceed the 16 bit int range of AVR boards.
+const unsigned long pump_on_time = 1000UL * 10; // 1000UL * 30;
+const unsigned long after_water_delay = 1000UL * 10;// 1000UL * 60 * 10;
+const unsigned long pump_off_delay = 1000UL * 5; // 1000UL * 60;
+// Longest delay between decisions with ADAPTIVE_SAMPLING, pump_off_delay is the shortest one.
+const unsigned long pump_off_delay_max = 1000UL * 60; // 1000UL * 60 * 30;
+// Period of the bursts feeding the sensors median filters.
+const unsigned long acquire_interval = 100;
+// Sample period while the pump runs, for the closed-loop watering.
+const unsigned long watering_monitor_interval = 50;
+
+/**
+* @brief Single byte commands on the serial line, read without blocking. Call from loop().
+*   l: prints the latency histograms, L: resets them, see Instrumentation.
+*   d: streams the EEPROM log out, see EepromLog::dump().
+*   W, D, E, F, S, R, c: the guided calibration, see calibration_command().
+* @note The replies are text, except the log dump, in TELEMETRY_BINARY mode tools/telemetry_decode.py skips them as invalid frames.
+*/
+#if ONLINE_CALIBRATION
+void calibration_command(int command);
+#endif
+
+void poll_commands() {
+  while(Serial.available() > 0){
+    int command = Serial.read();
+    switch(command){
+#if INSTRUMENTATION
+      case 'l': Instrumentation::dump(); break;
+      case 'L': Instrumentation::reset(); break;
+#endif
+#if EEPROM_LOG
+      case 'd': EepromLog::dump(); break;
+#endif
+#if ONLINE_CALIBRATION
+      case 'W': case 'D': case 'E': case 'F': case 'S': case 'R': case 'c': calibration_command(command); break;
+#endif
+      default: break;
+    }
+  }
+}
+
+/**
+* @brief Prints a status line in text mode, binary telemetry keeps the line free of anything but frames.
+*/
+void log_message(FlashString message) {
+#if TELEMETRY_MODE == TELEMETRY_TEXT
+  Serial.println(message);
+#else
+  (void)message;
+#endif
+}
 
+/**
+* @brief Waits up to SERIAL_HOST_WAIT_MS for a host to open the serial port, so it sees the first lines.
+* Only boards with native USB can tell, and only their output is lost without a host, a UART sends into the void either way.
+* @param warm Skips the wait, e.g. after a watchdog reset, the time to recover counts more than the first lines.
+*/
+void wait_for_host(bool warm) {
+#if defined(USBCON) || defined(ARDUINO_ARCH_RP2040) || (defined(ARDUINO_USB_CDC_ON_BOOT) && ARDUINO_USB_CDC_ON_BOOT)
+  if(warm) return;
+  uint32_t start = millis();
+  while(!Serial && millis() - start < SERIAL_HOST_WAIT_MS) {}
+#else
+  (void)warm;
+#endif
+}
+
+#if BENCHMARK
+
+// Prints the benchmark table once, see benchmark.h.
 void setup() {
-  // Establish Serial communication.
-  Serial.begin(9600);
-  delay(500);
+  Serial.begin(SERIAL_BAUD);
+  BenchmarkSuite::run();
+}
+
+void loop() {
+}
+
+#elif MULTI_ZONE
+
+// Sensors of every zone behind one mux, see ZoneController.
+typedef AnalogMux<MUX_COMMON_PIN, MUX_S0_PIN, MUX_S1_PIN, MUX_S2_PIN, MUX_S3_PIN> ZoneMux;
+ZoneController<ZONE_COUNT, ZoneMux, ZONE_FIRST_PUMP_PIN, MAX_CONCURRENT_PUMPS> zones(pump_on_time, after_water_delay, pump_off_delay);
+
+Scheduler<2> scheduler;
+// One mux channel per scan call, a full scan of every zone takes 2 * ZONE_COUNT calls.
+const unsigned long scan_interval = 10;
+const unsigned long report_interval = 1000UL * 5;
+
+void scan() {
+  ScopeProbe probe(PROBE_ACQUIRE);
+  zones.Scan();
+}
+
+void report() {
+#if TELEMETRY_MODE == TELEMETRY_TEXT
+  ScopeProbe probe(PROBE_PRINT);
+  zones.PrintAll();
+#endif
+}
+
+void setup() {
+  Serial.begin(SERIAL_BAUD);
+  zones.Begin();
+  scheduler.add_periodic(scan, scan_interval);
+  scheduler.add_periodic(report, report_interval);
+}
+
+void loop() {
+  ScopeProbe active(PROBE_LOOP);
+  poll_commands();
+  scheduler.run();
+  active.stop();
+#if LOW_POWER_SLEEP
+  ScopeProbe wait(PROBE_WAIT);
+  // The scan keeps the ADC busy all the time, idle mode only.
+  PowerManager::sleep(scheduler.time_until_next(), false);
+#endif
+}
+
+#elif RTOS_TASKS
+
+// Three tasks instead of loop(), see rtos_tasks.h. They share no state, only the frames and commands passed through their RtosQueues.
+// The safety task owns the sensors and the pump, the acquisition, the dose, the closed-loop watering and its overflow shutoff, alone on RTOS_SAFETY_CORE.
+// The decision task and the telemetry task, with the network uplink, run on RTOS_DECISION_CORE, neither of them can delay a pump shutoff.
+
+// Owned by the safety task.
+SingleZoneDecider ad;
+
+/**
+* @brief A sample of the safety task, handed to the decision task, and with the decision on to the telemetry task.
+*/
+struct FrameMessage{
+  SensorFrame frame;
+  // RulesFallback bits at the time of the sample, see ActionDecider::GetFallback().
+  unsigned char fallback;
+  // The decision, set by the decision task.
+  bool pump_on;
+  // The first sample after a dose.
+  bool watered;
+};
+
+enum ControlCommand : unsigned char{
+  // Starts a dose.
+  CONTROL_WATER = 0,
+  // Arms the next sample in delay_ms.
+  CONTROL_SAMPLE_IN = 1
+};
+
+/**
+* @brief The answer of the decision task to a FrameMessage.
+*/
+struct ControlMessage{
+  unsigned char command;
+  // Timestamp of the frame decided on.
+  uint32_t frame_timestamp;
+  unsigned long delay_ms;
+};
+
+/**
+* @brief What the safety task did, logged by the telemetry task.
+*/
+enum SafetyEvent : unsigned char{
+  SAFETY_PUMP_ON = 0,
+  SAFETY_TARGET_REACHED = 1,
+  SAFETY_OVERFLOW = 2,
+  SAFETY_SENSOR_INVALID = 3,
+  SAFETY_PUMP_OFF = 4,
+  // A pump command arrived after RTOS_COMMAND_TIMEOUT_MS, the sample is repeated instead.
+  SAFETY_STALE_COMMAND = 5,
+  // No answer to a sample within pump_off_delay_max, the safety task samples again on its own.
+  SAFETY_DECISION_TIMEOUT = 6
+};
+
+// Safety task to decision task.
+RtosQueue<FrameMessage, 4> frames;
+// Decision task to safety task.
+RtosQueue<ControlMessage, 4> controls;
+// Decision task to telemetry task.
+RtosQueue<FrameMessage, 8> reports;
+// Safety task to telemetry task.
+RtosQueue<uint8_t, 16> events;
+
+// The safety task preempts anything else on its core, the telemetry task runs below the decisions.
+const UBaseType_t safety_priority = configMAX_PRIORITIES - 2;
+const UBaseType_t decision_priority = 3;
+const UBaseType_t telemetry_priority = 2;
+// Longest wait of the telemetry task, between its polls of the serial commands.
+const unsigned long telemetry_poll_interval = 10;
+
+// Acquisition, sampling and the closed-loop watering monitor of the safety task.
+typedef Scheduler<3> SafetyScheduler;
+SafetyScheduler scheduler;
+SafetyScheduler::TaskId acquire_task;
+SafetyScheduler::TaskId sample_task;
+SafetyScheduler::TaskId watering_task;
+// Whether the last sample waits for its ControlMessage.
+bool awaiting_control = false;
+// Whether a dose ended since the last sample.
+bool watered = false;
+
+#if TELEMETRY_MODE == TELEMETRY_BINARY
+Telemetry telemetry;
+#endif
+
+#if ADAPTIVE_SAMPLING
+// Soil moisture trend of the decision task, backs the decisions off while the soil is far from the next threshold.
+AdaptiveInterval sampling(pump_off_delay, pump_off_delay_max);
+#endif
+
+/**
+* @brief Hands a decided frame to a network uplink, e.g. an MQTT publish over Wi-Fi. Runs in the telemetry task, a slow upload only holds up the reports.
+* Does nothing by default, a definition in another file of the sketch replaces it.
+*/
+void __attribute__((weak)) uplink_frame(const SensorFrame& frame, bool pump_on) {
+  (void)frame;
+  (void)pump_on;
+}
+
+/**
+* @brief Arms the sample task, and the acquisition bursts filling the median filters right before it, as in the single zone flow.
+*/
+void schedule_sample(unsigned long delay) {
+  uint32_t now = millis();
+  unsigned long lead = ad.PlanAcquisition(now + delay, acquire_interval);
+  if(delay < lead){
+    delay = lead;
+    ad.PlanAcquisition(now + delay, acquire_interval);
+  }
+  scheduler.schedule_in(acquire_task, delay - lead);
+  scheduler.schedule_in(sample_task, delay);
+}
+
+void acquire() {
+  ad.Acquire();
+}
+
+/**
+* @brief Takes a sample and hands it to the decision task, the next one is armed by its answer, see control().
+*/
+void sample() {
+  ad.Sample();
+  scheduler.cancel(acquire_task);
+  FrameMessage message;
+  message.frame = ad.GetFrame();
+  message.fallback = ad.GetFallback();
+  message.pump_on = false;
+  message.watered = watered;
+  watered = false;
+  awaiting_control = true;
+  frames.push(message);
+}
+
+/**
+* @brief Closed-loop watering, stops the dose early once ActionDecider::CheckWatering() says so, without waiting for the other core.
+*/
+void watering_monitor() {
+  if(!DosingEngine::is_running()) return;
+  ad.Sample();
+  SingleZoneDecider::WateringCheck check = ad.CheckWatering();
+  if(check == SingleZoneDecider::WATERING_CONTINUE) return;
+
+  DosingEngine::abort();
+  if(check == SingleZoneDecider::WATERING_TARGET_REACHED) events.push(SAFETY_TARGET_REACHED);
+  else if(check == SingleZoneDecider::WATERING_OVERFLOW) events.push(SAFETY_OVERFLOW);
+  else events.push(SAFETY_SENSOR_INVALID);
+}
+
+/**
+* @brief Carries out the answer of the decision task to the last sample. Answers to an earlier sample, e.g. after a decision timeout, are dropped.
+* A pump command older than RTOS_COMMAND_TIMEOUT_MS is not carried out either, the sample is repeated instead.
+*/
+void control(const ControlMessage& message) {
+  if(!awaiting_control || message.frame_timestamp != ad.GetFrame().timestamp) return;
+  awaiting_control = false;
+  if(message.command != CONTROL_WATER){
+    ad.PowerDownSensors();
+    schedule_sample(message.delay_ms);
+    return;
+  }
+  if(millis() - message.frame_timestamp >= RTOS_COMMAND_TIMEOUT_MS){
+    events.push(SAFETY_STALE_COMMAND);
+    schedule_sample(0);
+    return;
+  }
+  ad.TurnOnPump();
+  ad.BeginWatering();
+#if FLOW_METER_ENABLED
+  DosingEngine::start_pulses(FLOW_METER_DOSE_PULSES, pump_on_time);
+#else
+  DosingEngine::start_ms(pump_on_time);
+#endif
+#if CLOSED_LOOP_WATERING
+  scheduler.schedule_in(watering_task, watering_monitor_interval);
+#endif
+  events.push(SAFETY_PUMP_ON);
+}
+
+/**
+* @brief Runs once the DosingEngine finished a dose, the pump is already off by then.
+*/
+void pump_off() {
+  scheduler.cancel(watering_task);
+  ad.TurnOffPump();
+  ad.PowerDownSensors();
+  events.push(SAFETY_PUMP_OFF);
+  watered = true;
+  schedule_sample(after_water_delay);
+}
+
+void safety_task(void*) {
+  for(;;){
+    DosingEngine::update();
+    if(DosingEngine::poll_finished() != DosingEngine::IDLE) pump_off();
+    ControlMessage message;
+    while(controls.pop(message)) control(message);
+    // The decision task stalled, e.g. on a full telemetry queue, sensing goes on regardless.
+    if(awaiting_control && millis() - ad.GetFrame().timestamp >= pump_off_delay_max){
+      awaiting_control = false;
+      events.push(SAFETY_DECISION_TIMEOUT);
+      ad.PowerDownSensors();
+      schedule_sample(pump_off_delay);
+    }
+    scheduler.run();
+    // DosingEngine::update() counts the dose down in 1 ms steps, a ControlMessage wakes the task early.
+    unsigned long wait = DosingEngine::is_running() ? 1 : scheduler.time_until_next();
+    RtosTask::wait_ms(wait < acquire_interval ? wait : acquire_interval);
+  }
+}
+
+/**
+* @brief Decides on a sample of the safety task, the same pump toggling rules as the single zone flow, and tells the safety task when to sample next.
+*/
+void decide(FrameMessage& message) {
+  ControlMessage control;
+  control.frame_timestamp = message.frame.timestamp;
+  control.delay_ms = 0;
+#if ADAPTIVE_SAMPLING
+  // Watering changed the soil moisture, the trend starts over.
+  if(message.watered) sampling.reset();
+  sampling.update(message.frame.timestamp, message.frame.raw[SLOT_SOIL_MOISTURE]);
+#endif
+  message.pump_on = SingleZoneDecider::DecideDose(message.frame, message.fallback);
+  if(message.pump_on) control.command = CONTROL_WATER;
+  else{
+    control.command = CONTROL_SAMPLE_IN;
+#if ADAPTIVE_SAMPLING
+    control.delay_ms = sampling.next_interval(SoilMoistureThresholds::bands(), message.frame.raw[SLOT_SOIL_MOISTURE]);
+#else
+    control.delay_ms = pump_off_delay;
+#endif
+  }
+  controls.push(control);
+  reports.push(message);
+}
+
+void decision_task(void*) {
+  for(;;){
+    FrameMessage message;
+    while(frames.pop(message)) decide(message);
+    RtosTask::wait_ms(pump_off_delay_max);
+  }
+}
+
+void log_event(uint8_t event) {
+  switch(event){
+    case SAFETY_PUMP_ON: log_message(F("Pump turning on")); break;
+    case SAFETY_TARGET_REACHED: log_message(F("Target moisture reached")); break;
+    case SAFETY_OVERFLOW: log_message(F("Overflow detected")); break;
+    case SAFETY_SENSOR_INVALID: log_message(F("Invalid sensor state")); break;
+    case SAFETY_PUMP_OFF: log_message(F("Pump turning off")); break;
+    case SAFETY_STALE_COMMAND: log_message(F("Pump command too late, sampling again")); break;
+    default: log_message(F("No decision, sampling again")); break;
+  }
+}
+
+/**
+* @returns unsigned int The messages lost in a full queue between the tasks so far.
+*/
+unsigned int queue_dropped() {
+  return frames.get_dropped() + controls.get_dropped() + reports.get_dropped() + events.get_dropped();
+}
+
+/**
+* @brief Prints a decided frame, from the frame alone, the sensors and their health checks belong to the safety task.
+*/
+void print_report(const FrameMessage& report) {
+#if TELEMETRY_MODE == TELEMETRY_BINARY
+  telemetry.send(report.frame, report.pump_on, queue_dropped());
+#else
+  // In SensorSlot order.
+  FlashString names[SENSOR_SLOT_COUNT] = { SoilMoistureThresholds::name(), PHThresholds::name(), WaterLevelThresholds::name(), WaterDetectionThresholds::name() };
+  log_message(F("Ready for next decision\n\n\n\n\n"));
+  for(unsigned char i = 0; i < SENSOR_SLOT_COUNT; i++){
+    Serial.print(names[i]);
+    Serial.print('\n');
+    FlashStrings::print_field(F("Raw sensor value: "), report.frame.raw[i]);
+    FlashStrings::print_field(F("State: "), FlashStrings::state_name(report.frame.state[i]));
+  }
+  if(report.fallback & RULES_IGNORE_PH) Serial.print(F("\nRules: without the PH check"));
+  if(report.fallback & RULES_CONSERVATIVE) Serial.print(F("\nRules: without the bone dry special case"));
+  unsigned int dropped = queue_dropped();
+  if(dropped != 0){
+    Serial.print(F("\nDropped messages: "));
+    Serial.print(dropped);
+  }
+  Serial.print(F("\n\nPump is: "));
+  Serial.print(report.pump_on ? F(" On") : F("Off"));
+  Serial.print(F("\n\n\n"));
+#endif
+}
+
+void telemetry_task(void*) {
+  for(;;){
+    FrameMessage report;
+    while(reports.pop(report)){
+      print_report(report);
+      uplink_frame(report.frame, report.pump_on);
+    }
+    uint8_t event;
+    while(events.pop(event)) log_event(event);
+    poll_commands();
+#if TELEMETRY_MODE == TELEMETRY_BINARY
+    telemetry.pump();
+    RtosTask::wait_ms(telemetry.is_idle() ? telemetry_poll_interval : 1);
+#else
+    RtosTask::wait_ms(telemetry_poll_interval);
+#endif
+  }
+}
+
+void setup() {
+  Serial.begin(SERIAL_BAUD);
+  wait_for_host(false);
+  ad.Begin();
+  acquire_task = scheduler.add_periodic(acquire, acquire_interval);
+  sample_task = scheduler.add_oneshot(sample);
+  watering_task = scheduler.add_periodic(watering_monitor, watering_monitor_interval);
+  scheduler.cancel(watering_task);
+  schedule_sample(0);
+
+  // The consumers first, so every queue wakes its consumer from the first push on. The safety task waits at most acquire_interval for its first ControlMessage.
+  TaskHandle_t decision = RtosTask::spawn(decision_task, "decision", RTOS_STACK_BYTES, decision_priority, RTOS_DECISION_CORE);
+  TaskHandle_t reporter = RtosTask::spawn(telemetry_task, "telemetry", RTOS_STACK_BYTES, telemetry_priority, RTOS_DECISION_CORE);
+  frames.set_consumer(decision);
+  reports.set_consumer(reporter);
+  events.set_consumer(reporter);
+  controls.set_consumer(RtosTask::spawn(safety_task, "safety", RTOS_STACK_BYTES, safety_priority, RTOS_SAFETY_CORE));
+}
+
+// Every task runs on its own, loop() only yields.
+void loop() {
+  RtosTask::sleep_ms(1000);
+}
+
+#else
+
+
+// Initiate the setup of all sensors inside ActionDecider class.
+SingleZoneDecider ad;
+
+#if TELEMETRY_MODE == TELEMETRY_BINARY
+Telemetry telemetry;
+#endif
+
+// Acquisition, sampling, decision, printing and the closed-loop watering monitor each run as their own task, so loop() never blocks.
+// The pump run time is enforced by the DosingEngine's hardware timer, independent of the scheduler.
+// The calibration captures run as a task of their own with ONLINE_CALIBRATION.
+typedef Scheduler<5 + ONLINE_CALIBRATION> TaskScheduler;
+TaskScheduler scheduler;
+TaskScheduler::TaskId acquire_task;
+TaskScheduler::TaskId sample_task;
+TaskScheduler::TaskId decide_task;
+TaskScheduler::TaskId print_task;
+TaskScheduler::TaskId watering_task;
+#if ONLINE_CALIBRATION
+TaskScheduler::TaskId calibrate_task;
+#endif
+
+#if ADAPTIVE_SAMPLING
+// Soil moisture trend, backs the decisions off while the soil is far from the next threshold.
+AdaptiveInterval sampling(pump_off_delay, pump_off_delay_max);
+#endif
+
+/**
+* @brief Arms the sample task, and the acquisition bursts filling the median filters right before it.
+* The bursts start as far ahead as the slowest sensor needs to settle and to fill its median window, see ActionDecider::PlanAcquisition().
+*/
+void schedule_sample(unsigned long delay) {
+  uint32_t now = millis();
+  unsigned long lead = ad.PlanAcquisition(now + delay, acquire_interval);
+  // Delays shorter than the lead, e.g. the first sample after boot, are stretched, so every sensor is settled and its median window full.
+  if(delay < lead){
+    delay = lead;
+    ad.PlanAcquisition(now + delay, acquire_interval);
+  }
+  scheduler.schedule_in(acquire_task, delay - lead);
+  scheduler.schedule_in(sample_task, delay);
+}
+
+/**
+* @brief Arms the first sample after boot. A reset within a watering cycle resumes its after-watering delay, the dose of a pump running at the reset counts as given.
+* After a warm reset the debounced sensor states are restored as well, see WarmBoot::is_warm_reset().
+*/
+void schedule_first_sample() {
+  WarmBoot::State state;
+  if(WarmBoot::load(state)){
+    if(WarmBoot::is_warm_reset()){
+      SensorStateLevel states[SENSOR_SLOT_COUNT];
+      for(unsigned char i = 0; i < SENSOR_SLOT_COUNT; i++) states[i] = (SensorStateLevel)state.states[i];
+      ad.RestoreStates(states);
+    }
+    if(state.phase != WarmBoot::PHASE_IDLE){
+      log_message(F("Resuming the after-watering delay"));
+      schedule_sample(after_water_delay);
+      return;
+    }
+  }
+  schedule_sample(0);
+}
+
+void acquire() {
+  ScopeProbe probe(PROBE_ACQUIRE);
+  ad.Acquire();
+}
+
+void sample() {
+  ScopeProbe probe(PROBE_SAMPLE);
+  log_message(F("Ready for next decision\n\n\n\n\n"));
+  ad.Sample();
+  scheduler.cancel(acquire_task);
+#if ADAPTIVE_SAMPLING
+  sampling.update(ad.GetFrame().timestamp, ad.GetFrame().raw[SLOT_SOIL_MOISTURE]);
+#endif
+  // Registered after the sample task, therefore the decision runs within the same scheduler pass.
+  scheduler.schedule_in(decide_task, 0);
 }
 
-// Shorter delays for demonstration purposes, change to real-world values for real-workd use.
-const int pump_on_time = 1000 * 10; // 1000 * 30;
-const int after_water_delay = 1000 * 10;// 1000 * 60 * 10;
-const int pump_off_delay = 1000 * 5; // 1000 * 60;
 /**
 * Pump toggling rules:
 * If the pump was turned on => Keep it running for half minute => Turn it off => Initiate a 10 minute delay to let the newly fed water stabilize inside the pot before the next decision.
 * If the pump was not turned on => Initiate a 1 Minute delay before the next decision.
+* With ADAPTIVE_SAMPLING the delay instead follows the soil moisture trend, from pump_off_delay close to a threshold up to pump_off_delay_max.
 */
-void loop() {
+void decide() {
+  ScopeProbe probe(PROBE_DECIDE);
   bool pump = ad.DecidePump();
+#if EEPROM_LOG
+  EepromLog::log_frame(ad.GetFrame(), pump);
+#endif
   // For Debug/Demonstration purposes.
-  ad.PrintAll();
+  scheduler.schedule_in(print_task, 0);
 
   if(pump){
-    Serial.println("Pump turning on");
-    delay(pump_on_time);
-    Serial.println("Pump turning off");
-    ad.TurnOffPump();
-    Serial.println("Initiating after-watering delay");
-    delay(after_water_delay);
+    log_message(F("Pump turning on"));
+    ad.BeginWatering();
+    // The next decision is scheduled once the dose finished, see pump_off().
+#if FLOW_METER_ENABLED
+    DosingEngine::start_pulses(FLOW_METER_DOSE_PULSES, pump_on_time);
+#else
+    DosingEngine::start_ms(pump_on_time);
+#endif
+#if OVERFLOW_GUARD_ENABLED
+    OverflowGuard::arm();
+#endif
+#if CLOSED_LOOP_WATERING
+    scheduler.schedule_in(watering_task, watering_monitor_interval);
+#endif
+#if EEPROM_LOG
+    EepromLog::log_event(EepromLog::EVENT_PUMP_ON, 0, true);
+#endif
   }
   else{
-    Serial.println("Pump staying off");
-    Serial.println("Initiating pump-off delay");
-    delay(pump_off_delay);
+    log_message(F("Pump staying off"));
+    ad.PowerDownSensors();
+    log_message(F("Initiating pump-off delay"));
+#if ADAPTIVE_SAMPLING
+    schedule_sample(sampling.next_interval(SoilMoistureThresholds::bands(), ad.GetFrame().raw[SLOT_SOIL_MOISTURE]));
+#else
+    schedule_sample(pump_off_delay);
+#endif
   }
-  Serial.println("Ready for next decision\n\n\n\n\n");
+  // After the dose started, the write blocks for a few ms.
+  WarmBoot::save(pump ? WarmBoot::PHASE_WATERING : WarmBoot::PHASE_IDLE, ad.GetFrame());
 }
+
+void print_all() {
+  ScopeProbe probe(PROBE_PRINT);
+#if TELEMETRY_MODE == TELEMETRY_BINARY
+  telemetry.send(ad.GetFrame(), ad.IsPumpOn());
+#else
+  ad.PrintAll();
+#if LOW_POWER_SLEEP
+  PowerManager::SerialPrint();
+#endif
+#endif
+}
+
+/**
+* @brief Closed-loop watering, stops the dose early once ActionDecider::CheckWatering() says so.
+*/
+void watering_monitor() {
+  if(!DosingEngine::is_running()) return;
+  ScopeProbe probe(PROBE_WATERING);
+  ad.Sample();
+  SingleZoneDecider::WateringCheck check = ad.CheckWatering();
+  if(check == SingleZoneDecider::WATERING_CONTINUE) return;
+
+  DosingEngine::abort();
+  if(check == SingleZoneDecider::WATERING_TARGET_REACHED) log_message(F("Target moisture reached"));
+  else if(check == SingleZoneDecider::WATERING_OVERFLOW){
+    log_message(F("Overflow detected"));
+#if EEPROM_LOG
+    EepromLog::log_event(EepromLog::EVENT_OVERFLOW, 0, false);
+#endif
+  }
+  else log_message(F("Invalid sensor state"));
+}
+
+/**
+* @brief Runs once the DosingEngine finished a dose, the pump is already off by then.
+* @param result DosingEngine::COMPLETED, or DosingEngine::ABORTED by the closed loop or the overflow guard.
+*/
+void pump_off(DosingEngine::State result) {
+  scheduler.cancel(watering_task);
+#if EEPROM_LOG
+  unsigned long dosed_s = DosingEngine::get_dosed_ms() / 1000UL;
+  EepromLog::log_event(result == DosingEngine::ABORTED ? EepromLog::EVENT_PUMP_ABORTED : EepromLog::EVENT_PUMP_OFF, dosed_s > 0xFF ? 0xFF : dosed_s, false);
+#else
+  (void)result;
+#endif
+#if OVERFLOW_GUARD_ENABLED
+  OverflowGuard::disarm();
+#endif
+  log_message(F("Pump turning off"));
+  ad.TurnOffPump();
+  WarmBoot::save(WarmBoot::PHASE_SETTLING, ad.GetFrame());
+  ad.PowerDownSensors();
+#if ADAPTIVE_SAMPLING
+  // Watering changed the soil moisture, the trend starts over.
+  sampling.reset();
+#endif
+  log_message(F("Initiating after-watering delay"));
+  schedule_sample(after_water_delay);
+}
+
+#if ONLINE_CALIBRATION
+// Period of the readings of a calibration capture.
+const unsigned long calibration_interval = 100;
+// The captured sensor is powered this long before its first reading, longer than the SETTLE_MS of any sensor.
+const unsigned long calibration_settle = 1000;
+
+/**
+* @brief Starts a calibration capture of the sensor, unless the pump runs. The decisions wait until it finished, the sensor is moved by hand meanwhile.
+*/
+void start_capture(Calibration::Capture capture) {
+  if(ad.IsPumpOn()){
+    Serial.print(F("Pump running, capture refused\n"));
+    return;
+  }
+  Calibration::start(capture);
+  scheduler.cancel(acquire_task);
+  scheduler.cancel(sample_task);
+  scheduler.cancel(decide_task);
+  ad.PowerSensor(Calibration::slot());
+  scheduler.schedule_in(calibrate_task, calibration_settle);
+}
+
+/**
+* @brief One reading of the calibration capture. Once it finished the decisions resume after the after-watering delay, the sensor was just back in the pot.
+*/
+void calibrate() {
+  if(!Calibration::push(ad.ReadRaw(Calibration::slot()))) return;
+  scheduler.cancel(calibrate_task);
+  ad.PowerDownSensors();
+  schedule_sample(after_water_delay);
+}
+
+/**
+* @brief Serial commands of the guided calibration, see Calibration:
+*   W: captures the soil moisture sensor in soaked soil, D: in dry soil,
+*   E: captures the water level sensor in the empty reservoir, F: in the full one,
+*   S: stores the thresholds derived from the captures, R: returns to the compiled-in thresholds, c: prints the thresholds.
+*/
+void calibration_command(int command) {
+  switch(command){
+    case 'W': start_capture(Calibration::CAPTURE_SOIL_WET); break;
+    case 'D': start_capture(Calibration::CAPTURE_SOIL_DRY); break;
+    case 'E': start_capture(Calibration::CAPTURE_RESERVOIR_EMPTY); break;
+    case 'F': start_capture(Calibration::CAPTURE_RESERVOIR_FULL); break;
+    case 'S': Calibration::store(); break;
+    case 'R': Calibration::revert(); break;
+    default: Calibration::print(); break;
+  }
+}
+#endif
+
+void setup() {
+  // Establish Serial communication.
+  Serial.begin(SERIAL_BAUD);
+  wait_for_host(WarmBoot::is_warm_reset());
+  ad.Begin();
+#if OVERFLOW_GUARD_ENABLED
+  OverflowGuard::begin();
+#endif
+#if EEPROM_LOG
+  EepromLog::begin(WarmBoot::reset_flags());
+#endif
+#if LOW_POWER_SLEEP
+  PowerManager::begin();
+#endif
+
+  acquire_task = scheduler.add_periodic(acquire, acquire_interval);
+  sample_task = scheduler.add_oneshot(sample);
+  decide_task = scheduler.add_oneshot(decide);
+  print_task = scheduler.add_oneshot(print_all);
+  watering_task = scheduler.add_periodic(watering_monitor, watering_monitor_interval);
+  scheduler.cancel(watering_task);
+#if ONLINE_CALIBRATION
+  Calibration::begin();
+  calibrate_task = scheduler.add_periodic(calibrate, calibration_interval);
+  scheduler.cancel(calibrate_task);
+#endif
+  schedule_first_sample();
+}
+
+void loop() {
+  ScopeProbe active(PROBE_LOOP);
+  DosingEngine::update();
+#if OVERFLOW_GUARD_ENABLED
+  // The pump is already off by now, the aborted dose ends in pump_off() below.
+  if(OverflowGuard::poll_tripped()){
+    log_message(F("Overflow guard tripped"));
+#if EEPROM_LOG
+    EepromLog::log_event(EepromLog::EVENT_OVERFLOW, 1, false);
+#endif
+  }
+#endif
+  DosingEngine::State dose = DosingEngine::poll_finished();
+  if(dose != DosingEngine::IDLE){
+    pump_off(dose);
+  }
+  poll_commands();
+  scheduler.run();
+#if TELEMETRY_MODE == TELEMETRY_BINARY
+  telemetry.pump();
+  bool telemetry_idle = telemetry.is_idle();
+#else
+  bool telemetry_idle = true;
+#endif
+#if LOW_POWER_SLEEP
+  // Stay in idle mode while the pump runs, so its switch-off is not subject to the watchdog granularity.
+  bool bus_idle = true;
+#if I2C_SENSORS_ENABLED
+  // Power-down stops the TWI clock, which would break a running transaction.
+  bus_idle = TwiMaster::is_idle();
+#endif
+#if EEPROM_LOG
+  // The EEPROM-ready interrupt cannot wake the CPU from power-down.
+  bus_idle = bus_idle && EepromLog::is_idle();
+#endif
+  active.stop();
+  ScopeProbe wait(PROBE_WAIT);
+  wait.add_ms(PowerManager::sleep(scheduler.time_until_next(), !ad.IsPumpOn() && telemetry_idle && bus_idle));
+#else
+  (void)telemetry_idle;
+#endif
+}
+
+#endif
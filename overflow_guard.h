@@ -0,0 +1,103 @@
+#ifndef OVERFLOW_GUARD_H
+#define OVERFLOW_GUARD_H
+
+#include "hal.h"
+#include "config.h"
+
+#if OVERFLOW_GUARD_ENABLED
+
+#include "analog_sensors.h"
+#include "dosing_engine.h"
+#include "spsc_ring.h"
+
+/**
+* @brief Event driven overflow detection via the analog comparator.
+* The comparator compares the water detection signal on AIN1 against the THRESH_OFF reference on AIN0, see OVERFLOW_GUARD_ENABLED.
+* Its interrupt fires on the edge where the signal rises above the reference, switches the pump off from the ISR and queues the event for the main loop.
+* @note The ADC multiplexer could feed A6 into the comparator directly, but only with the ADC disabled, which would stop the AdcAcquisition engine.
+*/
+class OverflowGuard{
+  // millis() timestamps of the trips, the ISR produces, poll_tripped() consumes.
+  static SpscRing<uint32_t, 4> events;
+  // Owned by the main loop, updated as the events are taken.
+  static unsigned int trip_count;
+  static uint32_t trip_ms;
+public:
+  // Reference voltage on AIN0 matching THRESH_OFF, at a 5V supply.
+  static constexpr unsigned int REFERENCE_MV = (unsigned long)WaterDetectionThresholds::THRESH_OFF * 5000UL / 1024UL;
+
+  /**
+  * @brief Configures the comparator, call once from setup(). The interrupt stays off until arm().
+  */
+  static void begin() {
+    // Analog inputs only, the digital input buffers would draw current near the threshold.
+    DIDR1 |= _BV(AIN1D) | _BV(AIN0D);
+    // AIN0 as positive input, the multiplexer stays with the ADC.
+    ADCSRB &= ~_BV(ACME);
+    ACSR = 0;
+  }
+  /**
+  * @brief Enables the interrupt, call right after the pump was turned on.
+  * A signal already above the reference never produces the edge, this matches the bone dry special case of ActionDecider::CheckWatering.
+  */
+  static void arm() {
+    ACSR &= ~_BV(ACIE);
+    // Falling output edge, AIN1 (signal) rises above AIN0 (reference).
+    ACSR = (ACSR & ~_BV(ACIS0)) | _BV(ACIS1);
+    // Clear a flag left by earlier edges, by writing a one.
+    ACSR |= _BV(ACI);
+    ACSR |= _BV(ACIE);
+  }
+  /**
+  * @brief Disables the interrupt, call once the pump is off.
+  */
+  static void disarm() {
+    ACSR &= ~_BV(ACIE);
+  }
+  /**
+  * @brief Reports every overflow exactly once, call from loop().
+  * @returns bool Whether the guard switched the pump off since the last call.
+  */
+  static bool poll_tripped() {
+    uint32_t ms;
+    if(!events.pop(ms)) return false;
+    trip_ms = ms;
+    trip_count++;
+    return true;
+  }
+  /**
+  * @returns unsigned int The number of overflows taken by poll_tripped() since boot.
+  */
+  static unsigned int get_trip_count() {
+    return trip_count;
+  }
+  /**
+  * @returns uint32_t millis() timestamp of the last overflow taken by poll_tripped().
+  */
+  static uint32_t get_trip_ms() {
+    return trip_ms;
+  }
+  /**
+  * @brief Called from the analog comparator ISR only.
+  */
+  static void on_trigger() {
+    // Pin first, the single instruction shutoff, then let the engine record the aborted dose for poll_finished().
+    DosingEngine::Pump::turn_off();
+    DosingEngine::abort();
+    ACSR &= ~_BV(ACIE);
+    // Disarmed until the next dose, so at most one event per dose, the ring cannot overflow while loop() keeps polling.
+    events.push(millis());
+  }
+};
+
+SpscRing<uint32_t, 4> OverflowGuard::events;
+unsigned int OverflowGuard::trip_count = 0;
+uint32_t OverflowGuard::trip_ms = 0;
+
+ISR(ANALOG_COMP_vect) {
+  OverflowGuard::on_trigger();
+}
+
+#endif
+
+#endif
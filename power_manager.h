@@ -0,0 +1,247 @@
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include "hal.h"
+#include "config.h"
+
+#if LOW_POWER_SLEEP
+
+#include <avr/sleep.h>
+#include <avr/power.h>
+#include <avr/wdt.h>
+#include "adc_acquisition.h"
+#include "flash_strings.h"
+
+// Millisecond counter of the Arduino core (wiring.c), advanced by the time spent in power-down, during which Timer0 is stopped.
+extern volatile unsigned long timer0_millis;
+
+/**
+* @brief Puts the MCU to sleep between scheduled tasks.
+* Short waits are spent in idle mode, where Timer0 keeps millis() running and wakes the CPU every ms.
+* Long waits are spent in power-down mode with the ADC, the analog comparator and the brown-out detector switched off, woken by the watchdog timer.
+* The watchdog oscillator is calibrated against millis(), and the calibrated sleep time is added to millis() after waking up,
+* so the scheduler, and with it pump_off_delay and after_water_delay, keep their timing across power-down phases.
+*/
+class PowerManager{
+public:
+  enum Mode{
+    MODE_ACTIVE = 0,
+    MODE_IDLE = 1,
+    MODE_POWER_DOWN = 2,
+    MODE_COUNT = 3
+  };
+private:
+  // Longest watchdog period, 16ms << 9 = 8s.
+  static constexpr unsigned char WDT_MAX_PRESCALER = 9;
+  // Nominal watchdog period of prescaler 0.
+  static constexpr unsigned long WDT_BASE_US = 16000UL;
+  // Re-calibrate the watchdog oscillator after this many power-down phases, it drifts with voltage and temperature.
+  static constexpr unsigned char CALIBRATION_INTERVAL = 64;
+
+  static volatile bool wdt_fired;
+  // Measured duration of the 16ms base period.
+  static unsigned long wdt_base_us;
+  static unsigned char sleeps_since_calibration;
+  // Time spent in each mode since begin(), the active time is derived from the total time.
+  static unsigned long mode_ms[MODE_COUNT];
+  static unsigned long idle_us;
+  static uint32_t start_ms;
+
+  static void wdt_start(unsigned char prescaler) {
+    unsigned char bits = (prescaler & 0x07) | ((prescaler & 0x08) ? _BV(WDP3) : 0);
+    cli();
+    wdt_reset();
+    MCUSR &= ~_BV(WDRF);
+    // Timed sequence, interrupt mode only, the watchdog never resets the MCU.
+    WDTCSR = _BV(WDCE) | _BV(WDE);
+    WDTCSR = _BV(WDIE) | bits;
+    sei();
+  }
+  static void wdt_stop() {
+    cli();
+    wdt_reset();
+    MCUSR &= ~_BV(WDRF);
+    WDTCSR = _BV(WDCE) | _BV(WDE);
+    WDTCSR = 0;
+    sei();
+  }
+  /**
+  * @brief Measures one base period of the watchdog with micros(), while idling.
+  */
+  static void calibrate() {
+    wdt_fired = false;
+    uint32_t start = micros();
+    wdt_start(0);
+    while(!wdt_fired){
+      set_sleep_mode(SLEEP_MODE_IDLE);
+      sleep_mode();
+    }
+    uint32_t measured = micros() - start;
+    wdt_stop();
+    // Reject nonsense readings, the oscillator is specified within +-10% of 16ms, allow some margin.
+    if(measured > WDT_BASE_US / 2 && measured < WDT_BASE_US * 2) wdt_base_us = measured;
+    sleeps_since_calibration = 0;
+  }
+  static unsigned long period_ms(unsigned char prescaler) {
+    return (wdt_base_us << prescaler) / 1000UL;
+  }
+  static void advance_millis(unsigned long ms) {
+    cli();
+    timer0_millis += ms;
+    sei();
+  }
+  /**
+  * @brief Whether the Serial TX buffer still holds bytes to send, which would be lost in power-down.
+  * @note The byte in the shift register is not covered, Serial.flush() waits for it before powering down.
+  */
+  static bool serial_busy() {
+    return UCSR0B & _BV(UDRIE0);
+  }
+  static void print_mode(FlashString label, Mode mode, unsigned long current_ua) {
+    Serial.print(label);
+    Serial.print(time_in_mode(mode));
+    Serial.print(F(" @ "));
+    Serial.print(current_ua);
+    Serial.print(F("uA\n"));
+  }
+  static void sleep_idle() {
+    uint32_t start = micros();
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_mode();
+    idle_us += micros() - start;
+    if(idle_us >= 1000UL){
+      mode_ms[MODE_IDLE] += idle_us / 1000UL;
+      idle_us %= 1000UL;
+    }
+  }
+  static unsigned long sleep_power_down(unsigned char prescaler) {
+#if ADC_ISR_ACQUISITION
+    AdcAcquisition::suspend();
+#else
+    ADCSRA &= ~_BV(ADEN);
+#endif
+    power_adc_disable();
+    // Power-down only happens with the pump off, so an OverflowGuard is disarmed and its interrupt cannot fire on the ACD switch.
+    ACSR |= _BV(ACD);
+
+    wdt_fired = false;
+    wdt_start(prescaler);
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    // Another interrupt, e.g. a pin change, wakes the CPU early. Its ISR runs, and the CPU sleeps on until the watchdog fires,
+    // only a whole period is known to have passed. The flag is tested with interrupts off, sleep_cpu() follows sei() before any ISR.
+    for(;;){
+      cli();
+      if(wdt_fired) break;
+      sleep_enable();
+      sleep_bod_disable();
+      sei();
+      sleep_cpu();
+      sleep_disable();
+    }
+    sei();
+    wdt_stop();
+
+    unsigned long slept = period_ms(prescaler);
+    advance_millis(slept);
+    mode_ms[MODE_POWER_DOWN] += slept;
+
+    ACSR &= ~_BV(ACD);
+    power_adc_enable();
+#if ADC_ISR_ACQUISITION
+    AdcAcquisition::resume();
+#else
+    ADCSRA |= _BV(ADEN);
+#endif
+    return slept;
+  }
+public:
+  /**
+  * @brief Calibrates the watchdog oscillator, call once from setup().
+  */
+  static void begin() {
+    start_ms = millis();
+    calibrate();
+  }
+  /**
+  * @brief Sleeps for at most budget_ms, returns early on any interrupt in idle mode. Call from loop() with the time until the next scheduled task.
+  * @param budget_ms Time in ms until the next task is due.
+  * @param allow_power_down False while something needs the timers, e.g. a running pump, restricts sleeping to idle mode.
+  * @returns unsigned long Time in ms spent in power-down, 0 in idle mode. millis() includes it, micros() does not, Timer0 stops meanwhile.
+  */
+  static unsigned long sleep(unsigned long budget_ms, bool allow_power_down) {
+    if(budget_ms == 0) return 0;
+    if(!allow_power_down || budget_ms < POWER_DOWN_MIN_MS || serial_busy()){
+      sleep_idle();
+      return 0;
+    }
+    if(sleeps_since_calibration >= CALIBRATION_INTERVAL) calibrate();
+
+    // Largest watchdog period not overshooting the budget, the remainder is spent in further sleeps.
+    unsigned char prescaler = 0;
+    while(prescaler < WDT_MAX_PRESCALER && period_ms(prescaler + 1) <= budget_ms) prescaler++;
+    if(period_ms(prescaler) > budget_ms){
+      sleep_idle();
+      return 0;
+    }
+    Serial.flush();
+    unsigned long slept = sleep_power_down(prescaler);
+    sleeps_since_calibration++;
+    return slept;
+  }
+  /**
+  * @brief Called from the watchdog ISR only.
+  */
+  static void on_watchdog() {
+    wdt_fired = true;
+  }
+  /**
+  * @returns unsigned long Time in ms spent in the given mode since begin().
+  */
+  static unsigned long time_in_mode(Mode mode) {
+    if(mode != MODE_ACTIVE) return mode_ms[mode];
+    uint32_t total = millis() - start_ms;
+    unsigned long asleep = mode_ms[MODE_IDLE] + mode_ms[MODE_POWER_DOWN];
+    return total > asleep ? total - asleep : 0;
+  }
+  /**
+  * @brief Time weighted average of the per-mode currents POWER_ACTIVE_UA, POWER_IDLE_UA and POWER_DOWN_UA.
+  * @returns unsigned long Estimated average current in uA since begin(), only as accurate as these constants, nothing is measured.
+  */
+  static unsigned long average_current_ua() {
+    unsigned long active = time_in_mode(MODE_ACTIVE);
+    unsigned long idle = time_in_mode(MODE_IDLE);
+    unsigned long down = time_in_mode(MODE_POWER_DOWN);
+    unsigned long total = active + idle + down;
+    if(total == 0) return POWER_ACTIVE_UA;
+    // 64 bit, the products of ms and uA overflow 32 bit after a few minutes. Only used for reporting, speed does not matter.
+    unsigned long long weighted = (unsigned long long)active * POWER_ACTIVE_UA
+      + (unsigned long long)idle * POWER_IDLE_UA
+      + (unsigned long long)down * POWER_DOWN_UA;
+    return (unsigned long)(weighted / total);
+  }
+  /**
+  * @brief Prints the time spent in each mode and the resulting estimate of the average current, see average_current_ua().
+  */
+  static void SerialPrint() {
+    Serial.print(F("Power\n"));
+    print_mode(F("Active ms: "), MODE_ACTIVE, POWER_ACTIVE_UA);
+    print_mode(F("Idle ms: "), MODE_IDLE, POWER_IDLE_UA);
+    print_mode(F("Power-down ms: "), MODE_POWER_DOWN, POWER_DOWN_UA);
+    FlashStrings::print_field(F("Est. avg uA: "), average_current_ua());
+  }
+};
+
+volatile bool PowerManager::wdt_fired = false;
+unsigned long PowerManager::wdt_base_us = PowerManager::WDT_BASE_US;
+unsigned char PowerManager::sleeps_since_calibration = 0;
+unsigned long PowerManager::mode_ms[PowerManager::MODE_COUNT] = { 0, 0, 0 };
+unsigned long PowerManager::idle_us = 0;
+uint32_t PowerManager::start_ms = 0;
+
+ISR(WDT_vect) {
+  PowerManager::on_watchdog();
+}
+
+#endif
+
+#endif
@@ -1,29 +1,65 @@
 #ifndef PUMP_DRIVER_H
 #define PUMP_DRIVER_H
 
+#include "fast_pin.h"
+
+/**
+* @brief Drives the pump via a pin bound at compile time.
+* All operations are static and stateless, the pump state is read back from the pin's output latch,
+* so turn_off() is a deterministic, single instruction shutoff which any ISR may call, e.g. on an overflow.
+* @tparam PIN The digital pin switching the pump.
+*/
+template <unsigned char PIN>
 struct PumpDriver{
-private:
-  const unsigned short pin;
-  bool on;
-public:
-  PumpDriver(unsigned short pin) : pin(pin), on(false) {
+  typedef FastPin<PIN> Pin;
+  static constexpr unsigned char PIN_NUMBER = PIN;
+
+  PumpDriver() {
     // Set the pin under given pin number to strictly output mode
-    pinMode(pin, OUTPUT);
-    digitalWrite(this->pin, LOW);
+    Pin::set_low();
+    Pin::set_output();
   };
 
-  void turn_on() {
-    this->on = true;
-    digitalWrite(this->pin, HIGH);
+  static void turn_on() {
+    Pin::set_high();
   }
-  void turn_off() {
-    this->on = false;
-    digitalWrite(this->pin, LOW);
+  static void turn_off() {
+    Pin::set_low();
   }
 
-  bool is_on() const {
-    return this->on;
+  static bool is_on() {
+    return Pin::is_high();
   }
 };
 
+/**
+* @brief Pumps on COUNT consecutive pins starting at FIRST_PIN, each one a PumpDriver, selected by an index at runtime.
+* The index is resolved by a chain of compile-time bound pins, so every pump keeps the single instruction shutoff of its PumpDriver.
+*/
+template <unsigned char FIRST_PIN, unsigned char COUNT>
+struct PumpBank{
+  typedef PumpDriver<FIRST_PIN> First;
+  typedef PumpBank<FIRST_PIN + 1, COUNT - 1> Rest;
+
+  /**
+  * @brief Switches every pump off and its pin to output mode, call once before the first set().
+  */
+  static void begin() {
+    First::turn_off();
+    First::Pin::set_output();
+    Rest::begin();
+  }
+  static void set(unsigned char index, bool on) {
+    if(index != 0) Rest::set(index - 1, on);
+    else if(on) First::turn_on();
+    else First::turn_off();
+  }
+};
+
+template <unsigned char FIRST_PIN>
+struct PumpBank<FIRST_PIN, 0>{
+  static void begin() {}
+  static void set(unsigned char, bool) {}
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,104 @@
+#ifndef RTOS_TASKS_H
+#define RTOS_TASKS_H
+
+#include "hal.h"
+#include "config.h"
+
+#if RTOS_TASKS
+
+#include "spsc_ring.h"
+
+// The ESP32 core pulls FreeRTOS in via Arduino.h already.
+#if defined(ARDUINO_ARCH_RP2040)
+#include <FreeRTOS.h>
+#include <task.h>
+#endif
+
+/**
+* @brief Thin layer over the FreeRTOS task calls which differ between the ESP32 and the RP2040 port.
+*/
+struct RtosTask{
+  typedef void (*Entry)(void*);
+
+  /**
+  * @brief Creates a task pinned to the given core.
+  * @param stack_bytes Stack size in bytes, the ESP32 port counts bytes, the RP2040 port words.
+  * @returns TaskHandle_t The task, nullptr if it could not be created.
+  */
+  static TaskHandle_t spawn(Entry entry, const char* name, unsigned long stack_bytes, UBaseType_t priority, unsigned char core) {
+    TaskHandle_t handle = nullptr;
+#if defined(ARDUINO_ARCH_ESP32)
+    if(xTaskCreatePinnedToCore(entry, name, stack_bytes, nullptr, priority, &handle, core) != pdPASS) return nullptr;
+#else
+    if(xTaskCreateAffinitySet(entry, name, stack_bytes / sizeof(StackType_t), nullptr, priority, 1 << core, &handle) != pdPASS) return nullptr;
+#endif
+    return handle;
+  }
+  /**
+  * @returns TickType_t The ms in ticks, rounded up to at least one tick, so a short wait still yields.
+  */
+  static TickType_t ticks(unsigned long ms) {
+    TickType_t t = pdMS_TO_TICKS(ms);
+    return t > 0 ? t : 1;
+  }
+  static void sleep_ms(unsigned long ms) {
+    vTaskDelay(ticks(ms));
+  }
+  /**
+  * @brief Blocks the calling task until one of its RtosQueues received an element, or for at most ms.
+  * Elements pushed between the last pop() and the call wake it right away, the notifications count up.
+  */
+  static void wait_ms(unsigned long ms) {
+    ulTaskNotifyTake(pdTRUE, ticks(ms));
+  }
+};
+
+/**
+* @brief SpscRing between two tasks, which wakes the consumer task on every push, see RtosTask::wait_ms().
+* Neither side takes a lock, a producer on the other core is never held up by a slow consumer, a full queue drops the element instead.
+* @note One producer task and one consumer task per queue, as for the SpscRing. A consumer task may wait on several queues at once.
+*/
+template <typename T, unsigned char CAPACITY>
+class RtosQueue{
+  SpscRing<T, CAPACITY> ring;
+  TaskHandle_t volatile consumer;
+  unsigned int dropped;
+public:
+  RtosQueue() : ring(), consumer(nullptr), dropped(0) {}
+
+  /**
+  * @brief Sets the task woken by push(), before the producer starts.
+  */
+  void set_consumer(TaskHandle_t task) {
+    consumer = task;
+  }
+  /**
+  * @brief Producer side, appends an element and wakes the consumer.
+  * @returns bool False if the queue was full, the element is dropped.
+  */
+  bool push(const T& item) {
+    if(!ring.push(item)){
+      dropped++;
+      return false;
+    }
+    TaskHandle_t task = consumer;
+    if(task != nullptr) xTaskNotifyGive(task);
+    return true;
+  }
+  /**
+  * @brief Consumer side, removes the oldest element without blocking.
+  */
+  bool pop(T& item) {
+    return ring.pop(item);
+  }
+  /**
+  * @returns unsigned int The number of elements dropped due to a full queue, read from the producer side.
+  */
+  unsigned int get_dropped() const {
+    return dropped;
+  }
+};
+
+#endif
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef SAMPLE_FILTER_H
+#define SAMPLE_FILTER_H
+
+/**
+* @brief Helpers for oversampling and decimation.
+* Summing 4^n conversions and shifting the sum right by n yields a value with n additional bits of resolution, as long as the signal carries at least 1 LSB of noise.
+*/
+struct Oversampling{
+  // 4^3 * 1023 still fits into the 16 bit accumulators used on AVR.
+  static constexpr unsigned char MAX_BITS = 3;
+
+  /**
+  * @returns unsigned int The number of conversions needed for bits additional bits, 4^bits.
+  */
+  static constexpr unsigned int sample_count(unsigned char bits) {
+    return 1U << (2 * bits);
+  }
+  /**
+  * @brief Decimates the sum of sample_count(bits) conversions.
+  * @returns unsigned int The value with 10 + bits bits of resolution.
+  */
+  static constexpr unsigned int decimate(unsigned int sum, unsigned char bits) {
+    return sum >> bits;
+  }
+  /**
+  * @brief Rounds a decimated value back to the 10 bit range the thresholds are defined in.
+  * @returns unsigned int Ranging from 0 to 1023.
+  */
+  static constexpr unsigned int to_raw(unsigned int decimated, unsigned char bits) {
+    return bits == 0 ? decimated : clamp_raw((decimated + (1U << (bits - 1))) >> bits);
+  }
+  static constexpr unsigned int clamp_raw(unsigned int value) {
+    return value > 1023 ? 1023 : value;
+  }
+};
+
+/**
+* @brief Median-of-WINDOW filter running over a fixed-size ring buffer, rejects single spikes without the lag of a long average.
+* @note A WINDOW of 1 passes every value through unchanged.
+*/
+template <unsigned char WINDOW>
+class MedianFilter{
+  static_assert(WINDOW % 2 == 1, "The median window has to be odd.");
+  unsigned int ring[WINDOW];
+  unsigned char head;
+  unsigned char filled;
+public:
+  MedianFilter() : ring(), head(0), filled(0) {}
+
+  /**
+  * @brief Adds a new value to the ring buffer, overwriting the oldest one.
+  */
+  void push(unsigned int value) {
+    ring[head] = value;
+    head = head + 1 >= WINDOW ? 0 : head + 1;
+    if(filled < WINDOW) filled++;
+  }
+  /**
+  * @returns unsigned int The median of the values in the ring buffer, of the values pushed so far while filling up, 0 if empty.
+  */
+  unsigned int median() const {
+    if(filled == 0) return 0;
+    // Insertion sort of a copy, WINDOW is small enough for it to beat any cleverer selection.
+    unsigned int sorted[WINDOW];
+    for(unsigned char i = 0; i < filled; i++){
+      unsigned int v = ring[i];
+      unsigned char j = i;
+      for(; j > 0 && sorted[j - 1] > v; j--){
+        sorted[j] = sorted[j - 1];
+      }
+      sorted[j] = v;
+    }
+    return sorted[filled / 2];
+  }
+  /**
+  * @brief Forgets all previously pushed values.
+  */
+  void reset() {
+    head = 0;
+    filled = 0;
+  }
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "hal.h"
+#include "instrumentation.h"
+
+/**
+* @brief Signature of the functions run by the Scheduler.
+*/
+typedef void (*TaskCallback)();
+
+/**
+* @brief A single entry of the Scheduler's task table.
+*/
+struct Task{
+  TaskCallback callback;
+  // Period in ms for periodic tasks, 0 for one-shot tasks.
+  unsigned long interval;
+  // millis() timestamp at which the task is due next.
+  uint32_t deadline;
+  // Whether the task is waiting for its deadline. One-shot tasks disarm themselves after running.
+  bool armed;
+};
+
+/**
+* @brief Cooperative, millis() based task scheduler, replaces blocking delay() calls inside loop().
+* @note Deadlines are compared by their signed difference to the current time, so the scheduler keeps working across the millis() wrap-around (every ~49.7 days), as long as no single delay exceeds ~24.8 days.
+* @note Tasks must not block, every task delays all other tasks by its own run time.
+*/
+template <unsigned char MAX_TASKS>
+class Scheduler{
+public:
+  typedef unsigned char TaskId;
+  static constexpr TaskId INVALID_TASK = 0xFF;
+private:
+  Task tasks[MAX_TASKS];
+  unsigned char count;
+
+  /**
+  * @brief Wrap-safe check whether the deadline has been reached at the time now.
+  */
+  static bool is_due(uint32_t deadline, uint32_t now) {
+    return static_cast<int32_t>(now - deadline) >= 0;
+  }
+
+  TaskId add(TaskCallback callback, unsigned long interval, unsigned long first_delay, bool armed) {
+    if(count >= MAX_TASKS) return INVALID_TASK;
+    Task& task = tasks[count];
+    task.callback = callback;
+    task.interval = interval;
+    task.deadline = millis() + first_delay;
+    task.armed = armed;
+    return count++;
+  }
+public:
+  Scheduler() : count(0) {}
+
+  /**
+  * @brief Registers a task which runs every interval ms.
+  * @param callback The function to run.
+  * @param interval The period in ms, has to be greater than 0.
+  * @param first_delay Delay in ms until the first run.
+  * @returns TaskId The handle of the task, INVALID_TASK if the task table is full.
+  */
+  TaskId add_periodic(TaskCallback callback, unsigned long interval, unsigned long first_delay = 0) {
+    return add(callback, interval, first_delay, true);
+  }
+  /**
+  * @brief Registers a one-shot task. The task stays idle until it is armed via schedule_in().
+  * @param callback The function to run.
+  * @returns TaskId The handle of the task, INVALID_TASK if the task table is full.
+  */
+  TaskId add_oneshot(TaskCallback callback) {
+    return add(callback, 0, 0, false);
+  }
+  /**
+  * @brief (Re-)Arms a task to run delay ms from now. Periodic tasks continue with their period afterwards.
+  */
+  void schedule_in(TaskId id, unsigned long delay) {
+    if(id >= count) return;
+    tasks[id].deadline = millis() + delay;
+    tasks[id].armed = true;
+  }
+  /**
+  * @brief Disarms a task, it will not run until armed again via schedule_in().
+  */
+  void cancel(TaskId id) {
+    if(id >= count) return;
+    tasks[id].armed = false;
+  }
+  /**
+  * @brief Changes the period of a periodic task, takes effect after its next run.
+  */
+  void set_interval(TaskId id, unsigned long interval) {
+    if(id >= count || interval == 0) return;
+    tasks[id].interval = interval;
+  }
+  bool is_armed(TaskId id) const {
+    return id < count && tasks[id].armed;
+  }
+  /**
+  * @brief Runs every task whose deadline has been reached, each at most once per call. Call as often as possible from loop().
+  */
+  void run() {
+    for(unsigned char i = 0; i < count; i++){
+      Task& task = tasks[i];
+      uint32_t now = millis();
+      if(!task.armed || !is_due(task.deadline, now)) continue;
+      Instrumentation::record(PROBE_LATENESS, (now - task.deadline) * 1000UL);
+
+      if(task.interval == 0){
+        // Disarm before running, so the callback may re-arm its own task.
+        task.armed = false;
+      }
+      else{
+        // Advance from the previous deadline to avoid drift, unless the task fell behind by more than a full period.
+        task.deadline += task.interval;
+        if(is_due(task.deadline, now)) task.deadline = now + task.interval;
+      }
+      task.callback();
+    }
+  }
+  /**
+  * @brief Calculates the time until the next armed task is due.
+  * @returns unsigned long Time in ms, 0 if a task is already due, 0xFFFFFFFF if no task is armed.
+  */
+  unsigned long time_until_next() const {
+    uint32_t now = millis();
+    unsigned long next = 0xFFFFFFFFUL;
+    for(unsigned char i = 0; i < count; i++){
+      const Task& task = tasks[i];
+      if(!task.armed) continue;
+      if(is_due(task.deadline, now)) return 0;
+      unsigned long remaining = task.deadline - now;
+      if(remaining < next) next = remaining;
+    }
+    return next;
+  }
+};
+
+#endif
@@ -0,0 +1,281 @@
+#ifndef SENSOR_CHANNEL_H
+#define SENSOR_CHANNEL_H
+
+#include "hal.h"
+#include "config.h"
+#include "analog_sensors.h"
+#include "sensor_frame.h"
+#include "decision_table.h"
+#include "acquisition_sequence.h"
+#include "i2c_sensors.h"
+#include "sensor_health.h"
+
+/**
+* @brief Debounced state of one sensor, a new state is only taken over after CONFIRM_SAMPLES consecutive samples proposed it.
+*/
+struct SensorDebounce{
+  SensorStateLevel stable;
+  SensorStateLevel candidate;
+  unsigned char count;
+
+  SensorDebounce() : stable(SensorStateLevel::INVALID_STATE), candidate(SensorStateLevel::INVALID_STATE), count(0) {}
+
+  /**
+  * @param proposed The state of the current sample, classified with hysteresis against stable.
+  * @returns SensorStateLevel The debounced state.
+  */
+  SensorStateLevel update(SensorStateLevel proposed, unsigned char confirm_samples){
+    if(proposed == this->stable){
+      this->count = 0;
+      return this->stable;
+    }
+    // Invalid readings turn the pump off right away, and the first sample after boot has nothing to be debounced against.
+    if(proposed == SensorStateLevel::INVALID_STATE || this->stable == SensorStateLevel::INVALID_STATE){
+      this->stable = proposed;
+      this->count = 0;
+      return this->stable;
+    }
+    if(proposed != this->candidate){
+      this->candidate = proposed;
+      this->count = 0;
+    }
+    if(++this->count >= confirm_samples){
+      this->stable = proposed;
+      this->count = 0;
+    }
+    return this->stable;
+  }
+};
+
+/**
+* @brief Sensor channels are the building blocks of an ActionDecider, one per SensorSlot. Each channel owns the sensor and its whole pipeline,
+* the acquisition, filtering, debouncing and health check, and provides:
+*   - static constexpr SensorSlot SLOT, its slot in the SensorFrame.
+*   - void begin(), and unsigned char adc_pins(unsigned char* pins, unsigned char* bits, unsigned char count), which appends the pins the AdcAcquisition engine converts for it.
+*   - unsigned long plan(AcquisitionSequence&, unsigned long interval), the time it needs ahead of the planned sample.
+*   - void acquire(AcquisitionSequence&, uint32_t now, const unsigned int* sweep, unsigned char& index), one step of the acquisition, sweep[index++] is its AdcAcquisition value.
+*   - void power_down(AcquisitionSequence&), void power_on(SensorSlot) and bool read_raw(SensorSlot, unsigned int&), the latter two for the channel of the given slot only.
+*   - void sample(SensorFrame&), void restore(const SensorStateLevel*) and void print(const SensorFrame&).
+*   - void check_health(SensorFrame&, bool steady, unsigned char implausible) and unsigned char fallback(), the SensorHealth check and the RulesFallback bits it asks for.
+* Every member is a few lines, called once per channel from a pack expansion of the ActionDecider, and inlined into it.
+*/
+struct SensorChannelBase{
+  unsigned char adc_pins(unsigned char*, unsigned char*, unsigned char count) const { return count; }
+  unsigned long plan(AcquisitionSequence&, unsigned long) { return 0; }
+  void acquire(AcquisitionSequence&, uint32_t, const unsigned int*, unsigned char&) {}
+  void power_down(AcquisitionSequence&) {}
+  void power_on(SensorSlot) {}
+  bool read_raw(SensorSlot, unsigned int&) const { return false; }
+  void restore(const SensorStateLevel*) {}
+  void print(const SensorFrame&) const {}
+  void check_health(SensorFrame&, bool, unsigned char) {}
+  unsigned char fallback() const { return RULES_FULL; }
+};
+
+/**
+* @brief Channel of an AnalogSensor, with its median filter, its debouncing, its power gate and its SensorHealth check.
+* @tparam SLOT_ The slot of the readings in the SensorFrame.
+* @tparam Sensor The AnalogSensor type, its pin and thresholds.
+* @tparam HealthLimits The limits of its SensorHealth check, see SoilMoistureHealth.
+*/
+template <SensorSlot SLOT_, class Sensor, class HealthLimits>
+class AnalogChannel : public SensorChannelBase{
+  Sensor sensor;
+  // Spike rejection of the oversampled readings.
+  MedianFilter<Sensor::MEDIAN_WINDOW> filter;
+  SensorDebounce debounce;
+#if SENSOR_HEALTH
+  SensorHealth<HealthLimits> health;
+#endif
+  // Powers the sensor around its acquisition, see ActionDecider::PlanAcquisition().
+  AcquisitionSequence::Gate gate;
+public:
+  typedef Sensor SensorType;
+  static constexpr SensorSlot SLOT = SLOT_;
+
+  AnalogChannel()
+  : sensor(),
+    filter(),
+    debounce(),
+#if SENSOR_HEALTH
+    health(),
+#endif
+    gate()
+    {
+
+    }
+  void begin() {
+    Sensor::Power::begin();
+  }
+  unsigned char adc_pins(unsigned char* pins, unsigned char* bits, unsigned char count) const {
+    pins[count] = Sensor::PIN_NUMBER;
+    bits[count] = Sensor::OVERSAMPLE_BITS;
+    return count + 1;
+  }
+  unsigned long plan(AcquisitionSequence& sequence, unsigned long) {
+    return sequence.lead_ms<Sensor>();
+  }
+  /**
+  * @brief Pushes one oversampled burst into the median filter, once the sensor is settled and within its window.
+  * @note With ADC_ISR_ACQUISITION the burst is the channel's value of the last complete sweep of the AdcAcquisition engine, without waiting for a conversion.
+  */
+  void acquire(AcquisitionSequence& sequence, uint32_t now, const unsigned int* sweep, unsigned char& index) {
+    bool ready = sequence.step<Sensor>(this->gate, now);
+#if ADC_ISR_ACQUISITION
+    if(ready) this->filter.push(sweep[index]);
+    index++;
+#else
+    (void)sweep;
+    (void)index;
+    if(ready) this->filter.push(this->sensor.read_oversampled());
+#endif
+  }
+  void power_down(AcquisitionSequence& sequence) {
+    sequence.stop<Sensor>(this->gate);
+  }
+  void power_on(SensorSlot slot) {
+    if(slot == SLOT) Sensor::Power::power_on();
+  }
+  /**
+  * @brief Reads one oversampled burst, past the median filter and the debouncing, rounded back to 10 bits.
+  */
+  bool read_raw(SensorSlot slot, unsigned int& raw) const {
+    if(slot != SLOT) return false;
+    raw = Oversampling::to_raw(this->sensor.read_oversampled(), Sensor::OVERSAMPLE_BITS);
+    return true;
+  }
+  /**
+  * @brief Stores the median of the last bursts, rounded back to 10 bits, and its state, classified with hysteresis against the debounced state and debounced.
+  */
+  void sample(SensorFrame& frame) {
+    frame.raw[SLOT] = Oversampling::to_raw(this->filter.median(), Sensor::OVERSAMPLE_BITS);
+    frame.state[SLOT] = this->debounce.update(Sensor::classify(frame.raw[SLOT], this->debounce.stable), Sensor::CONFIRM_SAMPLES);
+  }
+  void restore(const SensorStateLevel* states) {
+    this->debounce.stable = states[SLOT];
+  }
+  void print(const SensorFrame& frame) const {
+    this->sensor.SerialPrint(frame.raw[SLOT], frame.state[SLOT]);
+#if SENSOR_HEALTH
+    this->health.SerialPrint();
+#endif
+  }
+  /**
+  * @brief Feeds the reading into the SensorHealth check, and marks the state INVALID_STATE while the sensor failed.
+  * The debouncing goes on underneath, a sensor which recovers continues from its debounced state.
+  */
+  void check_health(SensorFrame& frame, bool steady, unsigned char implausible) {
+#if SENSOR_HEALTH
+    this->health.update(frame.raw[SLOT], frame.timestamp, steady);
+    this->health.set_implausible((implausible & 1 << SLOT) != 0);
+    if(this->health.is_failed()) frame.state[SLOT] = SensorStateLevel::INVALID_STATE;
+#else
+    (void)frame;
+    (void)steady;
+    (void)implausible;
+#endif
+  }
+  unsigned char fallback() const {
+#if SENSOR_HEALTH
+    switch(this->health.level()){
+      case HEALTH_DEGRADED: return HealthLimits::FALLBACK_DEGRADED;
+      case HEALTH_FAILED: return HealthLimits::FALLBACK_FAILED;
+      case HEALTH_UNKNOWN: return HealthLimits::FALLBACK_UNKNOWN;
+      default: return RULES_FULL;
+    }
+#else
+    return RULES_FULL;
+#endif
+  }
+};
+
+#if I2C_SENSORS_ENABLED
+/**
+* @brief Channel of an I2cSensor. The conversion runs on the device, the bus transactions in the TWI ISR, neither blocks the acquisition of the analog channels.
+* A failed measurement reads INVALID_STATE, which turns the pump off like any invalid reading.
+* @tparam Device The I2cSensor device policy, e.g. EzoPhDevice.
+*/
+template <SensorSlot SLOT_, class Device>
+class I2cChannel : public SensorChannelBase{
+  typedef I2cSensor<Device> Sensor;
+  Sensor sensor;
+  SensorDebounce debounce;
+  // Whether the measurement of the planned acquisition was requested already.
+  bool requested;
+  // Time ahead of the planned sample to request the measurement at.
+  unsigned long lead;
+public:
+  static constexpr SensorSlot SLOT = SLOT_;
+
+  I2cChannel() : sensor(), debounce(), requested(false), lead(0) {}
+
+  void begin() {
+    TwiMaster::begin();
+  }
+  unsigned long plan(AcquisitionSequence&, unsigned long interval) {
+    // The conversion, plus an acquire() call to request it and one to read the response.
+    this->lead = Device::CONVERSION_MS + 2 * interval;
+    this->requested = false;
+    return this->lead;
+  }
+  void acquire(AcquisitionSequence& sequence, uint32_t now, const unsigned int*, unsigned char&) {
+    if(!this->requested && sequence.is_due(this->lead, now)){
+      this->sensor.start();
+      this->requested = true;
+    }
+    this->sensor.update(now);
+  }
+  /**
+  * @brief Stores the reading of the last successful measurement, in the unit of the Device, e.g. 1/100 PH steps.
+  */
+  void sample(SensorFrame& frame) {
+    frame.raw[SLOT] = this->sensor.get_value();
+    frame.state[SLOT] = this->sensor.has_value()
+      ? this->debounce.update(Sensor::classify(frame.raw[SLOT], this->debounce.stable), Device::CONFIRM_SAMPLES)
+      : SensorStateLevel::INVALID_STATE;
+  }
+  void restore(const SensorStateLevel* states) {
+    this->debounce.stable = states[SLOT];
+  }
+  void print(const SensorFrame& frame) const {
+    this->sensor.SerialPrint(frame.raw[SLOT], frame.state[SLOT]);
+  }
+};
+#endif
+
+/**
+* @brief Channel without a sensor, e.g. in place of a faulty one, its slot always holds the reading 0 in STATE.
+*/
+template <SensorSlot SLOT_, SensorStateLevel STATE>
+class ConstantChannel : public SensorChannelBase{
+public:
+  static constexpr SensorSlot SLOT = SLOT_;
+
+  void begin() {}
+  void sample(SensorFrame& frame) {
+    frame.raw[SLOT] = 0;
+    frame.state[SLOT] = STATE;
+  }
+};
+
+/**
+* @brief Compile-time checks of a list of channels.
+*/
+template <class... Channels>
+struct ChannelList;
+
+template <>
+struct ChannelList<>{
+  static constexpr unsigned int SLOT_MASK = 0;
+  static constexpr bool UNIQUE = true;
+};
+
+template <class Head, class... Tail>
+struct ChannelList<Head, Tail...>{
+  // One bit per SensorSlot with a channel.
+  static constexpr unsigned int SLOT_MASK = (1U << Head::SLOT) | ChannelList<Tail...>::SLOT_MASK;
+  // Whether no two channels share a slot.
+  static constexpr bool UNIQUE = !(ChannelList<Tail...>::SLOT_MASK & (1U << Head::SLOT)) && ChannelList<Tail...>::UNIQUE;
+};
+
+#endif
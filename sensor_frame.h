@@ -0,0 +1,30 @@
+#ifndef SENSOR_FRAME_H
+#define SENSOR_FRAME_H
+
+#include "states.h"
+
+/**
+* @brief Position of each sensor inside a SensorFrame.
+*/
+enum SensorSlot{
+  SLOT_SOIL_MOISTURE = 0,
+  SLOT_PH = 1,
+  SLOT_WATER_LEVEL = 2,
+  SLOT_WATER_DETECTION = 3,
+  SENSOR_SLOT_COUNT = 4
+};
+
+/**
+* @brief Snapshot of all sensor readings of one decision cycle.
+* @note Captured once per cycle by ActionDecider::Sample(), every consumer works from the snapshot instead of converting the ADC channels again.
+*/
+struct SensorFrame{
+  // millis() timestamp of the capture.
+  uint32_t timestamp;
+  // Raw ADC values, 0 to 1023. The PH slot holds 1/100 PH steps with I2C_PH_SENSOR.
+  unsigned int raw[SENSOR_SLOT_COUNT];
+  // States derived from the raw values.
+  SensorStateLevel state[SENSOR_SLOT_COUNT];
+};
+
+#endif
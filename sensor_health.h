@@ -0,0 +1,338 @@
+#ifndef SENSOR_HEALTH_H
+#define SENSOR_HEALTH_H
+
+#include "hal.h"
+#include "states.h"
+#include "flash_strings.h"
+#include "decision_table.h"
+#include "sensor_frame.h"
+
+/**
+* @brief Trust in the readings of a sensor, see SensorHealth.
+*/
+enum SensorHealthLevel : unsigned char{
+  HEALTH_OK = 0,
+  // The readings are still used, ActionDecider falls back to rules which do not rely on them as much.
+  HEALTH_DEGRADED = 1,
+  // The readings are unusable, the state of the sensor is INVALID_STATE.
+  HEALTH_FAILED = 2,
+  // Not watched long enough yet to trust the readings, see ESTABLISH_MS of the limits. ActionDecider falls back as for a degraded sensor.
+  HEALTH_UNKNOWN = 3
+};
+
+/**
+* @brief Faults found by SensorHealth, one bit each.
+*/
+enum SensorFault : unsigned char{
+  // Stuck at 0, e.g. a shorted or disconnected sensor.
+  FAULT_RAIL_LOW = 0x01,
+  // Stuck at 1023, e.g. a broken ground.
+  FAULT_RAIL_HIGH = 0x02,
+  // The reading did not move for longer than the sensor ever stays still, e.g. the PH probe stuck at 8.6.
+  FAULT_FLATLINE = 0x04,
+  // The readings jump between samples, e.g. a loose contact.
+  FAULT_NOISY = 0x08,
+  // The reading contradicts another sensor, see MoistureCrossCheck.
+  FAULT_IMPLAUSIBLE = 0x10,
+  // Faults which make the readings unusable, the default FAILED_FAULTS of the limits.
+  FAULTS_FAILED = FAULT_RAIL_LOW | FAULT_RAIL_HIGH | FAULT_FLATLINE
+};
+
+const char HEALTH_NAME_OK[] PROGMEM = "OK";
+const char HEALTH_NAME_DEGRADED[] PROGMEM = "DEGRADED";
+const char HEALTH_NAME_FAILED[] PROGMEM = "FAILED";
+const char HEALTH_NAME_UNKNOWN[] PROGMEM = "UNKNOWN";
+const char* const HEALTH_NAMES[] PROGMEM = {
+  HEALTH_NAME_OK,
+  HEALTH_NAME_DEGRADED,
+  HEALTH_NAME_FAILED,
+  HEALTH_NAME_UNKNOWN
+};
+
+/**
+* @brief Welford's running mean and variance in integer math, in 1/16 counts. One 16 bit division per value, no division for the limit check.
+*/
+class WelfordVariance{
+  static constexpr unsigned char FRACTION_BITS = 4;
+
+  unsigned char count;
+  // In 1/16 counts.
+  int mean;
+  // Sum of the squared deviations from the mean, in 1/256 counts^2. Below 2^32 for up to 60 values of at most MAX_VALUE.
+  unsigned long m2;
+public:
+  // Largest magnitude of a value, the 1/16 counts and their deviations have to fit into 16 bits.
+  static constexpr int MAX_VALUE = 511;
+  static constexpr unsigned char MAX_COUNT = 60;
+
+  WelfordVariance() : count(0), mean(0), m2(0) {}
+
+  void reset() {
+    count = 0;
+    mean = 0;
+    m2 = 0;
+  }
+  unsigned char get_count() const {
+    return count;
+  }
+  /**
+  * @param value -MAX_VALUE to MAX_VALUE, at most MAX_COUNT values between two reset() calls.
+  */
+  void push(int value) {
+    int x = value * (1 << FRACTION_BITS);
+    count++;
+    int delta = x - mean;
+    mean += delta / (int)count;
+    m2 += (unsigned long)((long)delta * (x - mean));
+  }
+  /**
+  * @returns bool Whether the sample variance is above limit counts^2, false for less than 2 values.
+  */
+  bool exceeds(unsigned int limit) const {
+    return count > 1 && m2 > ((unsigned long)limit << (2 * FRACTION_BITS)) * (count - 1);
+  }
+};
+
+/**
+* @brief Incremental health check of one sensor, fed with every sample and constant in cost and memory.
+* Finds a reading stuck at a rail, a flatline, i.e. a reading which did not move for longer than the sensor ever stays still,
+* and noise, from the Welford variance of the differences between consecutive samples over HEALTH_WINDOW samples, which leaves out slow trends.
+* @tparam Limits Policy providing:
+*   - static constexpr bool RAIL_LOW and RAIL_HIGH, whether a reading stuck at 0 or 1023 is a fault, i.e. impossible for an intact sensor.
+*   - static constexpr unsigned long FLATLINE_MS and unsigned int FLAT_TOLERANCE, how long the reading may stay within FLAT_TOLERANCE counts, 0 to skip the check.
+*   - static constexpr unsigned int NOISE_VARIANCE, the variance in counts^2 of the differences above which the sensor is noisy, 0 to skip the check.
+*   - static constexpr unsigned char FAILED_FAULTS, the SensorFault bits which fail the sensor, usually FAULTS_FAILED, the others only degrade it.
+*   - static constexpr unsigned char FALLBACK_DEGRADED and FALLBACK_FAILED, the RulesFallback bits ActionDecider::DecideAction() uses while the sensor is degraded or failed.
+*   - static constexpr unsigned long ESTABLISH_MS and unsigned char FALLBACK_UNKNOWN, how long after the first sample the health is HEALTH_UNKNOWN, 0 for never,
+*     and the RulesFallback bits meanwhile.
+*/
+template <class Limits>
+class SensorHealth{
+  WelfordVariance noise;
+  // Time of the first sample.
+  uint32_t first_ms;
+  // Start and reading of the current flat run.
+  uint32_t flat_since;
+  unsigned int flat_reference;
+  unsigned int previous;
+  unsigned char rail_count;
+  unsigned char faults;
+  bool started;
+  bool established;
+public:
+  // Readings within RAIL_MARGIN counts of 0 or 1023 count as on the rail, RAIL_SAMPLES consecutive ones are a fault.
+  static constexpr unsigned int RAIL_MARGIN = 2;
+  static constexpr unsigned char RAIL_SAMPLES = 3;
+  // Samples per noise estimate, the result holds until the next one.
+  static constexpr unsigned char HEALTH_WINDOW = 16;
+  static_assert(HEALTH_WINDOW <= WelfordVariance::MAX_COUNT, "Too many samples per noise estimate.");
+
+  SensorHealth() : noise(), first_ms(0), flat_since(0), flat_reference(0), previous(0), rail_count(0), faults(0), started(false), established(false) {}
+
+  /**
+  * @brief Checks the next sample.
+  * @param raw The reading, 0 to 1023.
+  * @param now Time of the sample in ms.
+  * @param steady Whether the reading is expected to change slowly only, false while watering, the noise estimate skips the sample then.
+  */
+  void update(unsigned int raw, uint32_t now, bool steady) {
+    if(!started){
+      started = true;
+      first_ms = now;
+      previous = raw;
+      flat_reference = raw;
+      flat_since = now;
+    }
+    bool rail_low = Limits::RAIL_LOW && raw <= RAIL_MARGIN;
+    bool rail_high = Limits::RAIL_HIGH && raw >= 1023 - RAIL_MARGIN;
+    if(!rail_low && !rail_high) rail_count = 0;
+    else if(rail_count < RAIL_SAMPLES) rail_count++;
+    faults &= ~(FAULT_RAIL_LOW | FAULT_RAIL_HIGH | FAULT_FLATLINE);
+    if(rail_count >= RAIL_SAMPLES) faults |= rail_low ? FAULT_RAIL_LOW : FAULT_RAIL_HIGH;
+
+    if(Limits::FLATLINE_MS != 0){
+      unsigned int distance = raw > flat_reference ? raw - flat_reference : flat_reference - raw;
+      if(distance > Limits::FLAT_TOLERANCE){
+        flat_reference = raw;
+        flat_since = now;
+      }
+      else if(now - flat_since >= Limits::FLATLINE_MS) faults |= FAULT_FLATLINE;
+    }
+
+    if(Limits::NOISE_VARIANCE != 0 && steady){
+      int step = (int)raw - (int)previous;
+      if(step > WelfordVariance::MAX_VALUE) step = WelfordVariance::MAX_VALUE;
+      else if(step < -WelfordVariance::MAX_VALUE) step = -WelfordVariance::MAX_VALUE;
+      noise.push(step);
+      if(noise.get_count() >= HEALTH_WINDOW){
+        if(noise.exceeds(Limits::NOISE_VARIANCE)) faults |= FAULT_NOISY;
+        else faults &= ~FAULT_NOISY;
+        noise.reset();
+      }
+    }
+    previous = raw;
+    if(!established && now - first_ms >= Limits::ESTABLISH_MS) established = true;
+  }
+  /**
+  * @brief Sets or clears FAULT_IMPLAUSIBLE, the result of a cross-check with another sensor.
+  */
+  void set_implausible(bool implausible) {
+    if(implausible) faults |= FAULT_IMPLAUSIBLE;
+    else faults &= ~FAULT_IMPLAUSIBLE;
+  }
+  unsigned char get_faults() const {
+    return faults;
+  }
+  /**
+  * @returns SensorHealthLevel HEALTH_FAILED on a fault found already, else HEALTH_UNKNOWN until ESTABLISH_MS passed, also before the first sample.
+  */
+  SensorHealthLevel level() const {
+    if(faults & Limits::FAILED_FAULTS) return HEALTH_FAILED;
+    if(!established) return HEALTH_UNKNOWN;
+    return faults ? HEALTH_DEGRADED : HEALTH_OK;
+  }
+  bool is_failed() const {
+    return (faults & Limits::FAILED_FAULTS) != 0;
+  }
+  /**
+  * @brief Prints the health and the faults, e.g. "Health: FAILED flatline".
+  */
+  void SerialPrint() const {
+    Serial.print(F("Health: "));
+    Serial.print(reinterpret_cast<FlashString>(pgm_read_ptr(&HEALTH_NAMES[this->level()])));
+    if(faults & FAULT_RAIL_LOW) Serial.print(F(" rail-low"));
+    if(faults & FAULT_RAIL_HIGH) Serial.print(F(" rail-high"));
+    if(faults & FAULT_FLATLINE) Serial.print(F(" flatline"));
+    if(faults & FAULT_NOISY) Serial.print(F(" noisy"));
+    if(faults & FAULT_IMPLAUSIBLE) Serial.print(F(" implausible"));
+    Serial.print('\n');
+  }
+};
+
+/**
+* @brief Cross-check of the soil moisture and the water detection sensor, catches the faults a single sensor cannot tell from a normal reading.
+* Water standing at the bottom of the pot wicks up into the soil within hours,
+* a bone dry reading next to detected water for longer than CROSS_CHECK_MS means one of both is wrong.
+* WateringRules waters on exactly this combination, see its bone dry special case.
+* A dose which soaked the soil drains to the bottom of the pot, the water detection still reading dry DRAIN_MS after it means it is stuck dry.
+* It stays suspect until it detects water again.
+*/
+class MoistureCrossCheck{
+  uint32_t conflict_since;
+  uint32_t dose_at;
+  bool conflicting;
+  bool watching;
+  bool detection_suspect;
+public:
+  static constexpr unsigned long CROSS_CHECK_MS = 6UL * 60 * 60 * 1000;
+  static constexpr unsigned long DRAIN_MS = 30UL * 60 * 1000;
+
+  MoistureCrossCheck() : conflict_since(0), dose_at(0), conflicting(false), watching(false), detection_suspect(false) {}
+
+  /**
+  * @brief Starts watching the water detection after a dose, call when the pump turns on.
+  */
+  void begin_dose(uint32_t now) {
+    watching = true;
+    dose_at = now;
+  }
+  /**
+  * @returns unsigned char The implausible sensors, one (1 << SensorSlot) bit each.
+  */
+  unsigned char update(SensorStateLevel sm_state, SensorStateLevel wd_state, uint32_t now) {
+    if(wd_state != SensorStateLevel::OK){
+      watching = false;
+      detection_suspect = false;
+    }
+    else if(watching && now - dose_at >= DRAIN_MS){
+      watching = false;
+      if(sm_state == SensorStateLevel::TOO_HIGH) detection_suspect = true;
+    }
+    unsigned char implausible = detection_suspect ? 1 << SLOT_WATER_DETECTION : 0;
+    if(sm_state != SensorStateLevel::TOO_LOW || wd_state != SensorStateLevel::TOO_HIGH){
+      conflicting = false;
+      return implausible;
+    }
+    if(!conflicting){
+      conflicting = true;
+      conflict_since = now;
+    }
+    if(now - conflict_since >= CROSS_CHECK_MS) implausible |= 1 << SLOT_SOIL_MOISTURE | 1 << SLOT_WATER_DETECTION;
+    return implausible;
+  }
+};
+
+/**
+* @brief Limits of the capacitive soil moisture sensor. Dry soil reads about 750 and soaked soil about 250, an intact sensor never reaches a rail.
+* Evaporation and the temperature move the reading within a day, but bone dry soil at a steady temperature may stay flat until the next watering.
+* A flatline therefore only degrades the sensor, failing it would turn the pump off, and only a watering could move the reading again.
+*/
+struct SoilMoistureHealth{
+  static constexpr bool RAIL_LOW = true;
+  static constexpr bool RAIL_HIGH = true;
+  static constexpr unsigned long FLATLINE_MS = 24UL * 60 * 60 * 1000;
+  static constexpr unsigned int FLAT_TOLERANCE = 2;
+  // 20 counts standard deviation between samples.
+  static constexpr unsigned int NOISE_VARIANCE = 400;
+  static constexpr unsigned char FAILED_FAULTS = FAULT_RAIL_LOW | FAULT_RAIL_HIGH;
+  // Failed, the INVALID_STATE turns the pump off.
+  static constexpr unsigned char FALLBACK_DEGRADED = RULES_CONSERVATIVE;
+  static constexpr unsigned char FALLBACK_FAILED = RULES_FULL;
+  static constexpr unsigned long ESTABLISH_MS = 0;
+  static constexpr unsigned char FALLBACK_UNKNOWN = RULES_FULL;
+};
+
+/**
+* @brief Limits of the analog PH sensor, PH 0 and 14 are out of question. The probe drifts by more than 0.03 PH within half an hour.
+* A false flatline only costs the PH check, see ActionDecider::DecideAction, a faulty probe is found half an hour after boot.
+* Until then its PH is unknown and ignored, a probe stuck out of range would veto every watering meanwhile.
+* @note A stuck probe which jitters by more than FLAT_TOLERANCE passes the flatline check, the reason why ANALOG_PH_SENSOR is opt-in.
+*/
+struct PhHealth{
+  static constexpr bool RAIL_LOW = true;
+  static constexpr bool RAIL_HIGH = true;
+  static constexpr unsigned long FLATLINE_MS = 30UL * 60 * 1000;
+  static constexpr unsigned int FLAT_TOLERANCE = 2;
+  static constexpr unsigned int NOISE_VARIANCE = 400;
+  static constexpr unsigned char FAILED_FAULTS = FAULTS_FAILED;
+  // The PH only vetoes a watering, without it the other sensors still protect the plant.
+  static constexpr unsigned char FALLBACK_DEGRADED = RULES_IGNORE_PH;
+  static constexpr unsigned char FALLBACK_FAILED = RULES_IGNORE_PH;
+  static constexpr unsigned long ESTABLISH_MS = FLATLINE_MS;
+  static constexpr unsigned char FALLBACK_UNKNOWN = RULES_IGNORE_PH;
+};
+
+/**
+* @brief Limits of the capacitive water level sensor. The level only moves while watering, no flatline check.
+*/
+struct WaterLevelHealth{
+  static constexpr bool RAIL_LOW = true;
+  static constexpr bool RAIL_HIGH = true;
+  static constexpr unsigned long FLATLINE_MS = 0;
+  static constexpr unsigned int FLAT_TOLERANCE = 0;
+  static constexpr unsigned int NOISE_VARIANCE = 400;
+  static constexpr unsigned char FAILED_FAULTS = FAULTS_FAILED;
+  static constexpr unsigned char FALLBACK_DEGRADED = RULES_CONSERVATIVE;
+  static constexpr unsigned char FALLBACK_FAILED = RULES_FULL;
+  static constexpr unsigned long ESTABLISH_MS = 0;
+  static constexpr unsigned char FALLBACK_UNKNOWN = RULES_FULL;
+};
+
+/**
+* @brief Limits of the water detection sensor. Reads 0 when dry for days, up to 1023 in water, and jumps when water arrives.
+* Both rails and a flatline are normal readings, the sensor is only checked against the soil moisture, see MoistureCrossCheck.
+*/
+struct WaterDetectionHealth{
+  static constexpr bool RAIL_LOW = false;
+  static constexpr bool RAIL_HIGH = false;
+  static constexpr unsigned long FLATLINE_MS = 0;
+  static constexpr unsigned int FLAT_TOLERANCE = 0;
+  static constexpr unsigned int NOISE_VARIANCE = 0;
+  static constexpr unsigned char FAILED_FAULTS = FAULTS_FAILED;
+  static constexpr unsigned char FALLBACK_DEGRADED = RULES_CONSERVATIVE;
+  static constexpr unsigned char FALLBACK_FAILED = RULES_FULL;
+  static constexpr unsigned long ESTABLISH_MS = 0;
+  static constexpr unsigned char FALLBACK_UNKNOWN = RULES_FULL;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef SENSOR_POWER_H
+#define SENSOR_POWER_H
+
+#include "fast_pin.h"
+
+// Power pin of a sensor wired directly to the supply, see SensorPower.
+static constexpr unsigned char NO_POWER_PIN = 0xFF;
+
+/**
+* @brief Switches the supply of a sensor via a digital pin, bound at compile time.
+* @note An output pin sources up to ~20mA, enough for the capacitive sensors (~5mA), use a transistor for anything drawing more.
+* @tparam POWER_PIN The digital pin powering the sensor, NO_POWER_PIN for a permanently powered sensor.
+*/
+template <unsigned char POWER_PIN>
+struct SensorPower{
+  typedef FastPin<POWER_PIN> Pin;
+  static constexpr bool GATED = true;
+
+  static void begin() {
+    Pin::set_low();
+    Pin::set_output();
+  }
+  static void power_on() {
+    Pin::set_high();
+  }
+  static void power_off() {
+    Pin::set_low();
+  }
+  static bool is_on() {
+    return Pin::is_high();
+  }
+};
+
+/**
+* @brief A permanently powered sensor, every operation compiles to nothing.
+*/
+template <>
+struct SensorPower<NO_POWER_PIN>{
+  static constexpr bool GATED = false;
+
+  static void begin() {}
+  static void power_on() {}
+  static void power_off() {}
+  static bool is_on() {
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+/**
+* @brief Accesses to the indices of a SpscRing, every one of them goes through here.
+* AVR has a single core and no reordering hardware, a volatile access to the byte plus a compiler barrier keeps the element access on the right side of the index update.
+* Elsewhere atomic loads and stores with acquire/release ordering, the dual-core RP2040 and ESP32 may run producer and consumer on different cores.
+* Acquiring the index of the other side orders the element access after its release, i.e. the consumer reads a complete element, and the producer
+* overwrites a slot only once the consumer is done reading it.
+*/
+struct SpscIndex{
+  /**
+  * @brief Reads the index owned by the calling side, nothing to order against.
+  */
+  static inline unsigned char load_own(const unsigned char& index) {
+#if defined(__AVR__)
+    return *static_cast<const volatile unsigned char*>(&index);
+#else
+    return __atomic_load_n(&index, __ATOMIC_RELAXED);
+#endif
+  }
+  static inline unsigned char load_acquire(const unsigned char& index) {
+#if defined(__AVR__)
+    unsigned char value = *static_cast<const volatile unsigned char*>(&index);
+    __asm__ __volatile__("" ::: "memory");
+    return value;
+#else
+    return __atomic_load_n(&index, __ATOMIC_ACQUIRE);
+#endif
+  }
+  static inline void store_release(unsigned char& index, unsigned char value) {
+#if defined(__AVR__)
+    __asm__ __volatile__("" ::: "memory");
+    *static_cast<volatile unsigned char*>(&index) = value;
+#else
+    __atomic_store_n(&index, value, __ATOMIC_RELEASE);
+#endif
+  }
+};
+
+/**
+* @brief Lock-free single-producer/single-consumer ring buffer, e.g. from an ISR to loop() or the other way around.
+* Only the producer writes head, only the consumer writes tail, both are single bytes accessed atomically through SpscIndex,
+* so neither side ever disables interrupts. Both indices run freely and wrap at 256, their difference is the fill level.
+* @note Exactly one context may call push(), and exactly one context pop()/peek()/clear(), the other calls are safe from either side.
+* @tparam T Element type, copied by assignment.
+* @tparam CAPACITY Number of elements, power of two, at most 128, all of them usable.
+*/
+template <typename T, unsigned char CAPACITY>
+class SpscRing{
+  static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "SpscRing capacity has to be a power of two.");
+  static_assert(CAPACITY <= 128, "SpscRing capacity has to fit the 8 bit indices.");
+  static constexpr unsigned char MASK = CAPACITY - 1;
+
+  T items[CAPACITY];
+  // Only accessed through SpscIndex.
+  unsigned char head;
+  unsigned char tail;
+public:
+  SpscRing() : items(), head(0), tail(0) {}
+
+  /**
+  * @brief Producer side, appends an element.
+  * @returns bool False if the ring is full, the element is dropped.
+  */
+  bool push(const T& item) {
+    unsigned char h = SpscIndex::load_own(head);
+    // The consumer has to be done reading the slot before it is overwritten.
+    if((unsigned char)(h - SpscIndex::load_acquire(tail)) >= CAPACITY) return false;
+    items[h & MASK] = item;
+    // The element has to be complete before the consumer sees the new head.
+    SpscIndex::store_release(head, h + 1);
+    return true;
+  }
+  /**
+  * @brief Consumer side, removes the oldest element.
+  * @returns bool False if the ring is empty, item is left untouched.
+  */
+  bool pop(T& item) {
+    unsigned char t = SpscIndex::load_own(tail);
+    // Read the element only after seeing the head that published it.
+    if(t == SpscIndex::load_acquire(head)) return false;
+    item = items[t & MASK];
+    // The element has to be read before the producer sees the slot as free.
+    SpscIndex::store_release(tail, t + 1);
+    return true;
+  }
+  /**
+  * @brief Consumer side, the oldest element without removing it.
+  * @returns bool False if the ring is empty.
+  */
+  bool peek(T& item) const {
+    unsigned char t = SpscIndex::load_own(tail);
+    if(t == SpscIndex::load_acquire(head)) return false;
+    item = items[t & MASK];
+    return true;
+  }
+  /**
+  * @brief Consumer side, drops every element.
+  */
+  void clear() {
+    SpscIndex::store_release(tail, SpscIndex::load_acquire(head));
+  }
+  unsigned char size() const {
+    return (unsigned char)(SpscIndex::load_acquire(head) - SpscIndex::load_acquire(tail));
+  }
+  unsigned char free_space() const {
+    return CAPACITY - size();
+  }
+  bool is_empty() const {
+    return size() == 0;
+  }
+  bool is_full() const {
+    return size() >= CAPACITY;
+  }
+  static constexpr unsigned char capacity() {
+    return CAPACITY;
+  }
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef STATE_BANDS_H
+#define STATE_BANDS_H
+
+#include "hal.h"
+#include "states.h"
+
+/**
+* @brief One entry of a band table, every raw value up to and including upper is assigned state.
+*/
+struct StateBand{
+  unsigned int upper;
+  SensorStateLevel state;
+};
+
+/**
+* @brief Copy of a band table in RAM, e.g. with thresholds calibrated at runtime. Classified by the same StateBands functions as the flash tables.
+*/
+template <unsigned char N>
+struct BandTable{
+  StateBand bands[N];
+
+  /**
+  * @param flash Band table in PROGMEM, copied as the initial thresholds.
+  */
+  explicit BandTable(const StateBand (&flash)[N]) {
+    load(flash);
+  }
+  void load(const StateBand (&flash)[N]) {
+    for(unsigned char i = 0; i < N; i++){
+      bands[i].upper = pgm_read_word(&flash[i].upper);
+      bands[i].state = static_cast<SensorStateLevel>(pgm_read_byte(&flash[i].state));
+    }
+  }
+};
+
+/**
+* @brief Classification of raw ADC values via band tables stored in flash (PROGMEM), or copied to RAM as a BandTable.
+* A band table lists the upper bound of every state in ascending order, classification is a binary search over it,
+* i.e. 3 compares for 5 bands, independent of which band the value falls into.
+*/
+struct StateBands{
+  /**
+  * @brief Accessors of both kinds of tables, the functions below are written against them.
+  */
+  template <unsigned char N>
+  static constexpr unsigned char size(const StateBand (&)[N]) {
+    return N;
+  }
+  template <unsigned char N>
+  static constexpr unsigned char size(const BandTable<N>&) {
+    return N;
+  }
+  template <unsigned char N>
+  static unsigned int upper_at(const StateBand (&bands)[N], unsigned char index) {
+    return pgm_read_word(&bands[index].upper);
+  }
+  template <unsigned char N>
+  static unsigned int upper_at(const BandTable<N>& table, unsigned char index) {
+    return table.bands[index].upper;
+  }
+  template <unsigned char N>
+  static SensorStateLevel state_at(const StateBand (&bands)[N], unsigned char index) {
+    if(index >= N) return SensorStateLevel::INVALID_STATE;
+    return static_cast<SensorStateLevel>(pgm_read_byte(&bands[index].state));
+  }
+  template <unsigned char N>
+  static SensorStateLevel state_at(const BandTable<N>& table, unsigned char index) {
+    if(index >= N) return SensorStateLevel::INVALID_STATE;
+    return table.bands[index].state;
+  }
+  /**
+  * @brief Assigns a raw value the state of the first band whose upper bound is not below it.
+  * @param bands Band table in PROGMEM, sorted by ascending upper bounds, or a BandTable.
+  * @returns SensorStateLevel INVALID_STATE if the value is above the last band.
+  */
+  template <class Bands>
+  static SensorStateLevel classify(const Bands& bands, unsigned int raw) {
+    return state_at(bands, band_index(bands, raw));
+  }
+  /**
+  * @brief Classification with hysteresis around every band boundary.
+  * Leaving the band of the current state requires the raw value to cross the boundary by more than margin, in either direction,
+  * i.e. every boundary B has an enter threshold of B + margin upwards and an exit threshold of B - margin downwards.
+  * @param current The state of the previous classification, INVALID_STATE classifies without hysteresis.
+  * @param margin Width of the hysteresis in raw counts, on each side of a boundary.
+  * @returns SensorStateLevel INVALID_STATE right away if the value is above the last band.
+  */
+  template <class Bands>
+  static SensorStateLevel classify(const Bands& bands, unsigned int raw, SensorStateLevel current, unsigned int margin) {
+    const unsigned char n = size(bands);
+    unsigned char index = band_index(bands, raw);
+    unsigned char current_index = state_index(bands, current);
+    if(index >= n || current_index >= n || index == current_index) return state_at(bands, index);
+    if(index > current_index){
+      unsigned char held = band_index(bands, raw > margin ? raw - margin : 0);
+      if(held > current_index) index = held;
+      else index = current_index;
+    }
+    else{
+      unsigned char held = band_index(bands, raw + margin);
+      if(held < current_index) index = held;
+      else index = current_index;
+    }
+    return state_at(bands, index);
+  }
+  /**
+  * @returns unsigned char Index of the first band whose upper bound is not below raw, the band count if the value is above the last band.
+  */
+  template <class Bands>
+  static unsigned char band_index(const Bands& bands, unsigned int raw) {
+    unsigned char lo = 0;
+    unsigned char hi = size(bands);
+    while(lo < hi){
+      unsigned char mid = (lo + hi) / 2;
+      if(raw <= upper_at(bands, mid)) hi = mid;
+      else lo = mid + 1;
+    }
+    return lo;
+  }
+  /**
+  * @returns unsigned char Index of the band assigned state, the band count if no band is.
+  */
+  template <class Bands>
+  static unsigned char state_index(const Bands& bands, SensorStateLevel state) {
+    const unsigned char n = size(bands);
+    for(unsigned char i = 0; i < n; i++){
+      if(state_at(bands, i) == state) return i;
+    }
+    return n;
+  }
+  /**
+  * @brief Compile-time check for strictly ascending upper bounds, use inside static_assert.
+  */
+  template <unsigned char N>
+  static constexpr bool is_sorted(const StateBand (&bands)[N], unsigned char i = 1) {
+    return i >= N || (bands[i - 1].upper < bands[i].upper && is_sorted(bands, i + 1));
+  }
+  /**
+  * @brief Converts a calibrated threshold to the largest raw value which still maps to a value at or below it, evaluated at compile time.
+  * @param threshold The threshold in the mapped unit, e.g. PH.
+  * @param min The mapped value of a raw reading of 0.
+  * @param max The mapped value of a raw reading of 1023.
+  */
+  static constexpr unsigned int mapped_to_raw(float threshold, float min, float max) {
+    return threshold <= min ? 0 : threshold >= max ? 1023 : static_cast<unsigned int>((threshold - min) * 1023.0f / (max - min));
+  }
+};
+
+#endif
@@ -3,14 +3,15 @@
 
 /**
 * @brief Represents the state of the environmental sensors reading in human readable terms.
+* @note Stored as a single byte, so states fit into flash lookup tables and compact frames.
 */
-enum SensorStateLevel{
+enum SensorStateLevel : unsigned char{
   TOO_LOW = 0,
   DANGER_LOW = 1,
   OK = 2,
   DANGER_HIGH = 3,
   TOO_HIGH = 4,
-  INVALID_STATE = INT32_MAX
+  INVALID_STATE = 5
 };
 
 
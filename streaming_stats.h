@@ -0,0 +1,138 @@
+#ifndef STREAMING_STATS_H
+#define STREAMING_STATS_H
+
+/**
+* @brief Streaming quantile estimate of 10 bit readings in constant memory, the P-square algorithm of Jain and Chlamtac.
+* Five markers track the minimum, the quantile, the maximum and the quantiles halfway in between, their heights are adjusted
+* by a piecewise parabolic interpolation as the readings come in, without storing them. Integer math only, heights in 1/16 counts.
+* @tparam QUANTILE_Q16 The quantile in 1/65536, e.g. 32768 for the median.
+*/
+template <unsigned int QUANTILE_Q16>
+class P2Quantile{
+  static_assert(QUANTILE_Q16 > 0, "The quantile has to be above 0.");
+  static constexpr unsigned char MARKERS = 5;
+  static constexpr unsigned char HEIGHT_SHIFT = 4;
+  static constexpr unsigned long ONE_Q16 = 1UL << 16;
+
+  // Marker heights in 1/16 counts.
+  long height[MARKERS];
+  // Marker positions, 0 based.
+  unsigned int position[MARKERS];
+  // Desired marker positions in 1/65536.
+  unsigned long desired[MARKERS];
+  unsigned int count;
+
+  static unsigned long increment(unsigned char marker) {
+    switch(marker){
+      case 0: return 0;
+      case 1: return QUANTILE_Q16 / 2;
+      case 2: return QUANTILE_Q16;
+      case 3: return (ONE_Q16 + QUANTILE_Q16) / 2;
+      default: return ONE_Q16;
+    }
+  }
+  /**
+  * @returns long The height of marker i moved by d positions on the parabola through it and its neighbours.
+  * The products stay below 2^31, positions are below 2^16 and heights below 2^14.
+  */
+  long parabolic(unsigned char i, int d) const {
+    long below = (long)position[i] - position[i - 1];
+    long above = (long)position[i + 1] - position[i];
+    long upper = (below + d) * (height[i + 1] - height[i]) / above;
+    long lower = (above - d) * (height[i] - height[i - 1]) / below;
+    return height[i] + d * (upper + lower) / (below + above);
+  }
+  long linear(unsigned char i, int d) const {
+    return height[i] + d * (height[i + d] - height[i]) / ((long)position[i + d] - position[i]);
+  }
+public:
+  // Readings taken, further ones are ignored, the positions are 16 bit.
+  static constexpr unsigned int MAX_COUNT = 60000;
+
+  P2Quantile() : height(), position(), desired(), count(0) {}
+
+  void reset() {
+    count = 0;
+  }
+  unsigned int get_count() const {
+    return count;
+  }
+  void push(unsigned int raw) {
+    if(count >= MAX_COUNT) return;
+    long x = (long)raw << HEIGHT_SHIFT;
+    if(count < MARKERS){
+      // Insertion sort of the first readings, they become the initial markers.
+      unsigned char i = count;
+      while(i > 0 && height[i - 1] > x){
+        height[i] = height[i - 1];
+        i--;
+      }
+      height[i] = x;
+      if(++count == MARKERS){
+        for(unsigned char m = 0; m < MARKERS; m++){
+          position[m] = m;
+          desired[m] = 4 * increment(m);
+        }
+      }
+      return;
+    }
+    unsigned char cell;
+    if(x < height[0]){
+      height[0] = x;
+      cell = 0;
+    }
+    else if(x >= height[MARKERS - 1]){
+      height[MARKERS - 1] = x;
+      cell = MARKERS - 2;
+    }
+    else{
+      cell = 0;
+      while(x >= height[cell + 1]) cell++;
+    }
+    for(unsigned char m = cell + 1; m < MARKERS; m++) position[m]++;
+    for(unsigned char m = 0; m < MARKERS; m++) desired[m] += increment(m);
+    count++;
+
+    for(unsigned char i = 1; i < MARKERS - 1; i++){
+      // Unsigned difference, the desired position is close to the actual one.
+      long offset = (long)(desired[i] - ((unsigned long)position[i] << 16));
+      int d;
+      if(offset >= (long)ONE_Q16 && position[i + 1] - position[i] > 1) d = 1;
+      else if(offset <= -(long)ONE_Q16 && position[i] - position[i - 1] > 1) d = -1;
+      else continue;
+      long moved = parabolic(i, d);
+      if(moved <= height[i - 1] || moved >= height[i + 1]) moved = linear(i, d);
+      height[i] = moved;
+      position[i] += d;
+    }
+  }
+  /**
+  * @returns unsigned int The estimated quantile in raw counts, exact for up to 5 readings, 0 without any.
+  */
+  unsigned int value() const {
+    if(count == 0) return 0;
+    unsigned char marker = count < MARKERS ? (unsigned char)(((unsigned long)(count - 1) * QUANTILE_Q16 + ONE_Q16 / 2) >> 16) : 2;
+    return (unsigned int)((height[marker] + (1L << (HEIGHT_SHIFT - 1))) >> HEIGHT_SHIFT);
+  }
+};
+
+/**
+* @brief Running minimum and maximum.
+*/
+struct RunningRange{
+  unsigned int min;
+  unsigned int max;
+
+  RunningRange() : min(0xFFFF), max(0) {}
+
+  void reset() {
+    min = 0xFFFF;
+    max = 0;
+  }
+  void push(unsigned int value) {
+    if(value < min) min = value;
+    if(value > max) max = value;
+  }
+};
+
+#endif
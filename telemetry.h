@@ -0,0 +1,132 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "hal.h"
+#include "config.h"
+#include "sensor_frame.h"
+#include "spsc_ring.h"
+#include "crc16.h"
+
+/**
+* @brief Fixed layout of one binary telemetry record, little-endian on every supported board.
+* @note tools/telemetry_decode.py mirrors this layout, bump Telemetry::VERSION on every change.
+*/
+struct __attribute__((packed)) TelemetryRecord{
+  uint8_t version;
+  // millis() timestamp of the SensorFrame.
+  uint32_t timestamp;
+  uint16_t raw[SENSOR_SLOT_COUNT];
+  uint8_t state[SENSOR_SLOT_COUNT];
+  uint8_t pump_on;
+  // Records lost before this one, wraps at 65536, see Telemetry::send().
+  uint16_t dropped;
+};
+
+/**
+* @brief Framing of telemetry records: record, CRC-16/CCITT-FALSE (little-endian), COBS encoded and terminated by a 0x00 delimiter.
+* COBS guarantees that the delimiter never appears inside a frame, so a receiver resynchronizes on the next 0x00 after any corruption.
+*/
+struct TelemetryFraming{
+  static constexpr unsigned char PAYLOAD_SIZE = sizeof(TelemetryRecord) + 2;
+  // COBS adds one overhead byte per 254 payload bytes, plus the delimiter.
+  static constexpr unsigned char FRAME_SIZE = PAYLOAD_SIZE + 2;
+
+  /**
+  * @brief COBS encodes length bytes (at most 254) of data and appends the 0x00 delimiter.
+  * @param out Receives at least length + 2 bytes.
+  * @returns unsigned char The number of bytes written to out.
+  */
+  static unsigned char cobs_encode(const uint8_t* data, unsigned char length, uint8_t* out) {
+    unsigned char code_index = 0;
+    unsigned char write_index = 1;
+    uint8_t code = 1;
+    for(unsigned char i = 0; i < length; i++){
+      if(data[i] == 0){
+        out[code_index] = code;
+        code_index = write_index++;
+        code = 1;
+      }
+      else{
+        out[write_index++] = data[i];
+        code++;
+      }
+    }
+    out[code_index] = code;
+    out[write_index++] = 0;
+    return write_index;
+  }
+  /**
+  * @brief Builds the complete frame of a record.
+  * @param out Receives FRAME_SIZE bytes at most.
+  * @returns unsigned char The number of bytes written to out.
+  */
+  static unsigned char encode(const TelemetryRecord& record, uint8_t* out) {
+    uint8_t payload[PAYLOAD_SIZE];
+    memcpy(payload, &record, sizeof(TelemetryRecord));
+    uint16_t crc = Crc16::ccitt_false(payload, sizeof(TelemetryRecord));
+    payload[sizeof(TelemetryRecord)] = crc & 0xFF;
+    payload[sizeof(TelemetryRecord) + 1] = crc >> 8;
+    return cobs_encode(payload, PAYLOAD_SIZE, out);
+  }
+};
+
+/**
+* @brief Binary telemetry output with its own TX queue, drained into Serial only as far as the hardware buffer has room, so sending never blocks.
+* @note A frame which does not fit into the queue anymore is dropped as a whole and counted, instead of waiting for room.
+*/
+class Telemetry{
+  // send() is the producer, pump() the consumer, either may move into an ISR, e.g. a UDRE driven transmitter.
+  SpscRing<uint8_t, TELEMETRY_QUEUE_SIZE> queue;
+  unsigned int dropped;
+public:
+  // Layout version of TelemetryRecord.
+  static constexpr uint8_t VERSION = 2;
+
+  Telemetry() : queue(), dropped(0) {}
+
+  /**
+  * @brief Queues a record of the given frame.
+  * @param upstream_dropped Records lost before they reached the telemetry, e.g. in a full RtosQueue, reported along with the ones dropped here.
+  * @returns bool False if the queue had no room and the record was dropped.
+  */
+  bool send(const SensorFrame& frame, bool pump_on, unsigned int upstream_dropped = 0) {
+    TelemetryRecord record;
+    record.version = VERSION;
+    record.timestamp = frame.timestamp;
+    for(unsigned char i = 0; i < SENSOR_SLOT_COUNT; i++){
+      record.raw[i] = frame.raw[i];
+      record.state[i] = (uint8_t)frame.state[i];
+    }
+    record.pump_on = pump_on ? 1 : 0;
+    record.dropped = (uint16_t)(dropped + upstream_dropped);
+
+    uint8_t encoded[TelemetryFraming::FRAME_SIZE];
+    unsigned char length = TelemetryFraming::encode(record, encoded);
+    if(length > queue.free_space()){
+      dropped++;
+      return false;
+    }
+    for(unsigned char i = 0; i < length; i++){
+      queue.push(encoded[i]);
+    }
+    return true;
+  }
+  /**
+  * @brief Moves as many queued bytes into Serial as its TX buffer takes without blocking. Call from loop().
+  */
+  void pump() {
+    int room = Serial.availableForWrite();
+    uint8_t byte;
+    while(room-- > 0 && queue.pop(byte)){
+      Serial.write(byte);
+    }
+  }
+  /**
+  * @returns bool Whether every queued byte has been handed to Serial.
+  */
+  bool is_idle() const {
+    return queue.is_empty();
+  }
+};
+
+#endif
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Compares two captures of the on-device benchmark table (BENCHMARK=1, see benchmark.h).
+
+Capture the Serial output of a benchmark build per commit, e.g. with the Arduino IDE's Serial monitor or:
+    stty -F /dev/ttyUSB0 9600 raw && cat /dev/ttyUSB0 > before.txt
+    benchmark_compare.py before.txt after.txt
+Lines other than the table rows, e.g. the PrintAll() output of its own benchmark, are skipped.
+Exits with status 1 if a benchmark's min cycles grew by more than --threshold percent.
+"""
+import argparse
+import sys
+
+COLUMNS = ("benchmark", "iterations", "min_cycles", "mean_cycles", "max_cycles")
+
+
+def read_table(path):
+    table = {}
+    header = ""
+    with open(path, errors="replace") as capture:
+        for line in capture:
+            line = line.strip()
+            if line.startswith("# F_CPU"):
+                header = line[2:]
+                continue
+            fields = line.split(",")
+            if len(fields) != len(COLUMNS) or fields[0] == COLUMNS[0]:
+                continue
+            try:
+                table[fields[0]] = [int(v) for v in fields[1:]]
+            except ValueError:
+                continue
+    return header, table
+
+
+def change(before, after):
+    if before == 0:
+        return "" if after == 0 else "new"
+    return "%+.1f%%" % (100.0 * (after - before) / before)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("before", help="capture of the baseline build")
+    parser.add_argument("after", help="capture of the changed build")
+    parser.add_argument("--threshold", type=float, default=5.0, help="allowed growth of min cycles in percent")
+    args = parser.parse_args()
+
+    before_header, before = read_table(args.before)
+    after_header, after = read_table(args.after)
+    if before_header != after_header:
+        print("captures differ in clock or counter: '%s' vs '%s'" % (before_header, after_header), file=sys.stderr)
+
+    print("%-24s %10s %10s %8s %10s %10s %8s" % ("benchmark", "min", "min'", "", "mean", "mean'", ""))
+    regressed = False
+    for name in list(before) + [n for n in after if n not in before]:
+        b = before.get(name)
+        a = after.get(name)
+        if b is None or a is None:
+            print("%-24s only in %s" % (name, args.before if a is None else args.after))
+            continue
+        print("%-24s %10d %10d %8s %10d %10d %8s" % (name, b[1], a[1], change(b[1], a[1]), b[2], a[2], change(b[2], a[2])))
+        if b[1] and 100.0 * (a[1] - b[1]) / b[1] > args.threshold:
+            regressed = True
+    sys.exit(1 if regressed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+"""Decodes a dump of the EEPROM log of the controller (EEPROM_LOG=1, serial command 'd', see eeprom_log.h) into CSV.
+
+Reads from a serial port (requires pyserial, sends the 'd' command itself) or from a file/stdin holding a raw capture:
+    eeprom_log_decode.py --port /dev/ttyUSB0 --baud 115200
+    eeprom_log_decode.py capture.bin
+Bytes before the "ELOG" header, e.g. text lines of the controller, are skipped.
+DELTA records without a preceding KEY record, i.e. whose KEY record was overwritten or torn, are reported on stderr and skipped.
+"""
+import argparse
+import sys
+
+# Mirrors LogRecord and LogRecordCodec in eeprom_log.h.
+MAGIC = b"ELOG"
+VERSION = 1
+TYPE_TIME, TYPE_KEY, TYPE_DELTA, TYPE_EVENT, TYPE_EMPTY = 0, 1, 2, 3, 7
+RAW_BITS = 10
+STATE_BITS = 3
+DT_BITS = 12
+BOOT_FLAG = 0x80
+RAW_SLOTS = ("soil_moisture", "water_level", "water_detection")
+STATE_SLOTS = ("soil_moisture", "ph", "water_level", "water_detection")
+STATES = ("TOO_LOW", "DANGER_LOW", "OK", "DANGER_HIGH", "TOO_HIGH", "INVALID_STATE")
+EVENTS = {1: "PUMP_ON", 2: "PUMP_OFF", 3: "PUMP_ABORTED", 4: "OVERFLOW"}
+RESET_CAUSES = ((0x01, "power-on"), (0x02, "external"), (0x04, "brown-out"), (0x08, "watchdog"))
+
+
+def get_bits(payload, offset, width):
+    return (int.from_bytes(payload, "little") >> offset) & ((1 << width) - 1)
+
+
+def signed8(value):
+    return value - 256 if value > 127 else value
+
+
+def states(payload, offset):
+    return [get_bits(payload, offset + i * STATE_BITS, STATE_BITS) for i in range(len(STATE_SLOTS))]
+
+
+def state_name(state):
+    return STATES[state] if state < len(STATES) else str(state)
+
+
+def reset_cause(flags):
+    names = [name for bit, name in RESET_CAUSES if flags & bit]
+    return "+".join(names) if names else "unknown"
+
+
+def read_exactly(stream, count):
+    data = bytearray()
+    while len(data) < count:
+        chunk = stream.read(count - len(data))
+        if not chunk:
+            raise EOFError("capture ends after %d of %d bytes" % (len(data), count))
+        data += chunk
+    return bytes(data)
+
+
+def read_dump(stream):
+    window = b""
+    while window != MAGIC:
+        byte = stream.read(1)
+        if not byte:
+            raise EOFError("no ELOG header in the capture")
+        window = (window + byte)[-len(MAGIC):]
+    version, size, count, dropped_low, dropped_high = read_exactly(stream, 5)
+    if version != VERSION:
+        raise ValueError("unsupported version %d" % version)
+    records = [read_exactly(stream, size) for _ in range(count)]
+    return records, dropped_low | dropped_high << 8
+
+
+class Decoder:
+    def __init__(self):
+        self.boot = None
+        self.time_s = None
+        self.raw = None
+
+    def decode(self, record):
+        """Returns the CSV row of a record, None for records adding no row."""
+        kind = record[1] >> 5
+        pump_on = (record[1] >> 4) & 1
+        payload = record[2:]
+        empty = [""] * (len(RAW_SLOTS) + len(STATE_SLOTS))
+        if kind == TYPE_TIME:
+            self.boot = payload[4]
+            self.time_s = get_bits(payload, 0, 32)
+            self.raw = None
+            if payload[5] & BOOT_FLAG:
+                return [self.boot, self.time_s, "boot"] + empty + ["", "", reset_cause(payload[5])]
+            return None
+        if kind == TYPE_KEY:
+            if self.time_s is None:
+                raise ValueError("KEY record without TIME record")
+            self.raw = [get_bits(payload, i * RAW_BITS, RAW_BITS) for i in range(len(RAW_SLOTS))]
+            return self.frame_row(states(payload, len(RAW_SLOTS) * RAW_BITS), pump_on)
+        if kind == TYPE_DELTA:
+            if self.raw is None:
+                raise ValueError("DELTA record without KEY record")
+            self.time_s += get_bits(payload, 0, DT_BITS)
+            for i in range(len(RAW_SLOTS)):
+                self.raw[i] += signed8(get_bits(payload, DT_BITS + i * 8, 8))
+            return self.frame_row(states(payload, DT_BITS + len(RAW_SLOTS) * 8), pump_on)
+        if kind == TYPE_EVENT:
+            event = EVENTS.get(payload[4], str(payload[4]))
+            return [self.boot if self.boot is not None else "", get_bits(payload, 0, 32), "event"] + empty + [pump_on, event, payload[5]]
+        if kind == TYPE_EMPTY:
+            return None
+        raise ValueError("unknown record type %d" % kind)
+
+    def frame_row(self, frame_states, pump_on):
+        return [self.boot, self.time_s, "frame"] + self.raw + [state_name(s) for s in frame_states] + [pump_on, "", ""]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", nargs="?", help="raw capture to decode, '-' or omitted for stdin")
+    parser.add_argument("--port", help="serial port to request the dump from instead of a file")
+    parser.add_argument("--baud", type=int, default=115200)
+    args = parser.parse_args()
+
+    if args.port:
+        import serial
+        stream = serial.Serial(args.port, args.baud, timeout=5)
+        stream.write(b"d")
+    elif args.file and args.file != "-":
+        stream = open(args.file, "rb")
+    else:
+        stream = sys.stdin.buffer
+
+    try:
+        records, dropped = read_dump(stream)
+    except (EOFError, ValueError) as error:
+        print("no dump: %s" % error, file=sys.stderr)
+        sys.exit(1)
+    if dropped:
+        print("%d records were dropped by the controller, the staging buffer was full" % dropped, file=sys.stderr)
+
+    header = ["boot", "uptime_s", "kind"] + ["%s_raw" % s for s in RAW_SLOTS] + ["%s_state" % s for s in STATE_SLOTS]
+    print(",".join(header + ["pump_on", "event", "argument"]))
+    decoder = Decoder()
+    for index, record in enumerate(records):
+        try:
+            row = decoder.decode(record)
+        except ValueError as error:
+            print("skipped record %d: %s" % (index, error), file=sys.stderr)
+            continue
+        if row is not None:
+            print(",".join(str(v) for v in row))
+
+
+if __name__ == "__main__":
+    main()
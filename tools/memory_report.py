@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Breaks the static SRAM and flash usage of a firmware build down by subsystem, and checks it against a budget.
+
+Reads the symbol table of the ELF file via avr-nm (part of the AVR toolchain shipped with the Arduino IDE):
+    arduino-cli compile -b arduino:avr:nano --output-dir build .
+    memory_report.py build/main.c.ino.elf
+    memory_report.py --sram-budget 1536 build/main.c.ino.elf
+Exits with status 1 if the static SRAM or the flash usage exceeds its budget, so a build script catches regressions early.
+The SRAM not used statically is left for the stack, keep a few hundred bytes of it.
+Totals are the sum of the symbol sizes, somewhat below what avr-size reports, which includes the padding between them.
+"""
+import argparse
+import re
+import subprocess
+import sys
+
+# Start of the data address space in AVR ELF files, everything below is flash.
+RAM_OFFSET = 0x800000
+
+# First match wins, matched against the demangled symbol name.
+SUBSYSTEMS = (
+    ("sensors", r"AdcAcquisition|AnalogSensor|MedianFilter|Oversampling|StateBands|_BANDS|SensorPower|AcquisitionSequence"
+                r"|I2cSensor|EzoPh|TwiMaster|FixedMap|AnalogMux|MuxSelectLine|OverflowGuard|__vector_(21|23|24)\b"
+                r"|Calibration|CalibratedBands|BandTable|P2Quantile|RunningRange|start_capture|\bcalibrate\b|calibration_command"
+                r"|SensorHealth|WelfordVariance|MoistureCrossCheck|HEALTH_NAME|AnalogChannel|I2cChannel|ConstantChannel|SensorDebounce"),
+    ("decider", r"ActionDecider|DecisionTable|WateringRules|ZoneController|AdaptiveInterval|\bad\b|\bzones\b|\bsampling\b"),
+    ("telemetry", r"Telemetry|\btelemetry\b|FlashStrings|STATE_NAME|log_message|print_all|report|Instrumentation|LatencyHistogram|poll_commands"
+                  r"|EepromLog|LogRecord|EepromStore|Crc16|__vector_22\b"),
+    ("pump", r"DosingEngine|PumpDriver|FastPin|__vector_(2|11)\b"),
+    ("scheduling", r"Scheduler|\bscheduler\b|PowerManager|WarmBoot|warm_boot|wait_for_host|schedule_first_sample|_task\b|__vector_6\b|\b(acquire|sample|decide|pump_off|watering_monitor|scan)\b"),
+    ("core", r"Serial|Print|Stream|timer0_|millis|micros|delay|\bmain\b|\binit\b|setup|loop|__vector|^__|^_"),
+)
+
+
+def read_symbols(elf, nm):
+    output = subprocess.run([nm, "-C", "-S", "--size-sort", elf], check=True, capture_output=True, text=True).stdout
+    for line in output.splitlines():
+        parts = line.split(None, 3)
+        if len(parts) < 4:
+            continue
+        address, size, kind, name = int(parts[0], 16), int(parts[1], 16), parts[2], parts[3]
+        yield address, size, kind, name
+
+
+def subsystem_of(name):
+    for subsystem, pattern in SUBSYSTEMS:
+        if re.search(pattern, name):
+            return subsystem
+    return "other"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("elf", help="firmware ELF file")
+    parser.add_argument("--nm", default="avr-nm", help="nm of the toolchain the firmware was built with")
+    parser.add_argument("--sram-budget", type=int, default=2048, help="static SRAM budget in bytes, ATmega328P: 2048")
+    parser.add_argument("--flash-budget", type=int, default=30720, help="flash budget in bytes, ATmega328P with Optiboot: 32256, old bootloader: 30720")
+    parser.add_argument("--symbols", action="store_true", help="list every symbol with its subsystem")
+    args = parser.parse_args()
+
+    totals = {}
+    listing = []
+    for address, size, kind, name in read_symbols(args.elf, args.nm):
+        subsystem = subsystem_of(name)
+        sram, flash = 0, 0
+        if address >= RAM_OFFSET:
+            sram = size
+            # Initialized data is copied from flash at startup, it costs both.
+            if kind in "dD":
+                flash = size
+        else:
+            flash = size
+        entry = totals.setdefault(subsystem, [0, 0])
+        entry[0] += sram
+        entry[1] += flash
+        listing.append((subsystem, sram, flash, name))
+
+    if args.symbols:
+        for subsystem, sram, flash, name in sorted(listing):
+            print("%-11s %6d %6d  %s" % (subsystem, sram, flash, name))
+        print()
+
+    order = [s for s, _ in SUBSYSTEMS] + ["other"]
+    print("%-11s %8s %8s" % ("subsystem", "sram", "flash"))
+    for subsystem in order:
+        if subsystem in totals:
+            print("%-11s %8d %8d" % (subsystem, totals[subsystem][0], totals[subsystem][1]))
+    sram_total = sum(v[0] for v in totals.values())
+    flash_total = sum(v[1] for v in totals.values())
+    print("%-11s %8d %8d" % ("total", sram_total, flash_total))
+    print("%-11s %8d %8d" % ("budget", args.sram_budget, args.flash_budget))
+    print("%-11s %8d %8d" % ("headroom", args.sram_budget - sram_total, args.flash_budget - flash_total))
+
+    over = False
+    if sram_total > args.sram_budget:
+        print("static SRAM exceeds the budget by %d bytes" % (sram_total - args.sram_budget), file=sys.stderr)
+        over = True
+    if flash_total > args.flash_budget:
+        print("flash exceeds the budget by %d bytes" % (flash_total - args.flash_budget), file=sys.stderr)
+        over = True
+    sys.exit(1 if over else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+"""Decodes the binary telemetry of the controller (TELEMETRY_MODE == TELEMETRY_BINARY) into CSV.
+
+Reads from a serial port (requires pyserial) or from a file/stdin holding a raw capture:
+    telemetry_decode.py --port /dev/ttyUSB0 --baud 115200
+    telemetry_decode.py capture.bin
+Frames failing the COBS decoding, the length or the CRC check are reported on stderr and skipped.
+"""
+import argparse
+import struct
+import sys
+
+# Mirrors TelemetryRecord in telemetry.h.
+RECORD_VERSION = 2
+RECORD_FORMAT = "<BI4H4BBH"
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+SLOTS = ("soil_moisture", "ph", "water_level", "water_detection")
+STATES = ("TOO_LOW", "DANGER_LOW", "OK", "DANGER_HIGH", "TOO_HIGH", "INVALID_STATE")
+
+
+def crc16_ccitt_false(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_decode(frame):
+    out = bytearray()
+    i = 0
+    while i < len(frame):
+        code = frame[i]
+        if code == 0 or i + code > len(frame) + 1:
+            raise ValueError("invalid COBS code")
+        out += frame[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(frame):
+            out.append(0)
+    return bytes(out)
+
+
+def decode_frame(frame):
+    payload = cobs_decode(frame)
+    if len(payload) != RECORD_SIZE + 2:
+        raise ValueError("unexpected length %d" % len(payload))
+    record, crc = payload[:RECORD_SIZE], struct.unpack("<H", payload[RECORD_SIZE:])[0]
+    if crc16_ccitt_false(record) != crc:
+        raise ValueError("CRC mismatch")
+    fields = struct.unpack(RECORD_FORMAT, record)
+    if fields[0] != RECORD_VERSION:
+        raise ValueError("unsupported version %d" % fields[0])
+    return {
+        "timestamp": fields[1],
+        "raw": fields[2:6],
+        "state": fields[6:10],
+        "pump_on": fields[10],
+        "dropped": fields[11],
+    }
+
+
+def frames(stream):
+    buffer = bytearray()
+    while True:
+        chunk = stream.read(64)
+        if not chunk:
+            return
+        for byte in chunk:
+            if byte == 0:
+                if buffer:
+                    yield bytes(buffer)
+                buffer.clear()
+            else:
+                buffer.append(byte)
+
+
+def state_name(state):
+    return STATES[state] if state < len(STATES) else str(state)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", nargs="?", help="raw capture to decode, '-' or omitted for stdin")
+    parser.add_argument("--port", help="serial port to read from instead of a file")
+    parser.add_argument("--baud", type=int, default=115200)
+    args = parser.parse_args()
+
+    if args.port:
+        import serial
+        stream = serial.Serial(args.port, args.baud)
+    elif args.file and args.file != "-":
+        stream = open(args.file, "rb")
+    else:
+        stream = sys.stdin.buffer
+
+    header = ["timestamp_ms"] + ["%s_raw" % s for s in SLOTS] + ["%s_state" % s for s in SLOTS] + ["pump_on", "dropped"]
+    print(",".join(header))
+    for frame in frames(stream):
+        try:
+            record = decode_frame(frame)
+        except ValueError as error:
+            print("skipped frame: %s" % error, file=sys.stderr)
+            continue
+        row = [str(record["timestamp"])] + [str(v) for v in record["raw"]]
+        row += [state_name(s) for s in record["state"]] + [str(record["pump_on"]), str(record["dropped"])]
+        print(",".join(row))
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
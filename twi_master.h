@@ -0,0 +1,180 @@
+#ifndef TWI_MASTER_H
+#define TWI_MASTER_H
+
+#include "config.h"
+
+#if I2C_SENSORS_ENABLED
+
+#include <util/atomic.h>
+
+/**
+* @brief Interrupt driven, non-blocking I2C master on the ATmega328P TWI (SDA A4, SCL A5), replaces the blocking Wire library.
+* A transaction is started by start_write() or start_read() and completes in the TWI ISR, one interrupt per bus event.
+* The caller polls get_status() and releases the bus via release() once it has taken the result, so only one transaction runs at a time.
+* @note The internal pull-ups are far too weak for 100kHz, the bus needs external 4.7k pull-ups.
+*/
+class TwiMaster{
+public:
+  enum Status{
+    IDLE = 0,
+    BUSY = 1,
+    DONE = 2,
+    FAILED = 3
+  };
+  // Longest write, commands of the supported sensors are a few bytes only.
+  static constexpr unsigned char TX_SIZE = 8;
+private:
+  // Status codes of TWSR, prescaler bits masked.
+  enum Code{
+    CODE_START = 0x08,
+    CODE_REPEATED_START = 0x10,
+    CODE_SLA_W_ACK = 0x18,
+    CODE_SLA_W_NACK = 0x20,
+    CODE_DATA_W_ACK = 0x28,
+    CODE_DATA_W_NACK = 0x30,
+    CODE_ARBITRATION_LOST = 0x38,
+    CODE_SLA_R_ACK = 0x40,
+    CODE_SLA_R_NACK = 0x48,
+    CODE_DATA_R_ACK = 0x50,
+    CODE_DATA_R_NACK = 0x58
+  };
+
+  static volatile Status status;
+  // SLA+R/W byte of the running transaction.
+  static volatile uint8_t sla;
+  static uint8_t tx[TX_SIZE];
+  static uint8_t* volatile rx;
+  static volatile unsigned char length;
+  static volatile unsigned char index;
+
+  static void reply(bool ack) {
+    TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | (ack ? _BV(TWEA) : 0);
+  }
+  static void stop(Status result) {
+    // The STOP condition completes without an interrupt, start() waits for TWSTO to clear.
+    TWCR = _BV(TWEN) | _BV(TWINT) | _BV(TWSTO);
+    status = result;
+  }
+  static bool start(uint8_t address_byte, unsigned char count) {
+    if(status != IDLE || (TWCR & _BV(TWSTO))) return false;
+    sla = address_byte;
+    length = count;
+    index = 0;
+    status = BUSY;
+    TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWSTA);
+    return true;
+  }
+public:
+  /**
+  * @brief Enables the TWI at I2C_CLOCK_HZ, call once from setup().
+  */
+  static void begin() {
+    // Prescaler 1, SCL = F_CPU / (16 + 2 * TWBR).
+    TWSR = 0;
+    TWBR = ((F_CPU / I2C_CLOCK_HZ) - 16) / 2;
+    TWCR = _BV(TWEN);
+  }
+  /**
+  * @brief Starts writing count bytes to the device, the bytes are copied.
+  * @returns bool False if the bus is not idle, retry later.
+  */
+  static bool start_write(uint8_t address, const uint8_t* data, unsigned char count) {
+    if(count == 0 || count > TX_SIZE || status != IDLE) return false;
+    for(unsigned char i = 0; i < count; i++) tx[i] = data[i];
+    rx = 0;
+    return start(address << 1, count);
+  }
+  /**
+  * @brief Starts reading count bytes from the device into buffer, which has to stay valid until the transaction ended.
+  * @returns bool False if the bus is not idle, retry later.
+  */
+  static bool start_read(uint8_t address, uint8_t* buffer, unsigned char count) {
+    if(count == 0 || status != IDLE) return false;
+    rx = buffer;
+    return start((address << 1) | 1, count);
+  }
+  static Status get_status() {
+    return status;
+  }
+  /**
+  * @brief Hands the bus back after a DONE or FAILED transaction.
+  */
+  static void release() {
+    if(status == DONE || status == FAILED) status = IDLE;
+  }
+  /**
+  * @brief Aborts a stuck transaction, e.g. a device holding SDA low, and re-initializes the TWI. The transaction ends as FAILED.
+  */
+  static void reset() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+      TWCR = 0;
+      TWCR = _BV(TWEN);
+      status = FAILED;
+    }
+  }
+  /**
+  * @returns bool Whether no transaction runs, power-down would stop the TWI clock in the middle of one.
+  */
+  static bool is_idle() {
+    return status != BUSY;
+  }
+  /**
+  * @brief Called from the TWI ISR only.
+  */
+  static void on_event() {
+    switch(TWSR & 0xF8){
+      case CODE_START:
+      case CODE_REPEATED_START:
+        TWDR = sla;
+        reply(false);
+        break;
+      case CODE_SLA_W_ACK:
+      case CODE_DATA_W_ACK:
+        if(index < length){
+          TWDR = tx[index++];
+          reply(false);
+        }
+        else stop(DONE);
+        break;
+      case CODE_SLA_R_ACK:
+        // Acknowledge every byte but the last one.
+        reply(length > 1);
+        break;
+      case CODE_DATA_R_ACK:
+        rx[index++] = TWDR;
+        reply(index + 1 < length);
+        break;
+      case CODE_DATA_R_NACK:
+        rx[index++] = TWDR;
+        stop(DONE);
+        break;
+      case CODE_ARBITRATION_LOST:
+        // Release the bus without a STOP.
+        TWCR = _BV(TWEN) | _BV(TWINT);
+        status = FAILED;
+        break;
+      case CODE_SLA_W_NACK:
+      case CODE_DATA_W_NACK:
+      case CODE_SLA_R_NACK:
+      default:
+        // No device, a rejected byte, or a bus error.
+        stop(FAILED);
+        break;
+    }
+  }
+};
+
+volatile TwiMaster::Status TwiMaster::status = TwiMaster::IDLE;
+volatile uint8_t TwiMaster::sla = 0;
+uint8_t TwiMaster::tx[TwiMaster::TX_SIZE];
+uint8_t* volatile TwiMaster::rx = 0;
+volatile unsigned char TwiMaster::length = 0;
+volatile unsigned char TwiMaster::index = 0;
+
+ISR(TWI_vect) {
+  TwiMaster::on_event();
+}
+
+#endif
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef WARM_BOOT_H
+#define WARM_BOOT_H
+
+#include "hal.h"
+#include "config.h"
+#include "sensor_frame.h"
+#include "eeprom_store.h"
+
+#if defined(__AVR_ATmega328P__)
+
+#include <avr/wdt.h>
+
+// MCUSR at reset, outside .bss, the C runtime clears .bss after init3.
+uint8_t warm_boot_reset_flags __attribute__((section(".noinit")));
+
+/**
+* @brief Runs in init3, before the C runtime initializes the RAM and long before setup().
+* Saves and clears the reset flags, and disables the watchdog: after a watchdog reset it stays enabled at its shortest period, and would reset the MCU again before setup() ran.
+* @note Bootloaders which clear MCUSR themselves, like the Optiboot of the Uno, leave the flags at 0, a cold boot.
+*/
+void warm_boot_capture_reset() __attribute__((naked, used, section(".init3")));
+void warm_boot_capture_reset() {
+  warm_boot_reset_flags = MCUSR;
+  MCUSR = 0;
+  wdt_disable();
+}
+
+#endif
+
+/**
+* @brief Controller state kept in the EEPROM at WARM_BOOT_ADDRESS, so a reset in the middle of a watering cycle does not water again right away.
+*/
+class WarmBoot{
+public:
+  enum Phase{
+    PHASE_IDLE = 0,
+    // The pump ran, the dose is lost with a reset.
+    PHASE_WATERING = 1,
+    // Within the after-watering delay.
+    PHASE_SETTLING = 2
+  };
+  /**
+  * @brief Layout in the EEPROM, followed by its CRC, see EepromStore. Bump VERSION on every change.
+  */
+  struct State{
+    uint8_t version;
+    uint8_t phase;
+    // Debounced states of the ActionDecider, SensorSlot order.
+    uint8_t states[SENSOR_SLOT_COUNT];
+  };
+  static constexpr uint8_t VERSION = 1;
+#if WARM_BOOT && EEPROM_LOG
+  static_assert(WARM_BOOT_ADDRESS + EepromStore::size<State>() <= EEPROM_LOG_START, "The warm boot state overlaps the EEPROM log.");
+#endif
+  /**
+  * @returns uint8_t The reset flags of MCUSR (PORF, EXTRF, BORF, WDRF), 0 if unknown.
+  */
+  static uint8_t reset_flags() {
+#if defined(__AVR_ATmega328P__)
+    return warm_boot_reset_flags;
+#else
+    return 0;
+#endif
+  }
+  /**
+  * @returns bool Whether the MCU was reset while powered, by the watchdog, a brown-out or the reset pin.
+  * RAM state is at most a few ms old then, a power-on reset may follow an outage of any length.
+  */
+  static bool is_warm_reset() {
+#if defined(__AVR_ATmega328P__)
+    uint8_t flags = reset_flags();
+    return flags != 0 && !(flags & _BV(PORF));
+#else
+    return false;
+#endif
+  }
+  /**
+  * @brief Reads the state saved before the reset.
+  * @returns bool False if there is none, the CRC or the version does not match, or WARM_BOOT is disabled.
+  */
+  static bool load(State& state) {
+#if WARM_BOOT
+    if(!EepromStore::load(WARM_BOOT_ADDRESS, state) || state.version != VERSION) return false;
+    for(unsigned char i = 0; i < SENSOR_SLOT_COUNT; i++){
+      if(state.states[i] > (uint8_t)SensorStateLevel::INVALID_STATE) return false;
+    }
+    return true;
+#else
+    (void)state;
+    return false;
+#endif
+  }
+  /**
+  * @brief Saves the phase and the debounced states of the frame. Only the bytes which changed are written, none if nothing did.
+  * @note Blocks for 3.4ms per written byte, the DosingEngine times the pump independently of loop().
+  */
+  static void save(Phase phase, const SensorFrame& frame) {
+#if WARM_BOOT
+    State state;
+    state.version = VERSION;
+    state.phase = phase;
+    for(unsigned char i = 0; i < SENSOR_SLOT_COUNT; i++) state.states[i] = (uint8_t)frame.state[i];
+    EepromStore::save(WARM_BOOT_ADDRESS, state);
+#else
+    (void)phase;
+    (void)frame;
+#endif
+  }
+};
+
+#endif
@@ -0,0 +1,281 @@
+#ifndef ZONE_CONTROLLER_H
+#define ZONE_CONTROLLER_H
+
+#include "hal.h"
+#include "config.h"
+
+#if MULTI_ZONE
+
+#include "analog_sensors.h"
+#include "analog_mux.h"
+#include "decision_table.h"
+#include "pump_driver.h"
+#include "sensor_channel.h"
+
+/**
+* @brief Waters several pots from one board, the multi-zone counterpart of ActionDecider.
+* Every zone has a soil moisture and a water detection sensor behind an AnalogMux, zone z on channels 2z (soil) and 2z + 1 (detection),
+* and its own pump on pin FIRST_PUMP_PIN + z, see PumpBank. All zones share one reservoir with a WaterLevelSensor on RESERVOIR_PIN.
+* The per-zone data is kept as a structure of arrays, one array per field indexed by zone.
+* Scan() reads one mux channel per call and switches to the next one right away, so the mux and the ADC settle while the caller waits for the next call.
+* After every full scan the states are debounced as in a SensorChannel, each zone runs the WateringRules,
+* and the pump arbiter runs at most MAX_PUMPS pumps at a time, granting waiting zones round robin.
+* @tparam ZONES Number of zones, at most Mux::CHANNELS / 2.
+* @tparam Mux The AnalogMux the zone sensors are wired to.
+* @tparam FIRST_PUMP_PIN The pump pin of zone 0, the others follow on consecutive pins.
+* @tparam MAX_PUMPS Number of pumps the supply drives at the same time.
+*/
+template <unsigned char ZONES, class Mux, unsigned char FIRST_PUMP_PIN, unsigned char MAX_PUMPS>
+class ZoneController{
+public:
+  enum ZonePhase{
+    ZONE_IDLE = 0,
+    // The rules ask for water, waiting for the arbiter to grant a pump.
+    ZONE_WAITING = 1,
+    ZONE_WATERING = 2
+  };
+private:
+  static_assert(ZONES > 0 && 2 * ZONES <= Mux::CHANNELS, "Every zone needs two mux channels.");
+  static_assert(MAX_PUMPS > 0, "At least one pump has to be able to run.");
+
+  static constexpr unsigned char CHANNEL_COUNT = 2 * ZONES;
+  static constexpr unsigned char RESERVOIR_PIN = A3;
+
+  // The zone sensors share the common pin of the mux, the sensor types only provide filtering, thresholds and printing.
+  typedef SoilMoistureSensor<Mux::PIN_NUMBER> SoilBank;
+  typedef WaterDetectionSensor<Mux::PIN_NUMBER> DetectionBank;
+  typedef WaterLevelSensor<RESERVOIR_PIN> Reservoir;
+  typedef PumpBank<FIRST_PUMP_PIN, ZONES> Pumps;
+  // The common pin is converted with the soil sensors resolution, the detection readings are rounded from it.
+  static constexpr unsigned char SCAN_BITS = SoilBank::OVERSAMPLE_BITS;
+
+  typedef DecisionTable<WateringRules> Table;
+  static_assert(Table::matches_rules(), "The packed decision table does not read back as WateringRules.");
+
+  static constexpr bool pumps_collide(unsigned char zone = 0) {
+    return zone < ZONES && (Mux::uses_pin(FIRST_PUMP_PIN + zone) || pumps_collide(zone + 1));
+  }
+  static_assert(!pumps_collide(), "A zone pump pin is also a mux select line.");
+
+  unsigned long pump_on_ms;
+  unsigned long after_water_ms;
+  unsigned long pump_off_ms;
+
+  // Structure of arrays, one entry per zone.
+  MedianFilter<SoilBank::MEDIAN_WINDOW> soil_filter[ZONES];
+  unsigned int soil_raw[ZONES];
+  SensorDebounce soil_state[ZONES];
+  unsigned int detection_raw[ZONES];
+  SensorDebounce detection_state[ZONES];
+  // Water detection state at the start of the watering, see ActionDecider::CheckWatering().
+  SensorStateLevel start_detection[ZONES];
+  unsigned char phase[ZONES];
+  // Start of the watering in ZONE_WATERING, the time the next decision is due at otherwise.
+  uint32_t phase_ms[ZONES];
+
+  MedianFilter<Reservoir::MEDIAN_WINDOW> reservoir_filter;
+  unsigned int reservoir_raw;
+  SensorDebounce reservoir_state;
+
+  // Mux channel settling for the next Scan().
+  unsigned char channel;
+#if ADC_ISR_ACQUISITION
+  // AdcAcquisition sweep at the mux switch.
+  unsigned char sweep_mark;
+#endif
+  // Full scans so far, saturating at the median window, decisions wait for full median filters.
+  unsigned char scans;
+  unsigned char running;
+  // Zone the arbiter grants a pump to first.
+  unsigned char next_grant;
+
+  /**
+  * @brief Classifies a reading with the hysteresis of Sensor against the debounced state, and debounces it with its CONFIRM_SAMPLES, as AnalogChannel::sample().
+  */
+  template <class Sensor>
+  static void debounce(SensorDebounce& state, unsigned int raw) {
+    state.update(Sensor::classify(raw, state.stable), Sensor::CONFIRM_SAMPLES);
+  }
+  void switch_channel(unsigned char next) {
+    this->channel = next;
+    Mux::select(next);
+#if ADC_ISR_ACQUISITION
+    this->sweep_mark = AdcAcquisition::get_sequence();
+#else
+    // Throw one conversion away, charges the sample-and-hold capacitor to the new channel.
+    analogRead(Mux::PIN_NUMBER);
+#endif
+  }
+  void stop_watering(unsigned char zone, uint32_t now) {
+    Pumps::set(zone, false);
+    this->running--;
+    this->phase[zone] = ZONE_IDLE;
+    this->phase_ms[zone] = now + this->after_water_ms;
+  }
+  /**
+  * @brief The decision of the rules, except with CLOSED_LOOP_WATERING for a zone at the target already, its watering would stop right after the start.
+  */
+  bool wants_water(unsigned char zone) const {
+    SensorStateLevel soil = this->soil_state[zone].stable;
+    return Table::lookup(soil, SensorStateLevel::OK, this->reservoir_state.stable, this->detection_state[zone].stable)
+      && !(CLOSED_LOOP_WATERING && (int)soil >= (int)SensorStateLevel::OK);
+  }
+  /**
+  * @brief Stops after pump_on_ms, on an invalid sensor or an empty reservoir.
+  * With CLOSED_LOOP_WATERING also as ActionDecider::CheckWatering(), once the soil reached the target or water reaches the bottom of the pot.
+  */
+  bool watering_done(unsigned char zone, uint32_t now) const {
+    SensorStateLevel soil = this->soil_state[zone].stable;
+    SensorStateLevel detection = this->detection_state[zone].stable;
+    SensorStateLevel reservoir = this->reservoir_state.stable;
+    if(now - this->phase_ms[zone] >= this->pump_on_ms) return true;
+    if(soil == SensorStateLevel::INVALID_STATE || detection == SensorStateLevel::INVALID_STATE) return true;
+    if(reservoir == SensorStateLevel::TOO_LOW || reservoir == SensorStateLevel::INVALID_STATE) return true;
+    if(!CLOSED_LOOP_WATERING) return false;
+    if(this->start_detection[zone] == SensorStateLevel::OK && detection == SensorStateLevel::TOO_HIGH) return true;
+    return (int)soil >= (int)SensorStateLevel::OK;
+  }
+  /**
+  * @brief Classifies and debounces the readings of the finished scan, and runs the zones and the pump arbiter.
+  */
+  void end_scan(uint32_t now) {
+    this->reservoir_filter.push(Reservoir().read_oversampled());
+    this->reservoir_raw = Oversampling::to_raw(this->reservoir_filter.median(), Reservoir::OVERSAMPLE_BITS);
+    debounce<Reservoir>(this->reservoir_state, this->reservoir_raw);
+    for(unsigned char z = 0; z < ZONES; z++){
+      this->soil_raw[z] = Oversampling::to_raw(this->soil_filter[z].median(), SCAN_BITS);
+      debounce<SoilBank>(this->soil_state[z], this->soil_raw[z]);
+      debounce<DetectionBank>(this->detection_state[z], this->detection_raw[z]);
+    }
+    if(this->scans < SoilBank::MEDIAN_WINDOW){
+      this->scans++;
+      return;
+    }
+
+    for(unsigned char z = 0; z < ZONES; z++){
+      switch(this->phase[z]){
+        case ZONE_WATERING:
+          if(this->watering_done(z, now)) this->stop_watering(z, now);
+          break;
+        case ZONE_WAITING:
+          // The conditions may have changed while waiting, e.g. the reservoir ran low.
+          if(!this->wants_water(z)){
+            this->phase[z] = ZONE_IDLE;
+            this->phase_ms[z] = now + this->pump_off_ms;
+          }
+          break;
+        default:
+          if((int32_t)(now - this->phase_ms[z]) < 0) break;
+          if(this->wants_water(z)) this->phase[z] = ZONE_WAITING;
+          else this->phase_ms[z] = now + this->pump_off_ms;
+          break;
+      }
+    }
+
+    // Round robin, so a zone which keeps asking for water cannot starve the others.
+    for(unsigned char i = 0; i < ZONES && this->running < MAX_PUMPS; i++){
+      unsigned char z = (this->next_grant + i) % ZONES;
+      if(this->phase[z] != ZONE_WAITING) continue;
+      this->phase[z] = ZONE_WATERING;
+      this->phase_ms[z] = now;
+      this->start_detection[z] = this->detection_state[z].stable;
+      this->running++;
+      Pumps::set(z, true);
+      this->next_grant = (z + 1) % ZONES;
+    }
+  }
+public:
+  /**
+  * @param pump_on_ms Longest watering of a zone, the watering stops earlier once the zone reached its target or overflows.
+  * @param after_water_ms Delay after a watering before the next decision of the zone.
+  * @param pump_off_ms Delay after a decision against watering before the next decision of the zone.
+  */
+  ZoneController(unsigned long pump_on_ms, unsigned long after_water_ms, unsigned long pump_off_ms)
+  : pump_on_ms(pump_on_ms),
+    after_water_ms(after_water_ms),
+    pump_off_ms(pump_off_ms),
+    soil_filter(),
+    soil_raw(),
+    soil_state(),
+    detection_raw(),
+    detection_state(),
+    start_detection(),
+    phase(),
+    phase_ms(),
+    reservoir_filter(),
+    reservoir_raw(0),
+    reservoir_state(),
+    channel(0),
+#if ADC_ISR_ACQUISITION
+    sweep_mark(0),
+#endif
+    scans(0),
+    running(0),
+    next_grant(0)
+    {}
+  /**
+  * @brief Sets up the mux, the pumps and the acquisition, call once from setup().
+  */
+  void Begin(){
+    Pumps::begin();
+    Mux::begin();
+#if ADC_ISR_ACQUISITION
+    const unsigned char pins[2] = { Mux::PIN_NUMBER, RESERVOIR_PIN };
+    const unsigned char bits[2] = { SCAN_BITS, Reservoir::OVERSAMPLE_BITS };
+    AdcAcquisition::begin(pins, bits, 2);
+#endif
+    this->switch_channel(0);
+  }
+  /**
+  * @brief Reads the settled mux channel and switches to the next one. Call periodically, a whole scan takes 2 * ZONES calls.
+  */
+  void Scan(){
+#if ADC_ISR_ACQUISITION
+    // The sweep in progress at the switch may have converted the previous channel, wait for the one after it.
+    if((unsigned char)(AdcAcquisition::get_sequence() - this->sweep_mark) < 2) return;
+#endif
+    unsigned int value = SoilBank().read_oversampled();
+    unsigned char zone = this->channel / 2;
+    if(this->channel % 2 == 0) this->soil_filter[zone].push(value);
+    else this->detection_raw[zone] = Oversampling::to_raw(value, SCAN_BITS);
+
+    unsigned char next = this->channel + 1;
+    if(next >= CHANNEL_COUNT){
+      next = 0;
+      this->end_scan(millis());
+    }
+    this->switch_channel(next);
+  }
+  /**
+  * @brief Switches every pump off right away, e.g. on a fault.
+  */
+  void StopAll(){
+    uint32_t now = millis();
+    for(unsigned char z = 0; z < ZONES; z++){
+      if(this->phase[z] == ZONE_WATERING) this->stop_watering(z, now);
+    }
+  }
+  bool IsAnyPumpOn() const{
+    return this->running > 0;
+  }
+  ZonePhase GetPhase(unsigned char zone) const{
+    return static_cast<ZonePhase>(this->phase[zone]);
+  }
+  /**
+  * @brief Prints the readings of the last full scan, of every zone and of the shared reservoir.
+  */
+  void PrintAll() const{
+    Reservoir().SerialPrint(this->reservoir_raw, this->reservoir_state.stable);
+    for(unsigned char z = 0; z < ZONES; z++){
+      FlashStrings::print_field(F("\nZone "), z);
+      SoilBank().SerialPrint(this->soil_raw[z], this->soil_state[z].stable);
+      DetectionBank().SerialPrint(this->detection_raw[z], this->detection_state[z].stable);
+      FlashStrings::print_field(F("Pump is: "), this->phase[z] == ZONE_WATERING ? F(" On") : this->phase[z] == ZONE_WAITING ? F("Waiting") : F("Off"));
+    }
+    Serial.print(F("\n\n"));
+  }
+};
+
+#endif
+
+#endif